@@ -22,16 +22,70 @@
 #define ARG_LIST_BUILDER_HH
 
 #include "apl-sqlite.hh"
+#include "TemporalConversion.hh"
+#include "NullSentinels.hh"
+#include "RetainedResult.hh"
+
+class ColumnDescriptor {
+public:
+    ColumnDescriptor( const string &name_in, const string &type_in ) : name( name_in ), type( type_in ) {}
+    ColumnDescriptor operator=( ColumnDescriptor &orig ) { return ColumnDescriptor( orig.name, orig.type ); }
+    const string &get_name( void ) { return name; }
+    const string &get_type( void ) { return type; }
+
+private:
+    const string name;
+    const string type;
+};
+
+/*
+ * Type letters used in result type hints. TYPE_HINT_AUTO uses the type of
+ * the value in the first row.
+ */
+enum TypeHint {
+    TYPE_HINT_AUTO = '?',
+    TYPE_HINT_INT = 'i',
+    TYPE_HINT_FLOAT = 'f',
+    TYPE_HINT_STRING = 's'
+};
+
+inline bool is_valid_type_hint( int ch )
+{
+    return ch == TYPE_HINT_AUTO || ch == TYPE_HINT_INT || ch == TYPE_HINT_FLOAT || ch == TYPE_HINT_STRING;
+}
 
 class ArgListBuilder {
 public:
+    ArgListBuilder() : null_sentinels( NULL ) {}
     virtual ~ArgListBuilder() {}
     virtual void append_string( const string &arg, int pos ) = 0;
     virtual void append_long( long arg, int pos ) = 0;
     virtual void append_double( double arg, int pos ) = 0;
     virtual void append_null( int pos ) = 0;
+    virtual void append_timestamp( const TemporalValue &arg, int pos ) { append_string( format_temporal( arg, false ), pos ); }
     virtual Value_P run_query( bool ignore_result ) = 0;
+
+    // Runs the query and keeps the result outside the workspace. By
+    // default, the result is converted in full and kept as an APL value.
+    virtual RetainedResult *run_retained_query( void ) { return new ConvertedResult( run_query( false ) ); }
     virtual void clear_args( void ) = 0;
+
+    // Used by prepared statement handles. make_persistent() is called
+    // once, before the statement is executed for the first time.
+    virtual void make_persistent( void ) {}
+    virtual int get_param_count( void ) = 0;
+    virtual void describe_columns( vector<ColumnDescriptor> &cols ) = 0;
+
+    // One type letter per result column, see TypeHint. Builders that
+    // get the column types from the database ignore the hints.
+    virtual void set_type_hints( const string &hints ) {}
+
+    // When set, nulls in the results are written as the sentinel of
+    // their column, and run_query() stores the null mask in sentinels
+    void set_null_sentinels( NullSentinels *sentinels ) { null_sentinels = sentinels; }
+
+protected:
+    NullSentinels *null_sentinels;
 };
 
 #endif
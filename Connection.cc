@@ -35,3 +35,331 @@ const string Connection::replace_bind_args( const string &sql )
     }
     return out.str();
 }
+
+// Bytes of multibyte UTF-8 characters are treated as identifier characters
+static bool is_identifier_char( char ch )
+{
+    return isalnum( static_cast<unsigned char>( ch ) ) || ch == '_' || (ch & 0x80) != 0;
+}
+
+/*
+ * Returns the length of the dollar quote delimiter ($$ or $tag$) that
+ * starts at pos, or 0 if there isn't one there. A $ that continues an
+ * identifier, or that starts a positional parameter, is not a quote.
+ */
+static size_t dollar_quote_length( const string &script, size_t pos )
+{
+    if( pos > 0 && (is_identifier_char( script[pos - 1] ) || script[pos - 1] == '$') ) {
+        return 0;
+    }
+    size_t i = pos + 1;
+    if( i < script.size() && is_identifier_char( script[i] ) && !isdigit( static_cast<unsigned char>( script[i] ) ) ) {
+        while( i < script.size() && is_identifier_char( script[i] ) ) {
+            i++;
+        }
+    }
+    return i < script.size() && script[i] == '$' ? i + 1 - pos : 0;
+}
+
+/*
+ * Splits the script at semicolons that are not inside quotes, dollar
+ * quoted strings or comments. Statements that are empty are skipped.
+ */
+void Connection::split_script( const string &script, vector<string> &statements )
+{
+    size_t start = 0;
+    size_t i = 0;
+    size_t length;
+    while( i <= script.size() ) {
+        if( i == script.size() || script[i] == ';' ) {
+            string statement = script.substr( start, i - start );
+            if( statement.find_first_not_of( " \t\r\n" ) != string::npos ) {
+                statements.push_back( statement );
+            }
+            start = ++i;
+        }
+        else if( script[i] == '\'' || script[i] == '"' ) {
+            size_t end = script.find( script[i], i + 1 );
+            i = end == string::npos ? script.size() : end + 1;
+        }
+        else if( script[i] == '$' && (length = dollar_quote_length( script, i )) > 0 ) {
+            size_t end = script.find( script.substr( i, length ), i + length );
+            i = end == string::npos ? script.size() : end + length;
+        }
+        else if( script.compare( i, 2, "--" ) == 0 ) {
+            size_t end = script.find( '\n', i );
+            i = end == string::npos ? script.size() : end + 1;
+        }
+        else if( script.compare( i, 2, "/*" ) == 0 ) {
+            size_t end = script.find( "*/", i + 2 );
+            i = end == string::npos ? script.size() : end + 2;
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static void run_transaction_statement( Connection *conn, const string &sql )
+{
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_update( sql ) );
+    arg_list->run_query( true );
+}
+
+/*
+ * Each level of nesting is recorded in nested_savepoints, with an empty
+ * name for the level that began a real transaction.
+ */
+void Connection::nested_begin( void )
+{
+    if( !in_transaction() ) {
+        transaction_begin();
+        nested_savepoints.push_back( "" );
+        return;
+    }
+
+    stringstream name;
+    name << "apl_nested_" << nested_savepoints.size();
+    run_transaction_statement( this, "savepoint " + name.str() );
+    nested_savepoints.push_back( name.str() );
+}
+
+void Connection::nested_commit( void )
+{
+    Assert( nested_savepoints.size() > 0 );
+    string name = nested_savepoints.back();
+    nested_savepoints.pop_back();
+    if( name.size() == 0 ) {
+        transaction_commit();
+    }
+    else {
+        run_transaction_statement( this, "release savepoint " + name );
+    }
+}
+
+void Connection::nested_rollback( void )
+{
+    Assert( nested_savepoints.size() > 0 );
+    string name = nested_savepoints.back();
+    nested_savepoints.pop_back();
+    if( !in_transaction() ) {
+        // Some errors, such as interrupts in SQLite, roll back the
+        // whole transaction by themselves
+        return;
+    }
+    if( name.size() == 0 ) {
+        transaction_rollback();
+    }
+    else {
+        run_transaction_statement( this, "rollback to savepoint " + name );
+        run_transaction_statement( this, "release savepoint " + name );
+    }
+}
+
+void Connection::enable_cache( long max_bytes, long ttl_ms, const string & )
+{
+    delete cache;
+    cache = new ResultCache( max_bytes, ttl_ms );
+}
+
+void Connection::disable_cache( void )
+{
+    delete cache;
+    cache = NULL;
+}
+
+void Connection::enable_slow_log( long threshold_ms, int capacity, const string &filename )
+{
+    delete slow_log;
+    slow_log = new SlowQueryLog( threshold_ms, capacity, filename );
+}
+
+void Connection::disable_slow_log( void )
+{
+    delete slow_log;
+    slow_log = NULL;
+}
+
+void Connection::upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated )
+{
+    Workspace::more_error() = "Upsert is not supported for this database type";
+    DOMAIN_ERROR;
+}
+
+long Connection::add_prepared_statement( PreparedStatement *prepared )
+{
+    long id = next_prepared_statement_id++;
+    prepared_statements[id] = prepared;
+    return id;
+}
+
+PreparedStatement *Connection::find_prepared_statement( long id )
+{
+    map<long, PreparedStatement *>::iterator i = prepared_statements.find( id );
+    if( i == prepared_statements.end() ) {
+        Workspace::more_error() = "Illegal prepared statement handle";
+        DOMAIN_ERROR;
+    }
+    return i->second;
+}
+
+void Connection::remove_prepared_statement( long id )
+{
+    PreparedStatement *prepared = find_prepared_statement( id );
+    prepared_statements.erase( id );
+    delete prepared;
+}
+
+void Connection::close_prepared_statements( void )
+{
+    for( map<long, PreparedStatement *>::iterator i = prepared_statements.begin() ; i != prepared_statements.end() ; i++ ) {
+        delete i->second;
+    }
+    prepared_statements.clear();
+}
+
+long Connection::add_retained_result( RetainedResult *result )
+{
+    long id = next_retained_result_id++;
+    retained_results[id] = result;
+    return id;
+}
+
+RetainedResult *Connection::find_retained_result( long id )
+{
+    map<long, RetainedResult *>::iterator i = retained_results.find( id );
+    if( i == retained_results.end() ) {
+        Workspace::more_error() = "Illegal result handle";
+        DOMAIN_ERROR;
+    }
+    return i->second;
+}
+
+void Connection::remove_retained_result( long id )
+{
+    RetainedResult *result = find_retained_result( id );
+    retained_results.erase( id );
+    delete result;
+}
+
+void Connection::close_retained_results( void )
+{
+    for( map<long, RetainedResult *>::iterator i = retained_results.begin() ; i != retained_results.end() ; i++ ) {
+        delete i->second;
+    }
+    retained_results.clear();
+}
+
+void Connection::enable_write_behind( long max_rows, long max_delay_ms )
+{
+    if( has_apl_callbacks() ) {
+        Workspace::more_error() = "Write-behind can't be used on a connection with APL functions or tables";
+        DOMAIN_ERROR;
+    }
+
+    BatchWriter *writer = make_batch_writer();
+    if( writer == NULL ) {
+        Workspace::more_error() = "Write-behind is not supported for this database type";
+        DOMAIN_ERROR;
+    }
+
+    string error = disable_write_behind();
+    write_behind = new WriteBehindQueue( writer, db_lock, max_rows, max_delay_ms );
+    if( error.size() > 0 ) {
+        Workspace::more_error() = error.c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+/*
+ * Writes everything still in the queue and stops the writer thread.
+ * Returns the last error from the queue, if any.
+ */
+const string Connection::disable_write_behind( void )
+{
+    if( write_behind == NULL ) {
+        return "";
+    }
+
+    write_behind->flush();
+    string error = write_behind->take_error();
+    delete write_behind;
+    write_behind = NULL;
+    return error;
+}
+
+void Connection::close_write_behind( void )
+{
+    string error = disable_write_behind();
+    if( error.size() > 0 ) {
+        CERR << error << endl;
+    }
+}
+
+/*
+ * Waits for the write-behind queue to be written, and keeps the
+ * writer thread out until unlock_for_foreground() is called. Nested
+ * calls from the thread already holding the lock don't wait, since
+ * the writer thread could never get the lock.
+ */
+bool Connection::lock_for_foreground( void )
+{
+    if( write_behind == NULL ) {
+        return false;
+    }
+
+    if( db_lock_owner.load() != std::this_thread::get_id() ) {
+        write_behind->flush();
+    }
+    db_lock.lock();
+    db_lock_owner.store( std::this_thread::get_id() );
+    db_lock_depth++;
+    return true;
+}
+
+void Connection::unlock_for_foreground( void )
+{
+    if( --db_lock_depth == 0 ) {
+        db_lock_owner.store( std::thread::id() );
+    }
+    db_lock.unlock();
+}
+
+void Connection::raise_write_behind_error( void )
+{
+    if( write_behind == NULL ) {
+        return;
+    }
+
+    string error = write_behind->take_error();
+    if( error.size() > 0 ) {
+        Workspace::more_error() = error.c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+const vector<string> &Connection::get_tables( void )
+{
+    schema_cache.validate( read_schema_version() );
+    vector<string> *tables = schema_cache.find_tables();
+    if( tables == NULL ) {
+        vector<string> result;
+        fill_tables( result );
+        schema_cache.set_tables( result );
+        tables = schema_cache.find_tables();
+    }
+    return *tables;
+}
+
+const TableInfo &Connection::get_table_info( const string &table )
+{
+    schema_cache.validate( read_schema_version() );
+    TableInfo *info = schema_cache.find_table_info( table );
+    if( info == NULL ) {
+        TableInfo result;
+        fill_table_info( table, result );
+        info = schema_cache.add_table_info( table );
+        *info = result;
+    }
+    return *info;
+}
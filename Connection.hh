@@ -23,35 +23,172 @@
 
 #include "apl-sqlite.hh"
 #include "ArgListBuilder.hh"
+#include "ResultCache.hh"
+#include "SlowQueryLog.hh"
+#include "SchemaCache.hh"
+#include "StatementLimits.hh"
+#include "Upsert.hh"
+#include "CsvImport.hh"
+#include "WriteBehindQueue.hh"
 
 #include <stdlib.h>
 
-class ColumnDescriptor {
+/*
+ * A statement prepared once and executed many times. Statements are
+ * owned by the connection, and are referred to from APL using the id
+ * returned by Connection::add_prepared_statement().
+ */
+class PreparedStatement {
 public:
-    ColumnDescriptor( const string &name_in, const string &type_in ) : name( name_in ), type( type_in ) {}
-    ColumnDescriptor operator=( ColumnDescriptor &orig ) { return ColumnDescriptor( orig.name, orig.type ); }
-    const string &get_name( void ) { return name; }
-    const string &get_type( void ) { return type; }
+    PreparedStatement( const string &sql_in, const string &statement_in, ArgListBuilder *builder_in, bool query_in )
+        : sql( sql_in ), statement( statement_in ), builder( builder_in ), query( query_in ) {}
+    ~PreparedStatement() { delete builder; }
+    const string &get_sql( void ) { return sql; }
+    const string &get_statement( void ) { return statement; }
+    ArgListBuilder *get_builder( void ) { return builder; }
+    bool is_query( void ) { return query; }
 
 private:
-    const string name;
-    const string type;
+    const string sql;
+    const string statement;
+    ArgListBuilder *builder;
+    const bool query;
 };
 
 class Connection
 {
 public:
-    virtual ~Connection() {}
+    Connection() : cache( NULL ), slow_log( NULL ), next_prepared_statement_id( 1 ),
+                   next_retained_result_id( 1 ), write_behind( NULL ), db_lock_depth( 0 ), temporal_mode( TEMPORAL_TEXT ),
+                   active_limiter( NULL ), statement_stopped( false ) {}
+    virtual ~Connection() { close_write_behind(); close_prepared_statements(); close_retained_results(); delete cache; delete slow_log; }
     virtual ArgListBuilder *make_prepared_query( const string &sql ) = 0;
     virtual ArgListBuilder *make_prepared_update( const string &sql ) = 0;
     virtual void transaction_begin( void ) = 0;
     virtual void transaction_commit( void ) = 0;
     virtual void transaction_rollback( void ) = 0;
+
+    // True if a transaction is open, whoever started it
+    virtual bool in_transaction( void ) = 0;
+
+    // Transactions used internally by a single operation. When a
+    // transaction is already open, a savepoint is used instead, so that
+    // the enclosing transaction is left for its owner to end.
+    void nested_begin( void );
+    void nested_commit( void );
+    void nested_rollback( void );
+
     virtual void fill_tables( vector<string> &tables ) = 0;
-    virtual void fill_cols( const string &table, vector<ColumnDescriptor> &cols ) = 0;
+    virtual void fill_table_info( const string &table, TableInfo &info ) = 0;
+
+    // A value that changes whenever the schema of the database changes
+    virtual const string read_schema_version( void ) = 0;
+
+    // Table metadata, from the schema cache when the schema hasn't changed
+    const vector<string> &get_tables( void );
+    const TableInfo &get_table_info( const string &table );
     virtual const string make_positional_param( int pos ) = 0;
 
     virtual const string replace_bind_args( const string &sql );
+
+    // Splits a script into separate statements
+    virtual void split_script( const string &script, vector<string> &statements );
+
+    ResultCache *get_cache( void ) { return cache; }
+    virtual void enable_cache( long max_bytes, long ttl_ms, const string &channel );
+    virtual void disable_cache( void );
+
+    // Called before each cache lookup, to discard results that may have
+    // been changed by someone else
+    virtual void validate_cache( void ) {}
+
+    SlowQueryLog *get_slow_log( void ) { return slow_log; }
+    virtual void enable_slow_log( long threshold_ms, int capacity, const string &filename );
+    virtual void disable_slow_log( void );
+
+    // Prefix used to get the plan of a statement for the slow query log
+    virtual const string make_explain_prefix( bool query ) = 0;
+
+    // Engine specific counters for the slow query log, collected since
+    // the last reset
+    virtual void reset_statement_details( void ) {}
+    virtual const string take_statement_details( void ) { return ""; }
+
+    // Write-behind mode. Updates are queued and written by a background
+    // thread, and every other use of the connection first waits for the
+    // queue to be written and then holds db_lock.
+    WriteBehindQueue *get_write_behind( void ) { return write_behind; }
+    void enable_write_behind( long max_rows, long max_delay_ms );
+    const string disable_write_behind( void );
+    virtual BatchWriter *make_batch_writer( void ) { return NULL; }
+
+    // True if statements may call APL functions or read APL tables. The
+    // writer thread must never run interpreter code, so these can't be
+    // combined with write-behind.
+    virtual bool has_apl_callbacks( void ) { return false; }
+    bool lock_for_foreground( void );
+    void unlock_for_foreground( void );
+    void raise_write_behind_error( void );
+
+    // How date and time columns are returned
+    TemporalMode get_temporal_mode( void ) { return temporal_mode; }
+    void set_temporal_mode( TemporalMode mode ) { temporal_mode = mode; }
+
+    // Text of a timestamp copied for the write-behind queue or an upsert,
+    // matching what the connection's argument lists bind
+    virtual const string format_timestamp( const TemporalValue &value ) { return format_temporal( value, false ); }
+
+    // Limits on the time and size of each statement. The active limiter
+    // belongs to the statement that is currently running, if any.
+    const QueryLimits &get_limits( void ) { return limits; }
+    void set_limits( const QueryLimits &limits_in ) { limits = limits_in; }
+    StatementLimiter *get_active_limiter( void ) { return active_limiter; }
+    void set_active_limiter( StatementLimiter *limiter ) { active_limiter = limiter; }
+
+    // True if the last statement was stopped by an interrupt or a limit,
+    // rather than failing in the database
+    bool was_statement_stopped( void ) { return statement_stopped; }
+    void set_statement_stopped( bool stopped ) { statement_stopped = stopped; }
+
+    // Inserts or updates the rows of binds, which has one value per
+    // column of spec. Called inside a transaction.
+    virtual void upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated );
+
+    // Writes the rows of a file import, or returns NULL if imports are
+    // not supported
+    virtual TableImporter *make_table_importer( const string &table, const vector<string> &columns ) { return NULL; }
+
+    long add_prepared_statement( PreparedStatement *prepared );
+    PreparedStatement *find_prepared_statement( long id );
+    void remove_prepared_statement( long id );
+
+    long add_retained_result( RetainedResult *result );
+    RetainedResult *find_retained_result( long id );
+    void remove_retained_result( long id );
+
+protected:
+    // Has to be called by subclasses before closing the underlying
+    // database, since the statements refer to it
+    void close_prepared_statements( void );
+    void close_write_behind( void );
+    void close_retained_results( void );
+
+    ResultCache *cache;
+    SlowQueryLog *slow_log;
+    SchemaCache schema_cache;
+    map<long, PreparedStatement *> prepared_statements;
+    long next_prepared_statement_id;
+    map<long, RetainedResult *> retained_results;
+    vector<string> nested_savepoints;
+    long next_retained_result_id;
+    WriteBehindQueue *write_behind;
+    std::recursive_mutex db_lock;
+    std::atomic<std::thread::id> db_lock_owner;
+    int db_lock_depth;
+    TemporalMode temporal_mode;
+    QueryLimits limits;
+    StatementLimiter *active_limiter;
+    bool statement_stopped;
 };
 
 #endif
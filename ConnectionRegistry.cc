@@ -0,0 +1,179 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ConnectionRegistry.hh"
+
+static const uint64_t SLOT_OPEN = 1UL << 31;
+static const uint64_t REF_COUNT_MASK = SLOT_OPEN - 1;
+static const long INDEX_MASK = (1L << HANDLE_INDEX_BITS) - 1;
+
+static uint32_t state_generation( uint64_t state )
+{
+    return state >> 32;
+}
+
+ConnectionRef::ConnectionRef( RegistrySlot *slot_in, bool exclusive )
+    : slot( slot_in ), locked( false )
+{
+    if( exclusive ) {
+        locked = slot->connection->lock_for_foreground();
+    }
+}
+
+ConnectionRef::~ConnectionRef()
+{
+    if( slot != NULL ) {
+        if( locked ) {
+            slot->connection->unlock_for_foreground();
+        }
+        slot->registry->release( slot );
+    }
+}
+
+ConnectionRegistry::~ConnectionRegistry()
+{
+    for( int i = 0 ; i < MAX_CHUNKS ; i++ ) {
+        delete[] chunks[i].load();
+    }
+}
+
+RegistrySlot *ConnectionRegistry::get_slot( int index )
+{
+    RegistrySlot *chunk = chunks[index / SLOTS_PER_CHUNK].load( std::memory_order_acquire );
+    if( chunk == NULL ) {
+        return NULL;
+    }
+    return &chunk[index % SLOTS_PER_CHUNK];
+}
+
+long ConnectionRegistry::add( Connection *connection )
+{
+    std::lock_guard<std::mutex> guard( lock );
+
+    int index;
+    if( !free_list.empty() ) {
+        index = free_list.back();
+        free_list.pop_back();
+    }
+    else {
+        if( num_slots == MAX_CHUNKS * SLOTS_PER_CHUNK ) {
+            return -1;
+        }
+        index = num_slots++;
+        if( index % SLOTS_PER_CHUNK == 0 ) {
+            RegistrySlot *chunk = new RegistrySlot[SLOTS_PER_CHUNK];
+            for( int i = 0 ; i < SLOTS_PER_CHUNK ; i++ ) {
+                chunk[i].registry = this;
+                chunk[i].index = index + i;
+            }
+            chunks[index / SLOTS_PER_CHUNK].store( chunk, std::memory_order_release );
+        }
+    }
+
+    RegistrySlot *slot = get_slot( index );
+    uint32_t generation = state_generation( slot->state.load() );
+    slot->connection = connection;
+    slot->state.store( (static_cast<uint64_t>( generation ) << 32) | SLOT_OPEN, std::memory_order_release );
+
+    return (static_cast<long>( generation ) << HANDLE_INDEX_BITS) | index;
+}
+
+bool ConnectionRegistry::lookup( long handle, RegistrySlot **result )
+{
+    if( handle < 0 ) {
+        return false;
+    }
+
+    RegistrySlot *slot = get_slot( handle & INDEX_MASK );
+    if( slot == NULL ) {
+        return false;
+    }
+
+    uint32_t generation = handle >> HANDLE_INDEX_BITS;
+    uint64_t state = slot->state.load( std::memory_order_acquire );
+    do {
+        if( (state & SLOT_OPEN) == 0 || state_generation( state ) != generation ) {
+            return false;
+        }
+    } while( !slot->state.compare_exchange_weak( state, state + 1, std::memory_order_acquire ) );
+
+    *result = slot;
+    return true;
+}
+
+bool ConnectionRegistry::remove( long handle )
+{
+    RegistrySlot *slot;
+    if( !lookup( handle, &slot ) ) {
+        return false;
+    }
+
+    // Clearing the open flag can only succeed for one caller, so
+    // concurrent closes of the same handle are safe
+    uint64_t state = slot->state.load();
+    do {
+        if( (state & SLOT_OPEN) == 0 ) {
+            release( slot );
+            return false;
+        }
+    } while( !slot->state.compare_exchange_weak( state, state & ~SLOT_OPEN ) );
+
+    // Unless other references are still held, this deletes the
+    // connection. Waiting for them instead would never finish when the
+    // caller holds one, for example a function called by a query on
+    // this connection that closes it.
+    release( slot );
+    return true;
+}
+
+void ConnectionRegistry::release( RegistrySlot *slot )
+{
+    uint64_t state = slot->state.fetch_sub( 1 );
+    if( (state & SLOT_OPEN) == 0 && (state & REF_COUNT_MASK) == 1 ) {
+        free_slot( slot );
+    }
+}
+
+void ConnectionRegistry::free_slot( RegistrySlot *slot )
+{
+    Connection *connection = slot->connection;
+    slot->connection = NULL;
+
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        uint32_t generation = state_generation( slot->state.load() ) + 1;
+        slot->state.store( static_cast<uint64_t>( generation ) << 32, std::memory_order_release );
+        free_list.push_back( slot->index );
+    }
+
+    delete connection;
+}
+
+void ConnectionRegistry::close_all( void )
+{
+    for( int i = 0 ; i < num_slots ; i++ ) {
+        RegistrySlot *slot = get_slot( i );
+        uint64_t state = slot->state.load();
+        if( (state & SLOT_OPEN) != 0 ) {
+            long handle = (static_cast<long>( state_generation( state ) ) << HANDLE_INDEX_BITS) | i;
+            remove( handle );
+        }
+    }
+}
@@ -0,0 +1,111 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONNECTION_REGISTRY_HH
+#define CONNECTION_REGISTRY_HH
+
+#include "Connection.hh"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+ * Handles given to APL pack the slot index in the low bits and the
+ * generation of the slot in the high bits. Every time a slot is freed
+ * its generation is incremented, so a stale handle can never refer to
+ * a connection that was later opened in the same slot.
+ */
+static const int HANDLE_INDEX_BITS = 16;
+static const int SLOTS_PER_CHUNK = 256;
+static const int MAX_CHUNKS = (1 << HANDLE_INDEX_BITS) / SLOTS_PER_CHUNK;
+
+class ConnectionRegistry;
+
+class RegistrySlot {
+public:
+    RegistrySlot() : state( 0 ), connection( NULL ), registry( NULL ), index( 0 ) {}
+
+    /*
+     * The state word holds the generation in the upper 32 bits, a flag
+     * indicating that the slot is open, and the number of active
+     * references in the remaining bits.
+     */
+    std::atomic<uint64_t> state;
+    Connection *connection;
+    ConnectionRegistry *registry;
+    int index;
+};
+
+/*
+ * A reference to an open connection. Closing the handle makes it
+ * invalid for new references, but the connection is only deleted once
+ * all references to it have been released. An exclusive
+ * reference also waits for any write-behind queue to be written, and
+ * keeps the writer thread out while the reference exists.
+ */
+class ConnectionRef {
+public:
+    ConnectionRef( RegistrySlot *slot_in, bool exclusive );
+    ConnectionRef( ConnectionRef &&orig ) : slot( orig.slot ), locked( orig.locked ) { orig.slot = NULL; }
+    ~ConnectionRef();
+    Connection *get( void ) { return slot->connection; }
+    Connection *operator->( void ) { return slot->connection; }
+    operator Connection *( void ) { return slot->connection; }
+
+private:
+    ConnectionRef( const ConnectionRef &orig );
+    ConnectionRef &operator=( const ConnectionRef &orig );
+    RegistrySlot *slot;
+    bool locked;
+};
+
+class ConnectionRegistry {
+public:
+    ConnectionRegistry() : num_slots( 0 ) {
+        for( int i = 0 ; i < MAX_CHUNKS ; i++ ) {
+            chunks[i].store( NULL );
+        }
+    }
+    ~ConnectionRegistry();
+
+    long add( Connection *connection );
+    bool lookup( long handle, RegistrySlot **result );
+
+    // Closes the handle. The connection is deleted by the last reference
+    // to it, which may be held by the caller. Returns false if the handle
+    // is not open.
+    bool remove( long handle );
+    void close_all( void );
+
+    // Drops a reference taken by lookup()
+    void release( RegistrySlot *slot );
+
+private:
+    RegistrySlot *get_slot( int index );
+    void free_slot( RegistrySlot *slot );
+
+    std::atomic<RegistrySlot *> chunks[MAX_CHUNKS];
+    std::mutex lock;
+    std::vector<int> free_list;
+    int num_slots;
+};
+
+#endif
@@ -0,0 +1,449 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "CsvImport.hh"
+
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Connection.hh"
+
+static void raise_import_option_error( const string &message, const string &value )
+{
+    stringstream out;
+    out << message << ": " << value;
+    Workspace::more_error() = out.str().c_str();
+    DOMAIN_ERROR;
+}
+
+static void split_names( const string &value, vector<string> &names )
+{
+    names.clear();
+    size_t start = 0;
+    while( true ) {
+        size_t comma = value.find( ',', start );
+        names.push_back( value.substr( start, comma == string::npos ? string::npos : comma - start ) );
+        if( comma == string::npos ) {
+            break;
+        }
+        start = comma + 1;
+    }
+}
+
+void CsvImportOptions::set( const string &key, const string &value )
+{
+    if( key == "delimiter" ) {
+        if( value == "tab" ) {
+            delimiter = '\t';
+        }
+        else if( value.size() == 1 && value[0] != '\n' && value[0] != '\r' ) {
+            delimiter = value[0];
+        }
+        else {
+            raise_import_option_error( "Delimiter must be a single character or tab", value );
+        }
+    }
+    else if( key == "quote" ) {
+        if( value.size() > 1 ) {
+            raise_import_option_error( "Quote must be a single character, or empty for no quoting", value );
+        }
+        quote = value.size() == 0 ? 0 : value[0];
+    }
+    else if( key == "header" ) {
+        if( value != "0" && value != "1" ) {
+            raise_import_option_error( "Header must be 0 or 1", value );
+        }
+        header = value == "1";
+    }
+    else if( key == "types" ) {
+        for( string::const_iterator i = value.begin() ; i != value.end() ; i++ ) {
+            if( !is_valid_type_hint( *i ) ) {
+                raise_import_option_error( "Illegal type, expected one of i, f, s or ?", value );
+            }
+        }
+        types = value;
+    }
+    else if( key == "columns" ) {
+        split_names( value, columns );
+    }
+    else if( key == "batch_rows" ) {
+        char *endptr;
+        batch_rows = strtol( value.c_str(), &endptr, 10 );
+        if( value.size() == 0 || *endptr != 0 || batch_rows < 1 ) {
+            raise_import_option_error( "Illegal batch_rows", value );
+        }
+    }
+    else {
+        raise_import_option_error( "Unknown import option", key );
+    }
+}
+
+const string CsvField::text( char quote ) const
+{
+    if( !escaped ) {
+        return string( data, length );
+    }
+    string result;
+    result.reserve( length );
+    for( size_t i = 0 ; i < length ; i++ ) {
+        result += data[i];
+        if( data[i] == quote ) {
+            i++;
+        }
+    }
+    return result;
+}
+
+CsvScanner::CsvScanner( const char *data_in, size_t size_in, char delimiter_in, char quote_in )
+    : pos( data_in ), end( data_in + size_in ), next_line( 1 ), delimiter( delimiter_in ), quote( quote_in )
+{
+    // UTF-8 byte order mark
+    if( size_in >= 3 && memcmp( data_in, "\xef\xbb\xbf", 3 ) == 0 ) {
+        pos += 3;
+    }
+}
+
+void CsvScanner::skip_line( void )
+{
+    const char *newline = static_cast<const char *>( memchr( pos, '\n', end - pos ) );
+    pos = newline == NULL ? end : newline + 1;
+    next_line++;
+}
+
+bool CsvScanner::next_record( vector<CsvField> &fields, long *line, string &error )
+{
+    fields.clear();
+    error.clear();
+    while( pos < end ) {
+        *line = next_line;
+        const char *newline = static_cast<const char *>( memchr( pos, '\n', end - pos ) );
+        const char *line_end = newline == NULL ? end : newline;
+        if( quote != 0 && memchr( pos, quote, line_end - pos ) != NULL ) {
+            scan_quoted_record( fields, error );
+            return true;
+        }
+
+        const char *record_end = line_end;
+        if( record_end > pos && record_end[-1] == '\r' ) {
+            record_end--;
+        }
+        if( record_end == pos ) {
+            skip_line();
+            continue;
+        }
+
+        const char *field = pos;
+        const char *delim;
+        while( (delim = static_cast<const char *>( memchr( field, delimiter, record_end - field ) )) != NULL ) {
+            fields.push_back( CsvField( field, delim - field, false, false ) );
+            field = delim + 1;
+        }
+        fields.push_back( CsvField( field, record_end - field, false, false ) );
+        pos = newline == NULL ? end : newline + 1;
+        next_line++;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Quoted fields may contain delimiters, newlines and doubled quotes
+ */
+void CsvScanner::scan_quoted_record( vector<CsvField> &fields, string &error )
+{
+    const char *p = pos;
+    while( true ) {
+        if( p < end && *p == quote ) {
+            const char *start = ++p;
+            bool escaped = false;
+            const char *closing;
+            while( true ) {
+                closing = static_cast<const char *>( memchr( p, quote, end - p ) );
+                if( closing == NULL ) {
+                    error = "Unterminated quoted field";
+                    pos = end;
+                    return;
+                }
+                for( const char *c = p ; (c = static_cast<const char *>( memchr( c, '\n', closing - c ) )) != NULL ; c++ ) {
+                    next_line++;
+                }
+                if( closing + 1 < end && closing[1] == quote ) {
+                    escaped = true;
+                    p = closing + 2;
+                    continue;
+                }
+                break;
+            }
+            fields.push_back( CsvField( start, closing - start, true, escaped ) );
+            p = closing + 1;
+            if( p < end && *p == '\r' && p + 1 < end && p[1] == '\n' ) {
+                p++;
+            }
+            if( p < end && *p != delimiter && *p != '\n' ) {
+                error = "Unexpected character after quoted field";
+                pos = p;
+                skip_line();
+                return;
+            }
+        }
+        else {
+            const char *start = p;
+            while( p < end && *p != delimiter && *p != '\n' ) {
+                p++;
+            }
+            const char *field_end = p;
+            if( field_end > start && field_end[-1] == '\r' && (p == end || *p == '\n') ) {
+                field_end--;
+            }
+            fields.push_back( CsvField( start, field_end - start, false, false ) );
+        }
+
+        if( p < end && *p == delimiter ) {
+            p++;
+            continue;
+        }
+        pos = p < end ? p + 1 : end;
+        next_line++;
+        return;
+    }
+}
+
+MappedFile::MappedFile( const string &filename ) : data( NULL ), size( 0 )
+{
+    int fd = open( filename.c_str(), O_RDONLY );
+    struct stat info;
+    if( fd == -1 || fstat( fd, &info ) == -1 ) {
+        stringstream out;
+        out << "Error opening " << filename << ": " << strerror( errno );
+        if( fd != -1 ) {
+            close( fd );
+        }
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+
+    size = info.st_size;
+    if( size > 0 ) {
+        void *mapped = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( mapped == MAP_FAILED ) {
+            stringstream out;
+            out << "Error mapping " << filename << ": " << strerror( errno );
+            close( fd );
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+        madvise( mapped, size, MADV_SEQUENTIAL );
+        data = static_cast<const char *>( mapped );
+    }
+    close( fd );
+}
+
+MappedFile::~MappedFile()
+{
+    if( data != NULL ) {
+        munmap( const_cast<char *>( data ), size );
+    }
+}
+
+static bool parse_long( const string &text, long *value )
+{
+    char *endptr;
+    errno = 0;
+    *value = strtol( text.c_str(), &endptr, 10 );
+    return text.size() > 0 && *endptr == 0 && errno == 0;
+}
+
+static bool parse_double( const string &text, double *value )
+{
+    char *endptr;
+    *value = strtod( text.c_str(), &endptr );
+    return text.size() > 0 && *endptr == 0;
+}
+
+/*
+ * Empty fields that are not quoted are nulls. Returns false if the
+ * field can't be converted to its type.
+ */
+static bool field_to_bind( const CsvField &field, char quote, TypeHint type, QueuedBind &bind )
+{
+    if( field.length == 0 && !field.quoted ) {
+        bind.type = QueuedBind::BIND_NULL;
+        return true;
+    }
+
+    string text = field.text( quote );
+    if( (type == TYPE_HINT_INT || type == TYPE_HINT_AUTO) && parse_long( text, &bind.long_value ) ) {
+        bind.type = QueuedBind::BIND_LONG;
+    }
+    else if( (type == TYPE_HINT_FLOAT || type == TYPE_HINT_AUTO) && parse_double( text, &bind.double_value ) ) {
+        bind.type = QueuedBind::BIND_DOUBLE;
+    }
+    else if( type == TYPE_HINT_STRING || type == TYPE_HINT_AUTO ) {
+        bind.type = QueuedBind::BIND_STRING;
+        bind.string_value = text;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static long write_import_batch( Connection *conn, TableImporter *importer, vector<QueuedBind> &binds,
+                                vector<long> &lines, vector<pair<long, string> > &rejected )
+{
+    if( lines.size() == 0 ) {
+        return 0;
+    }
+
+    long written;
+    conn->nested_begin();
+    try {
+        written = importer->write_batch( binds, lines, rejected );
+    }
+    catch( ... ) {
+        try {
+            conn->nested_rollback();
+        }
+        catch( ... ) {
+            // The original error is more interesting
+        }
+        throw;
+    }
+    conn->nested_commit();
+
+    binds.clear();
+    lines.clear();
+
+    // The batches that have been written are kept
+    if( attention_raised || interrupt_raised ) {
+        attention_raised = false;
+        interrupt_raised = false;
+        Workspace::more_error() = "Import interrupted";
+        INTERRUPT;
+    }
+    return written;
+}
+
+static bool rejected_line_less( const pair<long, string> &a, const pair<long, string> &b )
+{
+    return a.first < b.first;
+}
+
+long import_csv_file( Connection *conn, const string &filename, const string &table,
+                      const CsvImportOptions &options, vector<pair<long, string> > &rejected )
+{
+    MappedFile file( filename );
+    CsvScanner scanner( file.get_data(), file.get_size(), options.delimiter, options.quote );
+    vector<CsvField> fields;
+    long line;
+    string error;
+
+    vector<string> names = options.columns;
+    if( options.header ) {
+        if( !scanner.next_record( fields, &line, error ) ) {
+            return 0;
+        }
+        if( error.size() > 0 ) {
+            stringstream out;
+            out << "Error in header: " << error;
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+        if( names.size() == 0 ) {
+            for( vector<CsvField>::iterator i = fields.begin() ; i != fields.end() ; i++ ) {
+                names.push_back( i->text( options.quote ) );
+            }
+        }
+    }
+    if( names.size() == 0 ) {
+        const vector<ColumnInfo> &columns = conn->get_table_info( table ).columns;
+        for( vector<ColumnInfo>::const_iterator i = columns.begin() ; i != columns.end() ; i++ ) {
+            names.push_back( i->name );
+        }
+    }
+
+    // Fields without a column name are skipped
+    vector<int> field_indexes;
+    vector<string> target_columns;
+    for( size_t i = 0 ; i < names.size() ; i++ ) {
+        if( names[i].size() > 0 ) {
+            field_indexes.push_back( i );
+            target_columns.push_back( names[i] );
+        }
+    }
+    if( target_columns.size() == 0 ) {
+        Workspace::more_error() = "No columns to import";
+        DOMAIN_ERROR;
+    }
+
+    auto_ptr<TableImporter> importer( conn->make_table_importer( table, target_columns ) );
+    if( importer.get() == NULL ) {
+        Workspace::more_error() = "Import is not supported for this database type";
+        DOMAIN_ERROR;
+    }
+
+    int cols = target_columns.size();
+    vector<QueuedBind> binds;
+    vector<long> lines;
+    binds.reserve( options.batch_rows * cols );
+    long written = 0;
+    while( scanner.next_record( fields, &line, error ) ) {
+        if( error.size() == 0 && fields.size() != names.size() ) {
+            stringstream out;
+            out << "Expected " << names.size() << " fields, found " << fields.size();
+            error = out.str();
+        }
+
+        size_t row_start = binds.size();
+        for( int col = 0 ; col < cols && error.size() == 0 ; col++ ) {
+            int field = field_indexes[col];
+            TypeHint type = field < options.types.size() ? static_cast<TypeHint>( options.types[field] ) : TYPE_HINT_STRING;
+            binds.push_back( QueuedBind() );
+            if( !field_to_bind( fields[field], options.quote, type, binds.back() ) ) {
+                stringstream out;
+                out << "Field " << (field + 1) << " is not " << (type == TYPE_HINT_INT ? "an integer" : "a number");
+                error = out.str();
+            }
+        }
+
+        if( error.size() > 0 ) {
+            binds.resize( row_start );
+            rejected.push_back( pair<long, string>( line, error ) );
+            continue;
+        }
+
+        lines.push_back( line );
+        if( static_cast<long>( lines.size() ) >= options.batch_rows ) {
+            written += write_import_batch( conn, importer.get(), binds, lines, rejected );
+        }
+    }
+    written += write_import_batch( conn, importer.get(), binds, lines, rejected );
+
+    // Lines rejected by the database are added when their batch is
+    // written, after later lines may have been rejected by the parser
+    stable_sort( rejected.begin(), rejected.end(), rejected_line_less );
+    return written;
+}
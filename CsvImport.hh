@@ -0,0 +1,128 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef CSV_IMPORT_HH
+#define CSV_IMPORT_HH
+
+#include "apl-sqlite.hh"
+#include "WriteBehindQueue.hh"
+
+class Connection;
+
+class CsvImportOptions {
+public:
+    CsvImportOptions() : delimiter( ',' ), quote( '"' ), header( true ), batch_rows( 10000 ) {}
+    void set( const string &key, const string &value );
+
+    char delimiter;
+
+    // 0 if fields are never quoted
+    char quote;
+    bool header;
+
+    // One type letter per field, see TypeHint. Fields without a type
+    // are written as text.
+    string types;
+
+    // The column of each field, with an empty name for fields that are
+    // skipped. When empty, the names in the header are used, or the
+    // columns of the table in order if there is no header.
+    vector<string> columns;
+    long batch_rows;
+};
+
+/*
+ * A field points into the file. Quoted fields that contain doubled
+ * quotes are escaped, and have to be unescaped to get their text.
+ */
+class CsvField {
+public:
+    CsvField( const char *data_in, size_t length_in, bool quoted_in, bool escaped_in )
+        : data( data_in ), length( length_in ), quoted( quoted_in ), escaped( escaped_in ) {}
+    const string text( char quote ) const;
+    const char *data;
+    size_t length;
+    bool quoted;
+    bool escaped;
+};
+
+/*
+ * Splits a delimited file into records. Records without quotes are
+ * split with memchr(), which is vectorized by the C library, and only
+ * records that contain the quote character are scanned one character
+ * at a time.
+ */
+class CsvScanner {
+public:
+    CsvScanner( const char *data_in, size_t size_in, char delimiter_in, char quote_in );
+
+    // Reads the next record, skipping empty lines. Returns false at the
+    // end of the file. line is the line number where the record starts.
+    // If the record is malformed, error is set and the rest of the line
+    // is skipped.
+    bool next_record( vector<CsvField> &fields, long *line, string &error );
+
+private:
+    void scan_quoted_record( vector<CsvField> &fields, string &error );
+    void skip_line( void );
+    const char *pos;
+    const char *end;
+    long next_line;
+    const char delimiter;
+    const char quote;
+};
+
+/*
+ * A file mapped into memory for reading
+ */
+class MappedFile {
+public:
+    MappedFile( const string &filename );
+    ~MappedFile();
+    const char *get_data( void ) { return data; }
+    size_t get_size( void ) { return size; }
+
+private:
+    const char *data;
+    size_t size;
+};
+
+/*
+ * Writes imported rows to a table. Implementations keep their prepared
+ * statement for the whole import. write_batch() is called inside a
+ * transaction, adds the rows that the database rejects to rejected,
+ * and returns the number of rows that were written.
+ */
+class TableImporter {
+public:
+    virtual ~TableImporter() {}
+    virtual long write_batch( const vector<QueuedBind> &binds, const vector<long> &lines,
+                              vector<pair<long, string> > &rejected ) = 0;
+};
+
+// Imports the file into the table, one transaction per batch, or one
+// savepoint per batch inside an open transaction. Returns the number
+// of rows written. Rejected lines are returned with their
+// line numbers and the reason.
+long import_csv_file( Connection *conn, const string &filename, const string &table,
+                      const CsvImportOptions &options, vector<pair<long, string> > &rejected );
+
+#endif
@@ -0,0 +1,57 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "NullSentinels.hh"
+
+#include "Value.hh"
+#include "IntCell.hh"
+#include "FloatCell.hh"
+#include "CharCell.hh"
+#include "PointerCell.hh"
+
+void NullSentinel::fill( Cell *cell ) const
+{
+    switch( kind ) {
+    case SENTINEL_INT:
+        new (cell) IntCell( int_value );
+        break;
+    case SENTINEL_FLOAT:
+        new (cell) FloatCell( float_value );
+        break;
+    case SENTINEL_CHAR:
+        new (cell) CharCell( static_cast<Unicode>( int_value ) );
+        break;
+    case SENTINEL_EMPTY_STRING:
+        new (cell) PointerCell( Str0( LOC ) );
+        break;
+    }
+}
+
+Value_P make_null_mask( long rows, int cols )
+{
+    Value_P mask( new Value( Shape( rows, cols ), LOC ) );
+    long n = rows * cols;
+    for( long i = 0 ; i < n ; i++ ) {
+        new (mask->next_ravel()) IntCell( 0 );
+    }
+    mask->check_value( LOC );
+    return mask;
+}
@@ -0,0 +1,68 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef NULL_SENTINELS_HH
+#define NULL_SENTINELS_HH
+
+#include "apl-sqlite.hh"
+
+/*
+ * The value written instead of ⍬ for a null in a column
+ */
+class NullSentinel {
+public:
+    enum Kind { SENTINEL_INT, SENTINEL_FLOAT, SENTINEL_CHAR, SENTINEL_EMPTY_STRING };
+
+    NullSentinel( Kind kind_in, APL_Integer int_value_in, APL_Float float_value_in )
+        : kind( kind_in ), int_value( int_value_in ), float_value( float_value_in ) {}
+
+    // Simple sentinels don't allocate an APL value, so they can be
+    // written from the worker threads
+    bool is_simple( void ) const { return kind != SENTINEL_EMPTY_STRING; }
+    void fill( Cell *cell ) const;
+
+private:
+    Kind kind;
+    APL_Integer int_value;
+    APL_Float float_value;
+};
+
+/*
+ * Sentinels for the columns of one query, and the mask of null
+ * positions produced by running it. The last sentinel is used for all
+ * remaining columns.
+ */
+class NullSentinels {
+public:
+    NullSentinels( const vector<NullSentinel> &sentinels_in ) : sentinels( sentinels_in ) {}
+    const NullSentinel &for_column( int col ) const { return sentinels[min( static_cast<size_t>( col ), sentinels.size() - 1 )]; }
+    Value_P get_mask( void ) { return mask; }
+    void set_mask( Value_P mask_in ) { mask = mask_in; }
+
+private:
+    vector<NullSentinel> sentinels;
+    Value_P mask;
+};
+
+// A rows by cols mask with all cells set to 0
+Value_P make_null_mask( long rows, int cols );
+
+#endif
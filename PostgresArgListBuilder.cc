@@ -21,6 +21,11 @@
 #include "PostgresArgListBuilder.hh"
 
 #include <string.h>
+#include <poll.h>
+#include <charconv>
+
+#include "ThreadPool.hh"
+#include "QueryStats.hh"
 
 template<class T>
 PostgresBindArg<T>::~PostgresBindArg()
@@ -75,6 +80,23 @@ void PostgresBindArg<double>::update( Oid *types, const char **values, int *leng
     formats[pos] = 0;
 }
 
+/*
+ * Timestamps are sent in UTC without a type, so that the server converts
+ * them to the type of the column or expression.
+ */
+template<>
+void PostgresBindArg<TemporalValue>::update( Oid *types, const char **values, int *lengths, int *formats, int pos )
+{
+    types[pos] = 0;
+    string_arg = strdup( format_temporal( arg, true ).c_str() );
+    if( string_arg == NULL ) {
+        abort();
+    }
+    values[pos] = string_arg;
+    lengths[pos] = 0;
+    formats[pos] = 0;
+}
+
 void PostgresNullArg::update( Oid *types, const char **values, int *lengths, int *formats, int pos )
 {
     types[pos] = 0;
@@ -91,6 +113,86 @@ PostgresArgListBuilder::PostgresArgListBuilder( PostgresConnection *connection_i
 PostgresArgListBuilder::~PostgresArgListBuilder()
 {
     clear_args();
+    if( statement_name.size() > 0 ) {
+        stringstream sql;
+        sql << "deallocate " << statement_name;
+        PQclear( PQexec( connection->get_db(), sql.str().c_str() ) );
+    }
+}
+
+static void raise_postgres_error( const char *message, PGresult *result )
+{
+    stringstream out;
+    out << message << ": " << PQresultErrorMessage( result );
+    Workspace::more_error() = out.str().c_str();
+    DOMAIN_ERROR;
+}
+
+/*
+ * Creates a named statement on the server, which is used for all
+ * subsequent executions instead of sending the SQL each time.
+ */
+void PostgresArgListBuilder::make_persistent( void )
+{
+    if( statement_name.size() > 0 ) {
+        return;
+    }
+
+    PhaseTimer timer( PHASE_PREPARE );
+    string name = connection->make_statement_name();
+    PostgresResultWrapper result( PQprepare( connection->get_db(), name.c_str(), sql.c_str(), 0, NULL ) );
+    if( PQresultStatus( result.get_result() ) != PGRES_COMMAND_OK ) {
+        raise_postgres_error( "Error preparing statement", result.get_result() );
+    }
+    statement_name = name;
+}
+
+int PostgresArgListBuilder::get_param_count( void )
+{
+    make_persistent();
+    PostgresResultWrapper result( PQdescribePrepared( connection->get_db(), statement_name.c_str() ) );
+    if( PQresultStatus( result.get_result() ) != PGRES_COMMAND_OK ) {
+        raise_postgres_error( "Error describing statement", result.get_result() );
+    }
+    return PQnparams( result.get_result() );
+}
+
+static const string type_oid_to_name( Oid oid )
+{
+    switch( oid ) {
+    case 16: return "boolean";
+    case 21: return "smallint";
+    case 23: return "integer";
+    case 26: return "oid";
+    case 20: return "bigint";
+    case 700: return "real";
+    case 701: return "double precision";
+    case 1700: return "numeric";
+    case 25: return "text";
+    case 1043: return "character varying";
+    case 1042: return "character";
+    case 1082: return "date";
+    case 1114: return "timestamp";
+    case 1184: return "timestamp with time zone";
+    }
+
+    stringstream out;
+    out << "oid " << oid;
+    return out.str();
+}
+
+void PostgresArgListBuilder::describe_columns( vector<ColumnDescriptor> &cols )
+{
+    make_persistent();
+    PostgresResultWrapper result( PQdescribePrepared( connection->get_db(), statement_name.c_str() ) );
+    if( PQresultStatus( result.get_result() ) != PGRES_COMMAND_OK ) {
+        raise_postgres_error( "Error describing statement", result.get_result() );
+    }
+    int n = PQnfields( result.get_result() );
+    for( int i = 0 ; i < n ; i++ ) {
+        cols.push_back( ColumnDescriptor( PQfname( result.get_result(), i ),
+                                          type_oid_to_name( PQftype( result.get_result(), i ) ) ) );
+    }
 }
 
 void PostgresArgListBuilder::clear_args( void )
@@ -119,42 +221,403 @@ void PostgresArgListBuilder::append_double( double arg, int pos )
     args.push_back( new PostgresBindArg<double>( arg ) );
 }
 
+void PostgresArgListBuilder::append_timestamp( const TemporalValue &arg, int pos )
+{
+    Assert( static_cast<size_t>( pos ) == args.size() );
+    args.push_back( new PostgresBindArg<TemporalValue>( arg ) );
+}
+
 void PostgresArgListBuilder::append_null( int pos )
 {
     Assert( static_cast<size_t>( pos ) == args.size() );
     args.push_back( new PostgresNullArg() );
 }
 
-static void update_int_cell( Cell *cell, char *content )
+/*
+ * The cell converters are called from worker threads, so instead of
+ * raising an APL error they return a message describing the problem.
+ * The cell is always initialised so that the result value stays valid.
+ * The content is the text representation sent by the server.
+ */
+typedef const char *(*CellConverter)( Cell *cell, const char *content, int length );
+
+static const char *convert_float( Cell *cell, const char *content, int length )
 {
-    if( *content == 0 ) {
-        Workspace::more_error() = "Numeric content from database was empty";
-        DOMAIN_ERROR;
+    double n;
+    const char *end = content + length;
+    from_chars_result result = from_chars( content, end, n );
+    if( result.ec != errc() || result.ptr != end ) {
+        // Handles the special values, such as Infinity, that from_chars doesn't accept
+        char *endptr;
+        n = strtod( content, &endptr );
+        if( length == 0 || endptr != end ) {
+            new (cell) IntCell( 0 );
+            return "Error parsing decimal numbers returned from database";
+        }
     }
 
-    char *endptr;
-    long n = strtol( content, &endptr, 10 );
-    if( *endptr != 0 ) {
-        Workspace::more_error() = "Error parsing values returned from database";
-        DOMAIN_ERROR;
+    new (cell) FloatCell( n );
+    return NULL;
+}
+
+static const char *convert_int( Cell *cell, const char *content, int length )
+{
+    if( length == 0 ) {
+        new (cell) IntCell( 0 );
+        return "Numeric content from database was empty";
+    }
+
+    long n;
+    const char *end = content + length;
+    from_chars_result result = from_chars( content, end, n );
+    if( result.ec == errc::result_out_of_range ) {
+        return convert_float( cell, content, length );
+    }
+    if( result.ec != errc() || result.ptr != end ) {
+        new (cell) IntCell( 0 );
+        return "Error parsing values returned from database";
     }
 
     new (cell) IntCell( n );
+    return NULL;
 }
 
-static void update_double_cell( Cell *cell, char *content )
+/*
+ * Numeric values without a fraction are returned as integers, as long
+ * as they fit.
+ */
+static const char *convert_numeric( Cell *cell, const char *content, int length )
+{
+    long n;
+    const char *end = content + length;
+    from_chars_result result = from_chars( content, end, n );
+    if( length > 0 && result.ec == errc() && result.ptr == end ) {
+        new (cell) IntCell( n );
+        return NULL;
+    }
+    return convert_float( cell, content, length );
+}
+
+static const char *convert_bool( Cell *cell, const char *content, int length )
 {
-    char *endptr;
-    double n = strtod( content, &endptr );
-    if( *endptr != 0 ) {
-        Workspace::more_error() = "Error parsing decimal numbers returned from database";
+    if( length == 1 && ( *content == 't' || *content == 'f' ) ) {
+        new (cell) IntCell( *content == 't' ? 1 : 0 );
+        return NULL;
+    }
+
+    new (cell) IntCell( 0 );
+    return "Error parsing boolean returned from database";
+}
+
+struct TypeConversion {
+    Oid oid;
+    CellConverter converter;
+};
+
+/*
+ * Types not listed here are returned as strings.
+ */
+static const TypeConversion type_conversions[] = {
+    { 16,   convert_bool },     // bool
+    { 20,   convert_int },      // int8
+    { 21,   convert_int },      // int2
+    { 23,   convert_int },      // int4
+    { 26,   convert_int },      // oid
+    { 28,   convert_int },      // xid
+    { 700,  convert_float },    // float4
+    { 701,  convert_float },    // float8
+    { 1700, convert_numeric },  // numeric
+};
+
+static bool is_temporal_type( Oid oid )
+{
+    return oid == 1082     // date
+        || oid == 1083     // time
+        || oid == 1114     // timestamp
+        || oid == 1184     // timestamptz
+        || oid == 1266;    // timetz
+}
+
+static CellConverter find_converter( Oid oid )
+{
+    for( size_t i = 0 ; i < sizeof( type_conversions ) / sizeof( type_conversions[0] ) ; i++ ) {
+        if( type_conversions[i].oid == oid ) {
+            return type_conversions[i].converter;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Cells that need an APL value to be allocated (strings, nulls and
+ * timestamp vectors) can't be created by the worker threads. Instead,
+ * the decoded content is kept here until the workers have finished.
+ */
+class DeferredCell {
+public:
+    enum Kind { DEFERRED_NULL, DEFERRED_SENTINEL, DEFERRED_STRING, DEFERRED_TIMESTAMP };
+
+    DeferredCell( long index_in, Kind kind_in ) : index( index_in ), kind( kind_in ) {}
+    DeferredCell( long index_in, const UCS_string &value_in )
+        : index( index_in ), kind( DEFERRED_STRING ), value( value_in ) {}
+    DeferredCell( long index_in, const TemporalValue &temporal_in )
+        : index( index_in ), kind( DEFERRED_TIMESTAMP ), temporal( temporal_in ) {}
+    long index;
+    Kind kind;
+    UCS_string value;
+    TemporalValue temporal;
+};
+
+/*
+ * How the cells of a column are converted. source_col is the column in
+ * the PGresult. Columns without a converter that are not converted as
+ * dates are returned as strings.
+ */
+class ColumnConversion {
+public:
+    ColumnConversion( int source_col_in, CellConverter converter_in, TemporalMode temporal_mode_in )
+        : source_col( source_col_in ), converter( converter_in ), temporal_mode( temporal_mode_in ) {}
+    int source_col;
+    CellConverter converter;
+    TemporalMode temporal_mode;
+};
+
+/*
+ * Converts rows start to end of the APL value, which are read from the
+ * PGresult starting at first_row
+ */
+static const char *fill_row_range( PGresult *result, Value *db_result_value, long first_row, long start, long end,
+                                   const vector<ColumnConversion> &conversions, const NullSentinels *sentinels,
+                                   vector<DeferredCell> &deferred )
+{
+    const char *error = NULL;
+    int cols = conversions.size();
+    for( long row = start ; row < end ; row++ ) {
+        long source_row = first_row + row;
+        for( int col = 0 ; col < cols ; col++ ) {
+            long index = row * cols + col;
+            int source_col = conversions[col].source_col;
+            if( PQgetisnull( result, source_row, source_col ) ) {
+                if( sentinels == NULL ) {
+                    deferred.push_back( DeferredCell( index, DeferredCell::DEFERRED_NULL ) );
+                }
+                else if( sentinels->for_column( col ).is_simple() ) {
+                    sentinels->for_column( col ).fill( &db_result_value->get_ravel( index ) );
+                }
+                else {
+                    deferred.push_back( DeferredCell( index, DeferredCell::DEFERRED_SENTINEL ) );
+                }
+                continue;
+            }
+
+            char *value = PQgetvalue( result, source_row, source_col );
+            const ColumnConversion &conversion = conversions[col];
+            if( conversion.temporal_mode != TEMPORAL_TEXT ) {
+                // Values that can't be parsed, such as infinity, are
+                // returned as strings
+                TemporalValue temporal;
+                if( !parse_temporal( value, PQgetlength( result, source_row, source_col ), temporal ) ) {
+                    deferred.push_back( DeferredCell( index, ucs_string_from_string( value ) ) );
+                }
+                else if( conversion.temporal_mode == TEMPORAL_EPOCH_MS ) {
+                    new (&db_result_value->get_ravel( index )) IntCell( temporal.to_epoch_ms() );
+                }
+                else {
+                    deferred.push_back( DeferredCell( index, temporal ) );
+                }
+                continue;
+            }
+
+            if( conversion.converter == NULL ) {
+                deferred.push_back( DeferredCell( index, ucs_string_from_string( value ) ) );
+                continue;
+            }
+
+            const char *cell_error = conversion.converter( &db_result_value->get_ravel( index ), value,
+                                                           PQgetlength( result, source_row, source_col ) );
+            if( error == NULL ) {
+                error = cell_error;
+            }
+        }
+    }
+    return error;
+}
+
+static void check_result_size( StatementLimiter &limiter, PGresult *result )
+{
+    int rows = PQntuples( result );
+    int cols = PQnfields( result );
+    bool counting_bytes = limiter.is_counting_bytes();
+    for( int row = 0 ; row < rows ; row++ ) {
+        long bytes = 0;
+        if( counting_bytes ) {
+            bytes = cols * sizeof( Cell );
+            for( int col = 0 ; col < cols ; col++ ) {
+                bytes += PQgetlength( result, row, col ) * sizeof( Unicode );
+            }
+        }
+        if( limiter.add_row( bytes ) ) {
+            limiter.raise_stop_error();
+        }
+    }
+}
+
+static Value_P make_postgres_null_mask( PGresult *result )
+{
+    int rows = PQntuples( result );
+    if( rows == 0 ) {
+        return Idx0( LOC );
+    }
+
+    int cols = PQnfields( result );
+    Value_P mask = make_null_mask( rows, cols );
+    for( int row = 0 ; row < rows ; row++ ) {
+        for( int col = 0 ; col < cols ; col++ ) {
+            if( PQgetisnull( result, row, col ) ) {
+                new (&mask->get_ravel( row * cols + col )) IntCell( 1 );
+            }
+        }
+    }
+    return mask;
+}
+
+/*
+ * Converts rows first_row to first_row + rows of the given columns of
+ * the result
+ */
+static Value_P convert_tuples( PGresult *result, long first_row, long rows, const vector<int> &source_cols,
+                               TemporalMode temporal_mode, const NullSentinels *sentinels )
+{
+    if( rows == 0 ) {
+        return Idx0( LOC );
+    }
+
+    int cols = source_cols.size();
+    Shape shape( rows, cols );
+    Value_P db_result_value( new Value( shape, LOC ) );
+    Value *value_ptr = db_result_value.get();
+
+    vector<ColumnConversion> conversions;
+    for( int col = 0 ; col < cols ; col++ ) {
+        Oid oid = PQftype( result, source_cols[col] );
+        conversions.push_back( ColumnConversion( source_cols[col], find_converter( oid ),
+                                                 is_temporal_type( oid ) ? temporal_mode : TEMPORAL_TEXT ) );
+    }
+
+    vector<vector<DeferredCell> > deferred;
+    vector<const char *> errors;
+    if( static_cast<long>( rows ) * cols >= PARALLEL_CONVERSION_THRESHOLD ) {
+        ThreadPool *pool = ThreadPool::get_instance();
+        deferred.resize( pool->get_num_slices() );
+        errors.resize( pool->get_num_slices(), NULL );
+        pool->run_partitioned( rows, [&]( int slice, long start, long end ) {
+                errors[slice] = fill_row_range( result, value_ptr, first_row, start, end, conversions, sentinels,
+                                                deferred[slice] );
+            } );
+    }
+    else {
+        deferred.resize( 1 );
+        errors.push_back( fill_row_range( result, value_ptr, first_row, 0, rows, conversions, sentinels, deferred[0] ) );
+    }
+
+    for( vector<vector<DeferredCell> >::iterator slice = deferred.begin() ; slice != deferred.end() ; slice++ ) {
+        for( vector<DeferredCell>::iterator i = slice->begin() ; i != slice->end() ; i++ ) {
+            Cell *cell = &db_result_value->get_ravel( i->index );
+            if( i->kind == DeferredCell::DEFERRED_NULL ) {
+                new (cell) PointerCell( Idx0( LOC ) );
+            }
+            else if( i->kind == DeferredCell::DEFERRED_SENTINEL ) {
+                sentinels->for_column( i->index % cols ).fill( cell );
+            }
+            else if( i->kind == DeferredCell::DEFERRED_TIMESTAMP ) {
+                new (cell) PointerCell( make_timestamp_value( i->temporal ) );
+            }
+            else if( i->value.size() == 0 ) {
+                new (cell) PointerCell( Str0( LOC ) );
+            }
+            else {
+                new (cell) PointerCell( make_ucs_string_cell( i->value, LOC ) );
+            }
+        }
+    }
+
+    for( vector<const char *>::iterator i = errors.begin() ; i != errors.end() ; i++ ) {
+        if( *i != NULL ) {
+            Workspace::more_error() = *i;
+            DOMAIN_ERROR;
+        }
+    }
+
+    return db_result_value;
+}
+
+/*
+ * Interval between checks for interrupts and the time limit while
+ * waiting for the server
+ */
+static const int POLL_INTERVAL_MS = 100;
+
+/*
+ * Sends the statement and waits for the result. If the statement has to
+ * be stopped while the server is working on it, it is cancelled, and
+ * the server then returns an error as the result.
+ */
+static PGresult *exec_params( PGconn *db, StatementLimiter &limiter, const string &sql, const string &statement_name,
+                              int n, const char **values, int *lengths, int *formats )
+{
+    PhaseTimer timer( PHASE_EXECUTE );
+    int sent;
+    if( statement_name.size() > 0 ) {
+        sent = PQsendQueryPrepared( db, statement_name.c_str(), n, values, lengths, formats, 0 );
+    }
+    else {
+        sent = PQsendQueryParams( db, sql.c_str(), n, NULL, values, lengths, formats, 0 );
+    }
+    if( !sent ) {
+        stringstream out;
+        out << "Error sending query: " << PQerrorMessage( db );
+        Workspace::more_error() = out.str().c_str();
         DOMAIN_ERROR;
     }
 
-    new (cell) FloatCell( n );
+    bool cancelled = false;
+    while( PQisBusy( db ) ) {
+        struct pollfd fd;
+        fd.fd = PQsocket( db );
+        fd.events = POLLIN;
+        fd.revents = 0;
+        poll( &fd, 1, POLL_INTERVAL_MS );
+
+        if( !cancelled && limiter.should_stop() ) {
+            char error[256];
+            PGcancel *cancel = PQgetCancel( db );
+            if( cancel != NULL ) {
+                PQcancel( cancel, error, sizeof( error ) );
+                PQfreeCancel( cancel );
+            }
+            cancelled = true;
+        }
+
+        if( !PQconsumeInput( db ) ) {
+            break;
+        }
+    }
+
+    // Only one result is expected, but all of them have to be read
+    // before the connection can be used again
+    PGresult *result = PQgetResult( db );
+    PGresult *extra;
+    while( (extra = PQgetResult( db )) != NULL ) {
+        PQclear( extra );
+    }
+    return result;
 }
 
-Value_P PostgresArgListBuilder::run_query( bool ignore_result )
+/*
+ * Binds the arguments and runs the statement. Raises an error if the
+ * statement was stopped by the limiter.
+ */
+PGresult *PostgresArgListBuilder::execute( StatementLimiter &limiter )
 {
     int n = args.size();
     int array_len = n == 0 ? 1 : n;
@@ -163,70 +626,109 @@ Value_P PostgresArgListBuilder::run_query( bool ignore_result )
     DynArray( int, lengths, array_len );
     DynArray( int, formats, array_len );
 
-    for( int i = 0 ; i < n ; i++ ) {
-        PostgresArg *arg = args[i];
-        arg->update( types, values, lengths, formats, i );
+    {
+        PhaseTimer timer( PHASE_BIND );
+        for( int i = 0 ; i < n ; i++ ) {
+            PostgresArg *arg = args[i];
+            arg->update( types, values, lengths, formats, i );
+        }
+    }
+
+    PGresult *result = exec_params( connection->get_db(), limiter, sql, statement_name, n, values, lengths, formats );
+    if( limiter.is_stopped() ) {
+        PQclear( result );
+        limiter.raise_stop_error();
     }
+    return result;
+}
+
+static void raise_result_error( ExecStatusType status, PGresult *result )
+{
+    stringstream out;
+    out << "Error executing query: " << PQresStatus( status ) << endl
+        << "Message: " << PQresultErrorMessage( result );
+    Workspace::more_error() = out.str().c_str();
+    DOMAIN_ERROR;
+}
+
+static void all_columns( PGresult *result, vector<int> &cols )
+{
+    int n = PQnfields( result );
+    for( int col = 0 ; col < n ; col++ ) {
+        cols.push_back( col );
+    }
+}
+
+Value_P PostgresArgListBuilder::run_query( bool ignore_result )
+{
+    StatementLimiter limiter( connection );
+    PostgresResultWrapper result( execute( limiter ) );
 
-    PostgresResultWrapper result( PQexecParams( connection->get_db(), sql.c_str(), n,
-                                                NULL, values, lengths, formats,
-                                                0 ) );
     ExecStatusType status = PQresultStatus( result.get_result() );
     Value_P db_result_value;
     if( status == PGRES_COMMAND_OK ) {
         db_result_value = Str0( LOC );
     }
     else if( status == PGRES_TUPLES_OK ) {
-        int rows = PQntuples( result.get_result() );
-        if( rows == 0 ) {
-            db_result_value = Idx0( LOC );
-        }
-        else {
-            int cols = PQnfields( result.get_result() );
-            Shape shape( rows, cols );
-            db_result_value = new Value( shape, LOC );
-            for( int row = 0 ; row < rows ; row++ ) {
-                for( int col = 0 ; col < cols ; col++ ) {
-                    if( PQgetisnull( result.get_result(), row, col ) ) {
-                        new (db_result_value->next_ravel()) PointerCell( Idx0( LOC ) );
-                    }
-                    else {
-                        Oid col_type = PQftype( result.get_result(), col );
-                        char *value = PQgetvalue( result.get_result(), row, col );
-                        if( col_type == 23 // INT4OID
-                            || col_type == 20 // INT8OID
-                            ) {
-                            update_int_cell( db_result_value->next_ravel(), value );
-                        }
-                        else if( col_type == 1700 ) { // NUMERICOID
-                            if( strchr( value, '.' ) == NULL ) {
-                                update_int_cell( db_result_value->next_ravel(), value );
-                            }
-                            else {
-                                update_double_cell( db_result_value->next_ravel(), value );
-                            }
-                        }
-                        else {
-                            if( *value == 0 ) {
-                                new (db_result_value->next_ravel()) PointerCell( Str0( LOC ) );
-                            }
-                            else {
-                                new (db_result_value->next_ravel()) PointerCell( make_string_cell( value, LOC ) );
-                            }
-                        }
-                    }
-                }
-            }
+        // libpq has already received the whole result, but the limits
+        // still prevent it from being converted to an APL value
+        check_result_size( limiter, result.get_result() );
+        PhaseTimer timer( PHASE_CONVERT );
+        vector<int> cols;
+        all_columns( result.get_result(), cols );
+        db_result_value = convert_tuples( result.get_result(), 0, PQntuples( result.get_result() ), cols,
+                                          connection->get_temporal_mode(), null_sentinels );
+        if( null_sentinels != NULL ) {
+            null_sentinels->set_mask( make_postgres_null_mask( result.get_result() ) );
         }
     }
     else {
-        stringstream out;
-        out << "Error executing query: " << PQresStatus( status ) << endl
-            << "Message: " << PQresultErrorMessage( result.get_result() );
-        Workspace::more_error() = out.str().c_str();
-        DOMAIN_ERROR;
+        raise_result_error( status, result.get_result() );
     }
 
     db_result_value->check_value( LOC );
     return db_result_value;
 }
+
+/*
+ * Keeps the PGresult, and converts the requested rows and columns of
+ * it when they are fetched
+ */
+class PostgresRetainedResult : public RetainedResult {
+public:
+    PostgresRetainedResult( PGresult *result_in, TemporalMode temporal_mode_in )
+        : result( result_in ), temporal_mode( temporal_mode_in ) {}
+    virtual ~PostgresRetainedResult() {}
+    virtual long get_row_count( void ) { return PQntuples( result.get_result() ); }
+    virtual int get_column_count( void ) { return PQnfields( result.get_result() ); }
+    virtual Value_P fetch( long start, long end, const vector<int> &cols )
+    {
+        Value_P value = convert_tuples( result.get_result(), start, end - start, cols, temporal_mode, NULL );
+        value->check_value( LOC );
+        return value;
+    }
+
+private:
+    PostgresResultWrapper result;
+    TemporalMode temporal_mode;
+};
+
+/*
+ * The row and byte limits are not applied, since the result stays in
+ * libpq until it is fetched
+ */
+RetainedResult *PostgresArgListBuilder::run_retained_query( void )
+{
+    StatementLimiter limiter( connection );
+    PostgresResultWrapper result( execute( limiter ) );
+
+    ExecStatusType status = PQresultStatus( result.get_result() );
+    if( status == PGRES_COMMAND_OK ) {
+        Workspace::more_error() = "Statement does not return a result";
+        DOMAIN_ERROR;
+    }
+    else if( status != PGRES_TUPLES_OK ) {
+        raise_result_error( status, result.get_result() );
+    }
+    return new PostgresRetainedResult( result.release(), connection->get_temporal_mode() );
+}
@@ -60,20 +60,28 @@ public:
     virtual void append_long( long arg, int pos );
     virtual void append_double( double arg, int pos );
     virtual void append_null( int pos );
+    virtual void append_timestamp( const TemporalValue &arg, int pos );
     virtual Value_P run_query( bool ignore_result );
+    virtual RetainedResult *run_retained_query( void );
     virtual void clear_args( void );
+    virtual void make_persistent( void );
+    virtual int get_param_count( void );
+    virtual void describe_columns( vector<ColumnDescriptor> &cols );
 
 private:
+    PGresult *execute( StatementLimiter &limiter );
     PostgresConnection *connection;
     string sql;
+    string statement_name;
     vector<PostgresArg *> args;
 };
 
 class PostgresResultWrapper {
 public:
     PostgresResultWrapper( PGresult *result_in ) : result( result_in ) {}
-    ~PostgresResultWrapper() { PQclear( result ); }
+    ~PostgresResultWrapper() { if( result != NULL ) { PQclear( result ); } }
     PGresult *get_result( void ) { return result; }
+    PGresult *release( void ) { PGresult *released = result; result = NULL; return released; }
 
 private:
     PGresult *result;
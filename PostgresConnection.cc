@@ -33,22 +33,369 @@ private:
 };
 
 PostgresConnection::PostgresConnection( PGconn *db_in )
-    : db( db_in )
+    : db( db_in ), next_statement_number( 1 ), schema_version_valid( false )
 {
 }
 
 PostgresConnection::~PostgresConnection()
 {
+    close_write_behind();
+    close_prepared_statements();
     PQfinish( db );
 }
 
+/*
+ * Returns the value in the text format used for parameters, or NULL
+ * for nulls. Numbers are formatted into text.
+ */
+static const char *queued_bind_text( const QueuedBind &bind, string &text )
+{
+    stringstream out;
+    out.precision( 17 );
+    switch( bind.type ) {
+    case QueuedBind::BIND_LONG:
+        out << bind.long_value;
+        text = out.str();
+        return text.c_str();
+    case QueuedBind::BIND_DOUBLE:
+        out << bind.double_value;
+        text = out.str();
+        return text.c_str();
+    case QueuedBind::BIND_STRING:
+        return bind.string_value.c_str();
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Bind values are sent in text format, and the server infers their
+ * types from the statement.
+ */
+class PostgresBatchWriter : public BatchWriter {
+public:
+    PostgresBatchWriter( PGconn *db_in ) : db( db_in ) {}
+    virtual bool begin( string &error ) { return run_simple( "begin", error ); }
+    virtual bool execute( const QueuedStatement &statement, string &error );
+    virtual bool commit( string &error ) { return run_simple( "commit", error ); }
+    virtual void rollback( void ) { string error; run_simple( "rollback", error ); }
+
+private:
+    bool check_result( PGresult *result, string &error );
+    bool run_simple( const char *sql, string &error ) { return check_result( PQexec( db, sql ), error ); }
+    PGconn *db;
+};
+
+bool PostgresBatchWriter::check_result( PGresult *result, string &error )
+{
+    ExecStatusType status = PQresultStatus( result );
+    bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+    if( !ok ) {
+        error = PQresultErrorMessage( result );
+    }
+    PQclear( result );
+    return ok;
+}
+
+bool PostgresBatchWriter::execute( const QueuedStatement &queued, string &error )
+{
+    int n = queued.cols;
+    vector<string> text( n );
+    vector<const char *> values( n == 0 ? 1 : n );
+    for( long row = 0 ; row < queued.rows ; row++ ) {
+        for( int col = 0 ; col < n ; col++ ) {
+            values[col] = queued_bind_text( queued.binds[row * n + col], text[col] );
+        }
+        if( !check_result( PQexecParams( db, queued.statement.c_str(), n, NULL, &values[0], NULL, NULL, 0 ), error ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Appends a value in the text format of COPY
+ */
+static void append_copy_value( string &buffer, const QueuedBind &bind )
+{
+    stringstream out;
+    out.precision( 17 );
+    switch( bind.type ) {
+    case QueuedBind::BIND_LONG:
+        out << bind.long_value;
+        buffer += out.str();
+        break;
+    case QueuedBind::BIND_DOUBLE:
+        out << bind.double_value;
+        buffer += out.str();
+        break;
+    case QueuedBind::BIND_STRING:
+        for( string::const_iterator i = bind.string_value.begin() ; i != bind.string_value.end() ; i++ ) {
+            switch( *i ) {
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default: buffer += *i;
+            }
+        }
+        break;
+    default:
+        buffer += "\\N";
+    }
+}
+
+static void check_command( PGresult *result, ExecStatusType expected, const char *message )
+{
+    PostgresResultWrapper wrapper( result );
+    if( PQresultStatus( result ) != expected ) {
+        stringstream out;
+        out << message << ": " << PQresultErrorMessage( result );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+/*
+ * Size of the buffer passed to each PQputCopyData() call
+ */
+static const size_t COPY_BUFFER_SIZE = 65536;
+
+/*
+ * Sends the rows with a COPY statement. When row_numbers is true, the
+ * number of each row is sent after its values. Returns false, after
+ * storing the error message, if the copy failed.
+ */
+static bool copy_rows( PGconn *db, const string &copy_sql, const vector<QueuedBind> &binds, int cols,
+                       bool row_numbers, string &error )
+{
+    PGresult *result = PQexec( db, copy_sql.c_str() );
+    bool started = PQresultStatus( result ) == PGRES_COPY_IN;
+    if( !started ) {
+        error = PQresultErrorMessage( result );
+    }
+    PQclear( result );
+    if( !started ) {
+        return false;
+    }
+
+    long rows = binds.size() / cols;
+    string buffer;
+    string copy_error;
+    for( long row = 0 ; row < rows && copy_error.size() == 0 ; row++ ) {
+        for( int col = 0 ; col < cols ; col++ ) {
+            if( col > 0 ) {
+                buffer += '\t';
+            }
+            append_copy_value( buffer, binds[row * cols + col] );
+        }
+        if( row_numbers ) {
+            stringstream row_number;
+            row_number << '\t' << row;
+            buffer += row_number.str();
+        }
+        buffer += '\n';
+
+        if( buffer.size() >= COPY_BUFFER_SIZE || row == rows - 1 ) {
+            if( PQputCopyData( db, buffer.data(), buffer.size() ) != 1 ) {
+                copy_error = PQerrorMessage( db );
+            }
+            buffer.clear();
+        }
+    }
+    PQputCopyEnd( db, copy_error.size() > 0 ? copy_error.c_str() : NULL );
+
+    // All results have to be read before the connection can be used again
+    result = PQgetResult( db );
+    bool ok = PQresultStatus( result ) == PGRES_COMMAND_OK;
+    if( !ok ) {
+        error = PQresultErrorMessage( result );
+    }
+    PQclear( result );
+    while( (result = PQgetResult( db )) != NULL ) {
+        PQclear( result );
+    }
+    return ok;
+}
+
+/*
+ * The rows are copied into a temporary table, which is then merged into
+ * the target table with a single insert. The row number is copied as
+ * well, so that the last of several rows with the same key wins, as it
+ * does when the rows are written one at a time. The temporary table is
+ * dropped at the end, since the enclosing transaction may run further
+ * upserts before it commits.
+ */
+void PostgresConnection::upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated )
+{
+    static const char *TEMP_TABLE = "apl_upsert_rows";
+    static const char *ROW_COLUMN = "apl_upsert_row";
+
+    stringstream columns;
+    stringstream keys;
+    for( vector<string>::const_iterator i = spec.columns.begin() ; i != spec.columns.end() ; i++ ) {
+        columns << (i != spec.columns.begin() ? ", " : "") << quote_identifier( *i );
+    }
+    for( vector<string>::const_iterator i = spec.keys.begin() ; i != spec.keys.end() ; i++ ) {
+        keys << (i != spec.keys.begin() ? ", " : "") << quote_identifier( *i );
+    }
+
+    stringstream create;
+    create << "create temporary table " << TEMP_TABLE << " on commit drop as select " << columns.str()
+           << ", 0::bigint as " << ROW_COLUMN << " from " << quote_table_name( spec.table ) << " with no data";
+    check_command( PQexec( db, create.str().c_str() ), PGRES_COMMAND_OK, "Error creating upsert table" );
+
+    stringstream copy;
+    copy << "copy " << TEMP_TABLE << " from stdin";
+    string error;
+    if( !copy_rows( db, copy.str(), binds, spec.columns.size(), true, error ) ) {
+        stringstream out;
+        out << "Error copying upsert rows: " << error;
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+
+    // xmax is zero for rows that were inserted
+    stringstream source;
+    source << "select distinct on (" << keys.str() << ") " << columns.str()
+           << " from " << TEMP_TABLE << " order by " << keys.str() << ", " << ROW_COLUMN << " desc";
+    stringstream merge;
+    merge << "with merged as (" << make_upsert_insert_sql( spec, source.str(), true )
+          << " returning xmax = 0 as inserted) "
+          << "select count(*) filter (where inserted), count(*) filter (where not inserted) from merged";
+    PostgresResultWrapper result( PQexec( db, merge.str().c_str() ) );
+    if( PQresultStatus( result.get_result() ) != PGRES_TUPLES_OK ) {
+        stringstream out;
+        out << "Error in upsert: " << PQresultErrorMessage( result.get_result() );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    *inserted += atol( PQgetvalue( result.get_result(), 0, 0 ) );
+    *updated += atol( PQgetvalue( result.get_result(), 0, 1 ) );
+
+    stringstream drop;
+    drop << "drop table " << TEMP_TABLE;
+    check_command( PQexec( db, drop.str().c_str() ), PGRES_COMMAND_OK, "Error dropping upsert table" );
+}
+
+/*
+ * Each batch is sent with COPY. If the server rejects the batch, it is
+ * rolled back and inserted again one row at a time, so that only the
+ * failing rows are rejected.
+ */
+class PostgresTableImporter : public TableImporter {
+public:
+    PostgresTableImporter( PGconn *db_in, const string &copy_sql_in, const string &insert_sql_in, int cols_in )
+        : db( db_in ), copy_sql( copy_sql_in ), insert_sql( insert_sql_in ), cols( cols_in ) {}
+    virtual ~PostgresTableImporter() {}
+    virtual long write_batch( const vector<QueuedBind> &binds, const vector<long> &lines,
+                              vector<pair<long, string> > &rejected );
+
+private:
+    void run_command( const char *sql ) { check_command( PQexec( db, sql ), PGRES_COMMAND_OK, "Error in import" ); }
+    PGconn *db;
+    const string copy_sql;
+    const string insert_sql;
+    const int cols;
+};
+
+long PostgresTableImporter::write_batch( const vector<QueuedBind> &binds, const vector<long> &lines,
+                                         vector<pair<long, string> > &rejected )
+{
+    string error;
+    run_command( "savepoint apl_import_batch" );
+    if( copy_rows( db, copy_sql, binds, cols, false, error ) ) {
+        run_command( "release savepoint apl_import_batch" );
+        return lines.size();
+    }
+    run_command( "rollback to savepoint apl_import_batch" );
+
+    long written = 0;
+    vector<string> text( cols );
+    vector<const char *> values( cols );
+    for( size_t row = 0 ; row < lines.size() ; row++ ) {
+        for( int col = 0 ; col < cols ; col++ ) {
+            values[col] = queued_bind_text( binds[row * cols + col], text[col] );
+        }
+        run_command( "savepoint apl_import_row" );
+        PostgresResultWrapper result( PQexecParams( db, insert_sql.c_str(), cols, NULL, &values[0], NULL, NULL, 0 ) );
+        if( PQresultStatus( result.get_result() ) == PGRES_COMMAND_OK ) {
+            written++;
+        }
+        else {
+            rejected.push_back( pair<long, string>( lines[row], PQresultErrorMessage( result.get_result() ) ) );
+            run_command( "rollback to savepoint apl_import_row" );
+        }
+        run_command( "release savepoint apl_import_row" );
+    }
+    run_command( "release savepoint apl_import_batch" );
+    return written;
+}
+
+TableImporter *PostgresConnection::make_table_importer( const string &table, const vector<string> &columns )
+{
+    stringstream column_list;
+    stringstream params;
+    for( size_t col = 0 ; col < columns.size() ; col++ ) {
+        column_list << (col > 0 ? ", " : "") << quote_identifier( columns[col] );
+        params << (col > 0 ? ", " : "") << make_positional_param( col );
+    }
+    string target = quote_table_name( table ) + " (" + column_list.str() + ")";
+    return new PostgresTableImporter( db, "copy " + target + " from stdin",
+                                      "insert into " + target + " values (" + params.str() + ")", columns.size() );
+}
+
+BatchWriter *PostgresConnection::make_batch_writer( void )
+{
+    return new PostgresBatchWriter( db );
+}
+
+const string PostgresConnection::make_statement_name( void )
+{
+    stringstream out;
+    out << "apl_statement_" << next_statement_number++;
+    return out.str();
+}
+
+/*
+ * Returns true if the statement starts with one of the keywords of the
+ * statements which can change the schema.
+ */
+static bool may_change_schema( const string &sql )
+{
+    static const char *keywords[] = { "create", "alter", "drop", "comment", NULL };
+
+    size_t start = sql.find_first_not_of( " \t\r\n" );
+    if( start == string::npos ) {
+        return false;
+    }
+    for( const char **keyword = keywords ; *keyword != NULL ; keyword++ ) {
+        size_t i = start;
+        const char *k = *keyword;
+        while( *k != 0 && i < sql.size() && tolower( static_cast<unsigned char>( sql[i] ) ) == *k ) {
+            k++;
+            i++;
+        }
+        if( *k == 0 && (i == sql.size() || !(isalnum( static_cast<unsigned char>( sql[i] ) ) || sql[i] == '_')) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
 ArgListBuilder *PostgresConnection::make_prepared_query( const string &sql )
 {
+    if( may_change_schema( sql ) ) {
+        schema_version_valid = false;
+    }
     return new PostgresArgListBuilder( this, sql );
 }
 
 ArgListBuilder *PostgresConnection::make_prepared_update( const string &sql )
 {
+    if( may_change_schema( sql ) ) {
+        schema_version_valid = false;
+    }
     return new PostgresArgListBuilder( this, sql );    
 }
 
@@ -102,36 +449,151 @@ void PostgresConnection::fill_tables( vector<string> &tables )
     }
 }
 
-void PostgresConnection::fill_cols( const string &table, vector<ColumnDescriptor> &cols )
-{
-    const char *s = table.c_str();
-    PostgresAllocMemoryWrapper escaped_table_name( PQescapeLiteral( db, s, strlen( s ) ) );
-
-    stringstream sql;
-    sql << "select column_name,data_type from information_schema.columns where table_name = "
-        << escaped_table_name.value();
+/*
+ * Reads columns, indexes and the row estimate in one query using the
+ * system catalogs, which is much faster than information_schema. Each
+ * row is either a column (c), an index column (i) or the row
+ * estimate (r). The last column is only used for sorting.
+ */
+static const char *TABLE_INFO_SQL =
+    "with t as (select to_regclass($1) as oid) "
+    "select 'c', a.attnum, a.attname, format_type(a.atttypid, a.atttypmod), "
+    "       case when a.attnotnull then 0 else 1 end, "
+    "       coalesce((select k.n from pg_index x, unnest(x.indkey) with ordinality k(attnum, n) "
+    "                 where x.indrelid = t.oid and x.indisprimary and k.attnum = a.attnum), 0), '' "
+    "  from t join pg_attribute a on a.attrelid = t.oid "
+    " where a.attnum > 0 and not a.attisdropped "
+    "union all "
+    "select 'i', k.n, ic.relname, a.attname, case when x.indisunique then 1 else 0 end, 0, ic.relname "
+    "  from t join pg_index x on x.indrelid = t.oid "
+    "  join pg_class ic on ic.oid = x.indexrelid "
+    "  cross join unnest(x.indkey) with ordinality k(attnum, n) "
+    "  join pg_attribute a on a.attrelid = t.oid and a.attnum = k.attnum "
+    "union all "
+    "select 'r', 0, '', '', 0, c.reltuples::bigint, '' from t join pg_class c on c.oid = t.oid "
+    "order by 1, 7, 2";
 
-    PostgresResultWrapper result( PQexec( db, sql.str().c_str() ) );
+void PostgresConnection::fill_table_info( const string &table, TableInfo &info )
+{
+    string name = quote_table_name( table );
+    const char *values[] = { name.c_str() };
+    PostgresResultWrapper result( PQexecParams( db, TABLE_INFO_SQL, 1, NULL, values, NULL, NULL, 0 ) );
     ExecStatusType status = PQresultStatus( result.get_result() );
     if( status != PGRES_TUPLES_OK ) {
         stringstream out;
-        out << "Error getting list of columns: " << PQresultErrorMessage( result.get_result() );
+        out << "Error getting table info: " << PQresultErrorMessage( result.get_result() );
         Workspace::more_error() = out.str().c_str();
-        DOMAIN_ERROR;            
+        DOMAIN_ERROR;
     }
 
-    int rows = PQntuples( result.get_result() );
+    PGresult *r = result.get_result();
+    int rows = PQntuples( r );
     for( int row = 0 ; row < rows ; row++ ) {
-        char *colname = PQgetvalue( result.get_result(), row, 0 );
-        char *coltype = PQgetvalue( result.get_result(), row, 1 );
-        cols.push_back( ColumnDescriptor( const_cast<const char *>( colname ),
-                                          const_cast<const char *>( coltype ) ) );
+        char kind = *PQgetvalue( r, row, 0 );
+        if( kind == 'c' ) {
+            info.columns.push_back( ColumnInfo( PQgetvalue( r, row, 2 ), PQgetvalue( r, row, 3 ),
+                                                atoi( PQgetvalue( r, row, 4 ) ) != 0,
+                                                atoi( PQgetvalue( r, row, 5 ) ) ) );
+        }
+        else if( kind == 'i' ) {
+            // The index columns are sorted by index name and position
+            const char *name = PQgetvalue( r, row, 2 );
+            if( info.indexes.size() == 0 || info.indexes.back().name != name ) {
+                info.indexes.push_back( IndexInfo( name, atoi( PQgetvalue( r, row, 4 ) ) != 0 ) );
+            }
+            info.indexes.back().columns.push_back( PQgetvalue( r, row, 3 ) );
+        }
+        else {
+            info.row_estimate = atol( PQgetvalue( r, row, 5 ) );
+        }
     }
 }
 
+/*
+ * There is no schema version in PostgreSQL, but any change to a table
+ * or its columns writes new rows to pg_class or pg_attribute. Scanning
+ * those is too expensive to do for every lookup, so the version is
+ * only read again once it is older than SCHEMA_VERSION_TTL_MS, or when
+ * this connection has prepared a statement which may change the schema.
+ */
+const string PostgresConnection::read_schema_version( void )
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if( schema_version_valid
+        && std::chrono::duration_cast<std::chrono::milliseconds>( now - schema_version_read ).count() < SCHEMA_VERSION_TTL_MS ) {
+        return schema_version;
+    }
+
+    PostgresResultWrapper result( PQexec( db, "select (select count(*) || ':' || max(xmin::text::bigint) from pg_class)"
+                                          " || ':' || (select count(*) || ':' || max(xmin::text::bigint) from pg_attribute)" ) );
+    if( PQresultStatus( result.get_result() ) != PGRES_TUPLES_OK ) {
+        stringstream out;
+        out << "Error getting schema version: " << PQresultErrorMessage( result.get_result() );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    schema_version = PQgetvalue( result.get_result(), 0, 0 );
+    schema_version_read = now;
+    schema_version_valid = true;
+    return schema_version;
+}
+
+const string PostgresConnection::make_explain_prefix( bool query )
+{
+    // EXPLAIN ANALYZE executes the statement, which is only acceptable
+    // for queries
+    return query ? "explain (analyze, buffers) " : "explain ";
+}
+
 const string PostgresConnection::make_positional_param( int pos )
 {
     stringstream out;
     out << "$" << (pos + 1);
     return out.str();
 }
+
+/*
+ * Postgres has no cheap way of detecting changes, so cached results
+ * either expire after the TTL, or the cache is cleared whenever a
+ * notification arrives on the given channel.
+ */
+void PostgresConnection::enable_cache( long max_bytes, long ttl_ms, const string &channel )
+{
+    if( channel.size() > 0 && channel != cache_channel ) {
+        const char *s = channel.c_str();
+        PostgresAllocMemoryWrapper escaped_channel( PQescapeIdentifier( db, s, strlen( s ) ) );
+        stringstream sql;
+        sql << "listen " << escaped_channel.value();
+        PostgresResultWrapper result( PQexec( db, sql.str().c_str() ) );
+        if( PQresultStatus( result.get_result() ) != PGRES_COMMAND_OK ) {
+            stringstream out;
+            out << "Error listening for cache invalidation: " << PQresultErrorMessage( result.get_result() );
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+    }
+
+    cache_channel = channel;
+    Connection::enable_cache( max_bytes, ttl_ms, channel );
+}
+
+void PostgresConnection::validate_cache( void )
+{
+    if( cache_channel.size() == 0 ) {
+        return;
+    }
+
+    PQconsumeInput( db );
+    bool invalidate = false;
+    PGnotify *notify;
+    while( (notify = PQnotifies( db )) != NULL ) {
+        if( cache_channel == notify->relname ) {
+            invalidate = true;
+        }
+        PQfreemem( notify );
+    }
+
+    if( invalidate ) {
+        cache->clear();
+    }
+}
@@ -24,6 +24,10 @@
 #include "Connection.hh"
 
 #include <libpq-fe.h>
+#include <chrono>
+
+// How long a schema version read from the system catalogs is trusted
+static const long SCHEMA_VERSION_TTL_MS = 2000;
 
 class PostgresConnection : public Connection {
 public:
@@ -35,15 +39,31 @@ public:
     virtual void transaction_begin( void );
     virtual void transaction_commit( void );
     virtual void transaction_rollback( void );
+    virtual bool in_transaction( void ) { return PQtransactionStatus( db ) != PQTRANS_IDLE; }
 
     virtual void fill_tables( vector<string> &tables );
-    virtual void fill_cols( const string &table, vector<ColumnDescriptor> &cols );
+    virtual void fill_table_info( const string &table, TableInfo &info );
+    virtual const string read_schema_version( void );
     virtual const string make_positional_param( int pos );
+    virtual const string format_timestamp( const TemporalValue &value ) { return format_temporal( value, true ); }
+
+    virtual void enable_cache( long max_bytes, long ttl_ms, const string &channel );
+    virtual void validate_cache( void );
+    virtual const string make_explain_prefix( bool query );
+    virtual BatchWriter *make_batch_writer( void );
+    virtual void upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated );
+    virtual TableImporter *make_table_importer( const string &table, const vector<string> &columns );
 
     PGconn *get_db() { return db; }
+    const string make_statement_name( void );
 
 private:
     PGconn *db;
+    long next_statement_number;
+    string cache_channel;
+    string schema_version;
+    std::chrono::steady_clock::time_point schema_version_read;
+    bool schema_version_valid;
 };
 
 #endif
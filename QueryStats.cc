@@ -0,0 +1,249 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "QueryStats.hh"
+
+#include <algorithm>
+#include <mutex>
+#include <ctype.h>
+
+/*
+ * Number of durations kept per statement for the percentile
+ * calculations. Once full, samples are replaced at random.
+ */
+static const size_t MAX_SAMPLES = 1024;
+
+class StatementStats {
+public:
+    StatementStats() : count( 0 ), total_ns( 0 ), rows( 0 ), bytes( 0 ) {
+        for( int i = 0 ; i < NUM_PHASES ; i++ ) {
+            phase_ns[i] = 0;
+        }
+    }
+    long count;
+    long total_ns;
+    long phase_ns[NUM_PHASES];
+    long rows;
+    long bytes;
+    vector<long> samples;
+};
+
+// Collection has a cost for every statement, so it is off until asked for
+static int stats_level = STATS_LEVEL_OFF;
+static std::mutex stats_lock;
+static map<string, StatementStats> stats;
+static thread_local StatementTiming *current_timing = NULL;
+
+static long elapsed_ns( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+/*
+ * Collapses whitespace and replaces literals with ?, so that statements
+ * which only differ in their literal values are counted together.
+ */
+static string normalize_sql( const string &sql )
+{
+    string result;
+    size_t i = 0;
+    while( i < sql.size() ) {
+        char ch = sql[i];
+        if( isspace( ch ) ) {
+            while( i < sql.size() && isspace( sql[i] ) ) {
+                i++;
+            }
+            if( result.size() > 0 && i < sql.size() ) {
+                result += ' ';
+            }
+        }
+        else if( ch == '\'' ) {
+            i++;
+            while( i < sql.size() ) {
+                if( sql[i] == '\'' ) {
+                    if( i + 1 < sql.size() && sql[i + 1] == '\'' ) {
+                        i++;
+                    }
+                    else {
+                        break;
+                    }
+                }
+                i++;
+            }
+            i++;
+            result += '?';
+        }
+        else if( isdigit( ch ) && (result.size() == 0 || !(isalnum( result[result.size() - 1] )
+                                                           || result[result.size() - 1] == '_'
+                                                           || result[result.size() - 1] == '$')) ) {
+            while( i < sql.size() && (isalnum( sql[i] ) || sql[i] == '.') ) {
+                i++;
+            }
+            result += '?';
+        }
+        else {
+            result += ch;
+            i++;
+        }
+    }
+    return result;
+}
+
+/*
+ * force_enable is used when the timings are needed for something other
+ * than the statistics, such as the slow query log. The statistics are
+ * still only recorded if collection is enabled.
+ */
+StatementTiming::StatementTiming( const string &sql_in, bool force_enable )
+    : sql( sql_in ), enabled( force_enable || stats_level >= STATS_LEVEL_PHASES ),
+      record_stats( stats_level >= STATS_LEVEL_PHASES ), previous( current_timing ), total_ns( 0 )
+{
+    for( int i = 0 ; i < NUM_PHASES ; i++ ) {
+        phase_ns[i] = 0;
+    }
+    if( enabled ) {
+        start = std::chrono::steady_clock::now();
+        current_timing = this;
+    }
+}
+
+StatementTiming::~StatementTiming()
+{
+    if( enabled ) {
+        current_timing = previous;
+    }
+}
+
+StatementTiming *StatementTiming::get_current( void )
+{
+    return current_timing;
+}
+
+void StatementTiming::finish( Value_P result )
+{
+    if( !enabled ) {
+        return;
+    }
+
+    long total = elapsed_ns( start );
+    total_ns = total;
+    if( !record_stats ) {
+        return;
+    }
+
+    long rows = result->get_rank() == 2 ? result->get_rows() : 0;
+    long bytes = estimate_value_size( result );
+    string key = normalize_sql( sql );
+
+    std::lock_guard<std::mutex> guard( stats_lock );
+    StatementStats &s = stats[key];
+    s.count++;
+    s.total_ns += total;
+    for( int i = 0 ; i < NUM_PHASES ; i++ ) {
+        s.phase_ns[i] += phase_ns[i];
+    }
+    s.rows += rows;
+    s.bytes += bytes;
+    if( s.samples.size() < MAX_SAMPLES ) {
+        s.samples.push_back( total );
+    }
+    else {
+        size_t pos = rand() % s.count;
+        if( pos < MAX_SAMPLES ) {
+            s.samples[pos] = total;
+        }
+    }
+}
+
+PhaseTimer::PhaseTimer( QueryPhase phase_in )
+    : phase( phase_in ), timing( current_timing )
+{
+    if( phase == PHASE_STRINGS && stats_level < STATS_LEVEL_STRINGS ) {
+        timing = NULL;
+    }
+    if( timing != NULL ) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+PhaseTimer::~PhaseTimer()
+{
+    if( timing != NULL ) {
+        timing->add( phase, elapsed_ns( start ) );
+    }
+}
+
+void set_stats_level( int level )
+{
+    stats_level = level;
+}
+
+void reset_query_stats( void )
+{
+    std::lock_guard<std::mutex> guard( stats_lock );
+    stats.clear();
+}
+
+static double ns_to_ms( long ns )
+{
+    return ns / 1000000.0;
+}
+
+static long percentile( vector<long> &sorted_samples, int percent )
+{
+    if( sorted_samples.size() == 0 ) {
+        return 0;
+    }
+    size_t pos = (sorted_samples.size() - 1) * percent / 100;
+    return sorted_samples[pos];
+}
+
+/*
+ * Columns: sql, count, total, p50, p99, prepare, bind, execute,
+ * convert, strings (all times in milliseconds), rows, bytes
+ */
+Value_P make_query_stats_value( void )
+{
+    std::lock_guard<std::mutex> guard( stats_lock );
+    if( stats.size() == 0 ) {
+        return Idx0( LOC );
+    }
+
+    Value_P value( new Value( Shape( stats.size(), 12 ), LOC ) );
+    for( map<string, StatementStats>::iterator i = stats.begin() ; i != stats.end() ; i++ ) {
+        StatementStats &s = i->second;
+        vector<long> sorted_samples( s.samples );
+        std::sort( sorted_samples.begin(), sorted_samples.end() );
+
+        new (value->next_ravel()) PointerCell( make_string_cell( i->first, LOC ) );
+        new (value->next_ravel()) IntCell( s.count );
+        new (value->next_ravel()) FloatCell( ns_to_ms( s.total_ns ) );
+        new (value->next_ravel()) FloatCell( ns_to_ms( percentile( sorted_samples, 50 ) ) );
+        new (value->next_ravel()) FloatCell( ns_to_ms( percentile( sorted_samples, 99 ) ) );
+        for( int phase = 0 ; phase < NUM_PHASES ; phase++ ) {
+            new (value->next_ravel()) FloatCell( ns_to_ms( s.phase_ns[phase] ) );
+        }
+        new (value->next_ravel()) IntCell( s.rows );
+        new (value->next_ravel()) IntCell( s.bytes );
+    }
+
+    value->check_value( LOC );
+    return value;
+}
@@ -0,0 +1,87 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef QUERY_STATS_HH
+#define QUERY_STATS_HH
+
+#include "apl-sqlite.hh"
+
+#include <chrono>
+
+enum QueryPhase {
+    PHASE_PREPARE,
+    PHASE_BIND,
+    PHASE_EXECUTE,
+    PHASE_CONVERT,
+    PHASE_STRINGS,
+    NUM_PHASES
+};
+
+/*
+ * Collection levels. At STATS_LEVEL_STRINGS, the creation of each
+ * string cell is timed as well, which has a noticeable cost for large
+ * results.
+ */
+static const int STATS_LEVEL_OFF = 0;
+static const int STATS_LEVEL_PHASES = 1;
+static const int STATS_LEVEL_STRINGS = 2;
+
+/*
+ * Timing information for the statement that is currently executing on
+ * this thread. The phase timers add to it, and the totals are recorded
+ * in the global statistics when the statement finishes.
+ */
+class StatementTiming {
+public:
+    StatementTiming( const string &sql_in, bool force_enable );
+    ~StatementTiming();
+    void add( QueryPhase phase, long ns ) { phase_ns[phase] += ns; }
+    void finish( Value_P result );
+    long get_total_ns( void ) { return total_ns; }
+    long get_phase_ns( QueryPhase phase ) { return phase_ns[phase]; }
+
+    static StatementTiming *get_current( void );
+
+private:
+    string sql;
+    bool enabled;
+    bool record_stats;
+    StatementTiming *previous;
+    std::chrono::steady_clock::time_point start;
+    long total_ns;
+    long phase_ns[NUM_PHASES];
+};
+
+class PhaseTimer {
+public:
+    PhaseTimer( QueryPhase phase_in );
+    ~PhaseTimer();
+
+private:
+    QueryPhase phase;
+    StatementTiming *timing;
+    std::chrono::steady_clock::time_point start;
+};
+
+void set_stats_level( int level );
+Value_P make_query_stats_value( void );
+void reset_query_stats( void );
+
+#endif
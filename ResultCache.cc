@@ -0,0 +1,151 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ResultCache.hh"
+
+/*
+ * The key consists of the statement followed by a tagged encoding of
+ * the shape and content of the bind parameters.
+ */
+string make_cache_key( const string &statement, Value_P B )
+{
+    stringstream out;
+    out << statement << '\0' << B->get_rank();
+    for( int i = 0 ; i < B->get_rank() ; i++ ) {
+        out << ',' << B->get_shape().get_shape_item( i );
+    }
+    for( int i = 0 ; i < B->element_count() ; i++ ) {
+        const Cell &cell = B->get_ravel( i );
+        if( cell.is_integer_cell() ) {
+            out << '\0' << 'i' << cell.get_int_value();
+        }
+        else if( cell.is_float_cell() ) {
+            APL_Float f = cell.get_real_value();
+            out << '\0' << 'f';
+            out.write( reinterpret_cast<const char *>( &f ), sizeof( f ) );
+        }
+        else {
+            Value_P value = cell.to_value( LOC );
+            if( value->element_count() == 0 ) {
+                out << '\0' << 'n';
+            }
+            else {
+                string s = to_string( value->get_UCS_ravel() );
+                out << '\0' << 's' << s.size() << ':' << s;
+            }
+        }
+    }
+    return out.str();
+}
+
+ResultCache::ResultCache( long max_bytes_in, long ttl_ms_in )
+    : max_bytes( max_bytes_in ), ttl_ms( ttl_ms_in ), current_bytes( 0 ),
+      hits( 0 ), misses( 0 ), evictions( 0 ), invalidations( 0 )
+{
+}
+
+void ResultCache::remove_entry( std::list<CacheEntry>::iterator entry )
+{
+    current_bytes -= entry->size;
+    index.erase( entry->key );
+    entries.erase( entry );
+}
+
+Value_P ResultCache::lookup( const string &key )
+{
+    std::lock_guard<std::mutex> guard( lock );
+    std::unordered_map<string, std::list<CacheEntry>::iterator>::iterator i = index.find( key );
+    if( i == index.end() ) {
+        misses++;
+        return Value_P();
+    }
+
+    std::list<CacheEntry>::iterator entry = i->second;
+    if( ttl_ms > 0 ) {
+        long age = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - entry->created ).count();
+        if( age > ttl_ms ) {
+            remove_entry( entry );
+            invalidations++;
+            misses++;
+            return Value_P();
+        }
+    }
+
+    // Move the entry to the front of the LRU list
+    entries.splice( entries.begin(), entries, entry );
+    hits++;
+    return entry->value;
+}
+
+void ResultCache::insert( const string &key, Value_P value )
+{
+    long size = estimate_value_size( value ) + key.size();
+    if( size > max_bytes ) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard( lock );
+    std::unordered_map<string, std::list<CacheEntry>::iterator>::iterator i = index.find( key );
+    if( i != index.end() ) {
+        remove_entry( i->second );
+    }
+
+    while( current_bytes + size > max_bytes && !entries.empty() ) {
+        remove_entry( --entries.end() );
+        evictions++;
+    }
+
+    entries.push_front( CacheEntry( key, value, size, std::chrono::steady_clock::now() ) );
+    index[key] = entries.begin();
+    current_bytes += size;
+}
+
+void ResultCache::clear( void )
+{
+    std::lock_guard<std::mutex> guard( lock );
+    if( !entries.empty() ) {
+        invalidations++;
+    }
+    entries.clear();
+    index.clear();
+    current_bytes = 0;
+}
+
+static void add_stats_row( Value_P value, const string &name, long n )
+{
+    new (value->next_ravel()) PointerCell( make_string_cell( name, LOC ) );
+    new (value->next_ravel()) IntCell( n );
+}
+
+Value_P ResultCache::make_stats_value( void )
+{
+    std::lock_guard<std::mutex> guard( lock );
+    Value_P value( new Value( Shape( 8, 2 ), LOC ) );
+    add_stats_row( value, "hits", hits );
+    add_stats_row( value, "misses", misses );
+    add_stats_row( value, "evictions", evictions );
+    add_stats_row( value, "invalidations", invalidations );
+    add_stats_row( value, "entries", entries.size() );
+    add_stats_row( value, "bytes", current_bytes );
+    add_stats_row( value, "max_bytes", max_bytes );
+    add_stats_row( value, "ttl_ms", ttl_ms );
+    value->check_value( LOC );
+    return value;
+}
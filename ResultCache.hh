@@ -0,0 +1,72 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESULT_CACHE_HH
+#define RESULT_CACHE_HH
+
+#include "apl-sqlite.hh"
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+class CacheEntry {
+public:
+    CacheEntry( const string &key_in, Value_P value_in, long size_in, std::chrono::steady_clock::time_point created_in )
+        : key( key_in ), value( value_in ), size( size_in ), created( created_in ) {}
+    string key;
+    Value_P value;
+    long size;
+    std::chrono::steady_clock::time_point created;
+};
+
+/*
+ * A cache of query results, bounded by the approximate number of bytes
+ * used by the cached values. When the limit is reached, the least
+ * recently used entries are evicted. If ttl_ms is positive, entries
+ * older than that are discarded on lookup.
+ */
+class ResultCache {
+public:
+    ResultCache( long max_bytes_in, long ttl_ms_in );
+    Value_P lookup( const string &key );
+    void insert( const string &key, Value_P value );
+    void clear( void );
+    Value_P make_stats_value( void );
+
+private:
+    void remove_entry( std::list<CacheEntry>::iterator entry );
+
+    long max_bytes;
+    long ttl_ms;
+    long current_bytes;
+    long hits;
+    long misses;
+    long evictions;
+    long invalidations;
+    std::list<CacheEntry> entries;
+    std::unordered_map<string, std::list<CacheEntry>::iterator> index;
+    std::mutex lock;
+};
+
+string make_cache_key( const string &statement, Value_P B );
+
+#endif
@@ -0,0 +1,47 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "RetainedResult.hh"
+
+#include "Value.hh"
+
+long ConvertedResult::get_row_count( void )
+{
+    return value->get_rank() == 2 ? value->get_rows() : 0;
+}
+
+int ConvertedResult::get_column_count( void )
+{
+    return value->get_rank() == 2 ? value->get_cols() : 0;
+}
+
+Value_P ConvertedResult::fetch( long start, long end, const vector<int> &cols )
+{
+    int value_cols = value->get_cols();
+    Value_P result( new Value( Shape( end - start, cols.size() ), LOC ) );
+    for( long row = start ; row < end ; row++ ) {
+        for( vector<int>::const_iterator col = cols.begin() ; col != cols.end() ; col++ ) {
+            result->next_ravel()->init( value->get_ravel( row * value_cols + *col ), *result.get(), LOC );
+        }
+    }
+    result->check_value( LOC );
+    return result;
+}
@@ -0,0 +1,60 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef RETAINED_RESULT_HH
+#define RETAINED_RESULT_HH
+
+#include "apl-sqlite.hh"
+
+/*
+ * The result of a query that is kept outside the workspace, so that
+ * parts of it can be converted when they are needed. Results are owned
+ * by the connection, and are referred to from APL using the id returned
+ * by Connection::add_retained_result().
+ */
+class RetainedResult {
+public:
+    virtual ~RetainedResult() {}
+    virtual long get_row_count( void ) = 0;
+    virtual int get_column_count( void ) = 0;
+
+    // Converts rows start to end of the given columns. The caller has
+    // checked that the range isn't empty and that the columns exist.
+    virtual Value_P fetch( long start, long end, const vector<int> &cols ) = 0;
+};
+
+/*
+ * A result that has already been converted in full. Used by databases
+ * that can't keep the result any other way.
+ */
+class ConvertedResult : public RetainedResult {
+public:
+    ConvertedResult( Value_P value_in ) : value( value_in ) {}
+    virtual ~ConvertedResult() {}
+    virtual long get_row_count( void );
+    virtual int get_column_count( void );
+    virtual Value_P fetch( long start, long end, const vector<int> &cols );
+
+private:
+    Value_P value;
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCHEMA_CACHE_HH
+#define SCHEMA_CACHE_HH
+
+#include "apl-sqlite.hh"
+
+class ColumnInfo {
+public:
+    ColumnInfo( const string &name_in, const string &type_in, bool nullable_in, int primary_key_position_in )
+        : name( name_in ), type( type_in ), nullable( nullable_in ), primary_key_position( primary_key_position_in ) {}
+    string name;
+    string type;
+    bool nullable;
+
+    // Position of the column in the primary key, starting at 1, or 0 if
+    // the column isn't part of the primary key
+    int primary_key_position;
+};
+
+class IndexInfo {
+public:
+    IndexInfo( const string &name_in, bool unique_in ) : name( name_in ), unique( unique_in ) {}
+    string name;
+    bool unique;
+    vector<string> columns;
+};
+
+class TableInfo {
+public:
+    TableInfo() : row_estimate( -1 ) {}
+    vector<ColumnInfo> columns;
+    vector<IndexInfo> indexes;
+
+    // Estimated number of rows, or -1 if the database has no estimate
+    long row_estimate;
+};
+
+/*
+ * Table metadata of a connection. The cache is keyed on a schema
+ * version read from the database, and everything is dropped as soon as
+ * the version changes.
+ */
+class SchemaCache {
+public:
+    SchemaCache() : tables_valid( false ) {}
+    void validate( const string &version );
+    vector<string> *find_tables( void ) { return tables_valid ? &tables : NULL; }
+    void set_tables( const vector<string> &tables_in ) { tables = tables_in; tables_valid = true; }
+    TableInfo *find_table_info( const string &table );
+    TableInfo *add_table_info( const string &table ) { return &table_infos[table]; }
+
+private:
+    string version;
+    bool tables_valid;
+    vector<string> tables;
+    map<string, TableInfo> table_infos;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SlowQueryLog.hh"
+
+#include <fstream>
+
+static const int MAX_DESCRIBED_ROWS = 5;
+
+static void describe_cell( ostream &out, const Cell &cell )
+{
+    if( cell.is_integer_cell() ) {
+        out << cell.get_int_value();
+    }
+    else if( cell.is_float_cell() ) {
+        out << setprecision( 17 ) << cell.get_real_value();
+    }
+    else {
+        Value_P value = cell.to_value( LOC );
+        if( value->element_count() == 0 ) {
+            out << "NULL";
+        }
+        else if( value->is_char_string() ) {
+            out << "'" << to_string( value->get_UCS_ravel() ) << "'";
+        }
+        else {
+            out << "?";
+        }
+    }
+}
+
+/*
+ * Formats the bind parameters for the log. For rank-2 parameters, only
+ * the first few rows are included.
+ */
+string describe_bind_args( Value_P B )
+{
+    stringstream out;
+    if( B->get_rank() == 2 ) {
+        int rows = B->get_rows();
+        int cols = B->get_cols();
+        out << rows << " rows:";
+        for( int row = 0 ; row < rows && row < MAX_DESCRIBED_ROWS ; row++ ) {
+            out << " (";
+            for( int col = 0 ; col < cols ; col++ ) {
+                if( col > 0 ) {
+                    out << ", ";
+                }
+                describe_cell( out, B->get_ravel( row * cols + col ) );
+            }
+            out << ")";
+        }
+        if( rows > MAX_DESCRIBED_ROWS ) {
+            out << " ...";
+        }
+    }
+    else {
+        for( int i = 0 ; i < B->element_count() ; i++ ) {
+            if( i > 0 ) {
+                out << ", ";
+            }
+            describe_cell( out, B->get_ravel( i ) );
+        }
+    }
+    return out.str();
+}
+
+void SlowQueryLog::add( const SlowQueryEntry &entry )
+{
+    if( capacity > 0 ) {
+        if( entries.size() == capacity ) {
+            entries.pop_front();
+        }
+        entries.push_back( entry );
+    }
+
+    if( filename.size() > 0 ) {
+        write_to_file( entry );
+    }
+}
+
+static const char *phase_names[NUM_PHASES] = { "prepare", "bind", "execute", "convert", "strings" };
+
+void SlowQueryLog::write_to_file( const SlowQueryEntry &entry )
+{
+    ofstream out( filename.c_str(), ios::app );
+    if( !out ) {
+        CERR << "Unable to write to slow query log: " << filename << endl;
+        return;
+    }
+
+    out << "time: " << entry.timestamp_ms << endl
+        << "sql: " << entry.sql << endl
+        << "binds: " << entry.binds << endl
+        << "rows: " << entry.rows << endl
+        << "total_ms: " << entry.total_ns / 1000000.0 << endl;
+    for( int i = 0 ; i < NUM_PHASES ; i++ ) {
+        out << phase_names[i] << "_ms: " << entry.phase_ns[i] / 1000000.0 << endl;
+    }
+    out << "details: " << entry.details << endl
+        << "plan:" << endl << entry.plan << endl
+        << endl;
+}
+
+/*
+ * Columns: timestamp (ms since the epoch), sql, binds, rows, total,
+ * prepare, bind, execute, convert, strings (all in milliseconds),
+ * details, plan
+ */
+Value_P SlowQueryLog::make_log_value( void )
+{
+    if( entries.size() == 0 ) {
+        return Idx0( LOC );
+    }
+
+    Value_P value( new Value( Shape( entries.size(), 7 + NUM_PHASES ), LOC ) );
+    for( std::deque<SlowQueryEntry>::iterator i = entries.begin() ; i != entries.end() ; i++ ) {
+        new (value->next_ravel()) IntCell( i->timestamp_ms );
+        new (value->next_ravel()) PointerCell( make_string_cell( i->sql, LOC ) );
+        new (value->next_ravel()) PointerCell( i->binds.size() == 0 ? Str0( LOC ) : make_string_cell( i->binds, LOC ) );
+        new (value->next_ravel()) IntCell( i->rows );
+        new (value->next_ravel()) FloatCell( i->total_ns / 1000000.0 );
+        for( int phase = 0 ; phase < NUM_PHASES ; phase++ ) {
+            new (value->next_ravel()) FloatCell( i->phase_ns[phase] / 1000000.0 );
+        }
+        new (value->next_ravel()) PointerCell( i->details.size() == 0 ? Str0( LOC ) : make_string_cell( i->details, LOC ) );
+        new (value->next_ravel()) PointerCell( i->plan.size() == 0 ? Str0( LOC ) : make_string_cell( i->plan, LOC ) );
+    }
+
+    value->check_value( LOC );
+    return value;
+}
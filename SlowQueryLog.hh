@@ -0,0 +1,65 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SLOW_QUERY_LOG_HH
+#define SLOW_QUERY_LOG_HH
+
+#include "apl-sqlite.hh"
+#include "QueryStats.hh"
+
+#include <deque>
+
+class SlowQueryEntry {
+public:
+    long timestamp_ms;
+    string sql;
+    string binds;
+    long rows;
+    long total_ns;
+    long phase_ns[NUM_PHASES];
+    string details;
+    string plan;
+};
+
+/*
+ * Keeps the most recent statements that took longer than the
+ * threshold. If a filename is given, entries are also appended to
+ * that file.
+ */
+class SlowQueryLog {
+public:
+    SlowQueryLog( long threshold_ms_in, int capacity_in, const string &filename_in )
+        : threshold_ms( threshold_ms_in ), capacity( capacity_in ), filename( filename_in ) {}
+    long get_threshold_ms( void ) { return threshold_ms; }
+    void add( const SlowQueryEntry &entry );
+    Value_P make_log_value( void );
+
+private:
+    void write_to_file( const SlowQueryEntry &entry );
+
+    long threshold_ms;
+    size_t capacity;
+    string filename;
+    std::deque<SlowQueryEntry> entries;
+};
+
+string describe_bind_args( Value_P B );
+
+#endif
@@ -22,9 +22,12 @@
 
 #include <string.h>
 #include "SqliteResultValue.hh"
+#include "ThreadPool.hh"
+#include "QueryStats.hh"
 
 void SqliteArgListBuilder::init_sql( void )
 {
+    PhaseTimer timer( PHASE_PREPARE );
     const char *sql_charptr = sql.c_str();
     if( sqlite3_prepare_v2( connection->get_db(),
                             sql_charptr, strlen( sql_charptr ) + 1,
@@ -46,8 +49,23 @@ SqliteArgListBuilder::~SqliteArgListBuilder()
 
 void SqliteArgListBuilder::clear_args( void )
 {
-    sqlite3_finalize( statement );
-    init_sql();
+    // Any error from the last step has already been reported
+    sqlite3_reset( statement );
+    sqlite3_clear_bindings( statement );
+}
+
+int SqliteArgListBuilder::get_param_count( void )
+{
+    return sqlite3_bind_parameter_count( statement );
+}
+
+void SqliteArgListBuilder::describe_columns( vector<ColumnDescriptor> &cols )
+{
+    int n = sqlite3_column_count( statement );
+    for( int i = 0 ; i < n ; i++ ) {
+        const char *type = sqlite3_column_decltype( statement, i );
+        cols.push_back( ColumnDescriptor( sqlite3_column_name( statement, i ), type == NULL ? "" : type ) );
+    }
 }
 
 static void free_text_arg( void *arg )
@@ -80,37 +98,155 @@ void SqliteArgListBuilder::append_null( int pos )
     sqlite3_bind_null( statement, pos + 1 );
 }
 
-Value_P SqliteArgListBuilder::run_query( bool ignore_result )
+void SqliteArgListBuilder::set_type_hints( const string &hints )
 {
-    vector<ResultRow> results;
+    type_hints = hints;
+}
+
+/*
+ * Estimate of the memory used by a row of the result
+ */
+static long row_bytes( sqlite3_stmt *statement, int col_count )
+{
+    long bytes = col_count * sizeof( Cell );
+    for( int col = 0 ; col < col_count ; col++ ) {
+        int type = sqlite3_column_type( statement, col );
+        if( type == SQLITE_TEXT || type == SQLITE_BLOB ) {
+            bytes += sqlite3_column_bytes( statement, col ) * sizeof( Unicode );
+        }
+    }
+    return bytes;
+}
+
+void SqliteArgListBuilder::fetch_rows( vector<ResultColumn *> &columns, long *row_count )
+{
+    PhaseTimer timer( PHASE_EXECUTE );
+    StatementLimiter limiter( connection );
+    bool counting_bytes = limiter.is_counting_bytes();
+    TemporalMode temporal_mode = connection->get_temporal_mode();
+    int col_count = sqlite3_column_count( statement );
     int result;
     while( (result = sqlite3_step( statement )) != SQLITE_DONE ) {
         if( result != SQLITE_ROW ) {
+            if( limiter.is_stopped() ) {
+                sqlite3_reset( statement );
+                limiter.raise_stop_error();
+            }
             connection->raise_sqlite_error( "Error reading sql result" );
         }
 
-        ResultRow row;
-        row.add_values( statement );
-        results.push_back( row );
+        if( limiter.add_row( counting_bytes ? row_bytes( statement, col_count ) : 0 ) ) {
+            sqlite3_reset( statement );
+            limiter.raise_stop_error();
+        }
+
+        if( columns.size() == 0 ) {
+            for( int col = 0 ; col < col_count ; col++ ) {
+                TypeHint hint = col < type_hints.size() ? static_cast<TypeHint>( type_hints[col] ) : TYPE_HINT_AUTO;
+                const NullSentinel *sentinel = null_sentinels == NULL ? NULL : &null_sentinels->for_column( col );
+                columns.push_back( make_result_column( statement, col, hint, temporal_mode, sentinel ) );
+            }
+        }
+
+        for( int col = 0 ; col < col_count ; col++ ) {
+            columns[col]->fetch( statement, col );
+        }
+        (*row_count)++;
     }
+}
 
+/*
+ * Cells that don't need an APL value to be allocated are written
+ * column by column, by the worker threads for large results. The
+ * remaining cells are filled in afterwards on the calling thread.
+ */
+static Value_P make_result( vector<ResultColumn *> &columns, long row_count )
+{
+    int col_count = columns.size();
+    Value_P db_result_value( new Value( Shape( row_count, col_count ), LOC ) );
+    Value *value_ptr = db_result_value.get();
+    if( row_count * col_count >= PARALLEL_CONVERSION_THRESHOLD ) {
+        ThreadPool::get_instance()->run_partitioned( row_count, [&]( int, long start, long end ) {
+                for( int col = 0 ; col < col_count ; col++ ) {
+                    columns[col]->fill_from_worker( value_ptr, col, col_count, start, end );
+                }
+            } );
+    }
+    else {
+        for( int col = 0 ; col < col_count ; col++ ) {
+            columns[col]->fill_from_worker( value_ptr, col, col_count, 0, row_count );
+        }
+    }
+
+    for( int col = 0 ; col < col_count ; col++ ) {
+        columns[col]->fill_deferred( value_ptr, col, col_count );
+    }
+    return db_result_value;
+}
+
+Value_P SqliteArgListBuilder::run_query( bool ignore_result )
+{
+    vector<ResultColumn *> columns;
+    long row_count = 0;
     Value_P db_result_value;
-    int row_count = results.size();
-    if( row_count > 0 ) {
-        int col_count = results[0].get_values().size();
-        Shape result_shape( row_count, col_count );
-        db_result_value = new Value( result_shape, LOC );
-        for( vector<ResultRow>::iterator row_iterator = results.begin() ; row_iterator != results.end() ; row_iterator++ ) {
-            const vector<const ResultValue *> &row = row_iterator->get_values();
-            for( vector<const ResultValue *>::const_iterator col_iterator = row.begin() ; col_iterator != row.end() ; col_iterator++ ) {
-                (*col_iterator)->update( db_result_value->next_ravel() );
+    try {
+        fetch_rows( columns, &row_count );
+
+        PhaseTimer timer( PHASE_CONVERT );
+        if( row_count > 0 ) {
+            db_result_value = make_result( columns, row_count );
+        }
+        else {
+            db_result_value = Idx0( LOC );
+        }
+
+        if( null_sentinels != NULL ) {
+            Value_P mask = Idx0( LOC );
+            if( row_count > 0 ) {
+                mask = make_null_mask( row_count, columns.size() );
+                for( int col = 0 ; col < columns.size() ; col++ ) {
+                    columns[col]->mark_nulls( mask.get(), col, columns.size() );
+                }
             }
+            null_sentinels->set_mask( mask );
         }
     }
-    else {
-        db_result_value = Idx0( LOC );
+    catch( ... ) {
+        for( vector<ResultColumn *>::iterator i = columns.begin() ; i != columns.end() ; i++ ) {
+            delete *i;
+        }
+        throw;
+    }
+
+    for( vector<ResultColumn *>::iterator i = columns.begin() ; i != columns.end() ; i++ ) {
+        delete *i;
     }
 
     db_result_value->check_value( LOC );
     return db_result_value;
 }
+
+/*
+ * All rows are read, since SQLite statements can't be positioned, but
+ * they are kept in the result columns instead of being converted
+ */
+RetainedResult *SqliteArgListBuilder::run_retained_query( void )
+{
+    if( sqlite3_column_count( statement ) == 0 ) {
+        Workspace::more_error() = "Statement does not return a result";
+        DOMAIN_ERROR;
+    }
+
+    vector<ResultColumn *> columns;
+    long row_count = 0;
+    try {
+        fetch_rows( columns, &row_count );
+    }
+    catch( ... ) {
+        for( vector<ResultColumn *>::iterator i = columns.begin() ; i != columns.end() ; i++ ) {
+            delete *i;
+        }
+        throw;
+    }
+    return new SqliteRetainedResult( columns, sqlite3_column_count( statement ), row_count );
+}
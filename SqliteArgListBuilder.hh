@@ -24,6 +24,7 @@
 #include "apl-sqlite.hh"
 #include "SqliteConnection.hh"
 #include "ArgListBuilder.hh"
+#include "SqliteResultColumn.hh"
 
 class SqliteArgListBuilder : public ArgListBuilder {
 public:
@@ -34,11 +35,17 @@ public:
     virtual void append_double( double arg, int pos );
     virtual void append_null( int pos );
     virtual Value_P run_query( bool ignore_result );
+    virtual RetainedResult *run_retained_query( void );
     virtual void clear_args( void );
+    virtual int get_param_count( void );
+    virtual void describe_columns( vector<ColumnDescriptor> &cols );
+    virtual void set_type_hints( const string &hints );
 
 private:
     void init_sql( void );
+    void fetch_rows( vector<ResultColumn *> &columns, long *row_count );
     string sql;
+    string type_hints;
     SqliteConnection *connection;
     sqlite3_stmt *statement;
 };
@@ -22,6 +22,8 @@
 #include "SqliteConnection.hh"
 #include "SqliteResultValue.hh"
 #include "SqliteArgListBuilder.hh"
+#include "SqliteFunction.hh"
+#include "SqliteVirtualTable.hh"
 
 void SqliteConnection::raise_sqlite_error( const string &message )
 {
@@ -31,16 +33,259 @@ void SqliteConnection::raise_sqlite_error( const string &message )
     DOMAIN_ERROR;
 }
 
+/*
+ * Called by SQLite while a statement runs. Returning non-zero makes
+ * the statement fail with SQLITE_INTERRUPT.
+ */
+static int progress_callback( void *arg )
+{
+    StatementLimiter *limiter = static_cast<SqliteConnection *>( arg )->get_active_limiter();
+    return limiter != NULL && limiter->should_stop() ? 1 : 0;
+}
+
 SqliteConnection::SqliteConnection( sqlite3 *db_in )
-    : db( db_in )
+    : db( db_in ), apl_module_registered( false ), functions_registered( false ), modified_since_validate( false ), last_data_version( 0 ),
+      fullscan_steps( 0 ), sorts( 0 ), autoindexes( 0 ), vm_steps( 0 )
 {
+    sqlite3_progress_handler( db, PROGRESS_INTERVAL, progress_callback, this );
 }
 
 SqliteConnection::~SqliteConnection()
 {
+    close_write_behind();
+    close_prepared_statements();
     if( sqlite3_close( db ) != SQLITE_OK ) {
         raise_sqlite_error( "Error closing database" );
     }
+
+    for( map<string, AplVirtualTable *>::iterator i = virtual_tables.begin() ; i != virtual_tables.end() ; i++ ) {
+        delete i->second;
+    }
+}
+
+/*
+ * Statements are prepared once and kept for as long as write-behind
+ * is enabled.
+ */
+class SqliteBatchWriter : public BatchWriter {
+public:
+    SqliteBatchWriter( sqlite3 *db_in ) : db( db_in ) {}
+    virtual ~SqliteBatchWriter();
+    virtual bool begin( string &error ) { return run_simple( "begin", error ); }
+    virtual bool execute( const QueuedStatement &statement, string &error );
+    virtual bool commit( string &error ) { return run_simple( "commit", error ); }
+    virtual void rollback( void ) { string error; run_simple( "rollback", error ); }
+
+private:
+    bool run_simple( const char *sql, string &error );
+    sqlite3 *db;
+    map<string, sqlite3_stmt *> statements;
+};
+
+SqliteBatchWriter::~SqliteBatchWriter()
+{
+    for( map<string, sqlite3_stmt *>::iterator i = statements.begin() ; i != statements.end() ; i++ ) {
+        sqlite3_finalize( i->second );
+    }
+}
+
+bool SqliteBatchWriter::run_simple( const char *sql, string &error )
+{
+    char *message;
+    if( sqlite3_exec( db, sql, NULL, NULL, &message ) != SQLITE_OK ) {
+        error = message;
+        sqlite3_free( message );
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Binds the cols values starting at binds to parameters 1 to cols
+ */
+static bool bind_queued_row( sqlite3_stmt *statement, const QueuedBind *binds, int cols )
+{
+    for( int col = 0 ; col < cols ; col++ ) {
+        const QueuedBind &bind = binds[col];
+        int result;
+        switch( bind.type ) {
+        case QueuedBind::BIND_LONG:
+            result = sqlite3_bind_int64( statement, col + 1, bind.long_value );
+            break;
+        case QueuedBind::BIND_DOUBLE:
+            result = sqlite3_bind_double( statement, col + 1, bind.double_value );
+            break;
+        case QueuedBind::BIND_STRING:
+            result = sqlite3_bind_text( statement, col + 1, bind.string_value.c_str(),
+                                        bind.string_value.size(), SQLITE_TRANSIENT );
+            break;
+        default:
+            result = sqlite3_bind_null( statement, col + 1 );
+        }
+        if( result != SQLITE_OK ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SqliteBatchWriter::execute( const QueuedStatement &queued, string &error )
+{
+    sqlite3_stmt *statement;
+    map<string, sqlite3_stmt *>::iterator i = statements.find( queued.statement );
+    if( i == statements.end() ) {
+        if( sqlite3_prepare_v2( db, queued.statement.c_str(), -1, &statement, NULL ) != SQLITE_OK ) {
+            error = sqlite3_errmsg( db );
+            return false;
+        }
+        statements[queued.statement] = statement;
+    }
+    else {
+        statement = i->second;
+    }
+
+    for( long row = 0 ; row < queued.rows ; row++ ) {
+        bool ok = bind_queued_row( statement, &queued.binds[row * queued.cols], queued.cols );
+        int result = SQLITE_DONE;
+        while( ok && (result = sqlite3_step( statement )) == SQLITE_ROW ) {
+        }
+        if( !ok || result != SQLITE_DONE ) {
+            error = sqlite3_errmsg( db );
+            sqlite3_reset( statement );
+            return false;
+        }
+        sqlite3_reset( statement );
+        sqlite3_clear_bindings( statement );
+    }
+    return true;
+}
+
+/*
+ * An upsert with do update doesn't tell whether the row was inserted or
+ * updated, so each row is first inserted with do nothing, and only
+ * updated if that didn't change anything. Parameters are numbered by
+ * column, so both statements are bound from the same row.
+ */
+void SqliteConnection::upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated )
+{
+    int cols = spec.columns.size();
+    vector<string> params;
+    stringstream values;
+    values << "values (";
+    for( int col = 0 ; col < cols ; col++ ) {
+        stringstream param;
+        param << "?" << (col + 1);
+        params.push_back( param.str() );
+        values << (col > 0 ? ", " : "") << param.str();
+    }
+    values << ")";
+
+    sqlite3_stmt *statement;
+    if( sqlite3_prepare_v2( db, make_upsert_insert_sql( spec, values.str(), false ).c_str(), -1,
+                            &statement, NULL ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error preparing upsert" );
+    }
+    SqliteStmtWrapper insert( statement );
+
+    statement = NULL;
+    string update_sql = make_upsert_update_sql( spec, params );
+    if( update_sql.size() > 0
+        && sqlite3_prepare_v2( db, update_sql.c_str(), -1, &statement, NULL ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error preparing upsert" );
+    }
+    SqliteStmtWrapper update( statement );
+
+    long rows = binds.size() / cols;
+    for( long row = 0 ; row < rows ; row++ ) {
+        const QueuedBind *row_binds = &binds[row * cols];
+        if( run_bound_statement( insert.get_statement(), row_binds, cols ) > 0 ) {
+            (*inserted)++;
+        }
+        else if( statement != NULL && run_bound_statement( statement, row_binds, cols ) > 0 ) {
+            (*updated)++;
+        }
+    }
+}
+
+/*
+ * Runs the statement with one row of values, and returns the number of
+ * rows it changed
+ */
+int SqliteConnection::run_bound_statement( sqlite3_stmt *statement, const QueuedBind *binds, int cols )
+{
+    if( !bind_queued_row( statement, binds, cols ) ) {
+        raise_sqlite_error( "Error binding upsert values" );
+    }
+    int result = sqlite3_step( statement );
+    sqlite3_reset( statement );
+    if( result != SQLITE_DONE ) {
+        raise_sqlite_error( "Error in upsert" );
+    }
+    return sqlite3_changes( db );
+}
+
+/*
+ * Rows are written with one prepared insert for the whole import. A
+ * failed insert only undoes itself, so the other rows of the batch are
+ * kept, unless the error rolled back the transaction.
+ */
+class SqliteTableImporter : public TableImporter {
+public:
+    SqliteTableImporter( SqliteConnection *conn_in, sqlite3_stmt *statement_in, int cols_in )
+        : conn( conn_in ), statement( statement_in ), cols( cols_in ) {}
+    virtual ~SqliteTableImporter() { sqlite3_finalize( statement ); }
+    virtual long write_batch( const vector<QueuedBind> &binds, const vector<long> &lines,
+                              vector<pair<long, string> > &rejected );
+
+private:
+    SqliteConnection *conn;
+    sqlite3_stmt *statement;
+    int cols;
+};
+
+long SqliteTableImporter::write_batch( const vector<QueuedBind> &binds, const vector<long> &lines,
+                                       vector<pair<long, string> > &rejected )
+{
+    sqlite3 *db = conn->get_db();
+    long written = 0;
+    for( size_t row = 0 ; row < lines.size() ; row++ ) {
+        bool ok = bind_queued_row( statement, &binds[row * cols], cols );
+        int result = ok ? sqlite3_step( statement ) : SQLITE_ERROR;
+        if( result == SQLITE_DONE ) {
+            written++;
+        }
+        else {
+            rejected.push_back( pair<long, string>( lines[row], sqlite3_errmsg( db ) ) );
+        }
+        sqlite3_reset( statement );
+        if( sqlite3_get_autocommit( db ) ) {
+            conn->raise_sqlite_error( "Import failed" );
+        }
+    }
+    return written;
+}
+
+TableImporter *SqliteConnection::make_table_importer( const string &table, const vector<string> &columns )
+{
+    stringstream sql;
+    stringstream values;
+    sql << "insert into " << quote_table_name( table ) << " (";
+    for( size_t col = 0 ; col < columns.size() ; col++ ) {
+        sql << (col > 0 ? ", " : "") << quote_identifier( columns[col] );
+        values << (col > 0 ? ", " : "") << "?" << (col + 1);
+    }
+    sql << ") values (" << values.str() << ")";
+
+    sqlite3_stmt *statement;
+    if( sqlite3_prepare_v2( db, sql.str().c_str(), -1, &statement, NULL ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error preparing import" );
+    }
+    return new SqliteTableImporter( this, statement, columns.size() );
+}
+
+BatchWriter *SqliteConnection::make_batch_writer( void )
+{
+    return new SqliteBatchWriter( db );
 }
 
 ArgListBuilder *SqliteConnection::make_prepared_query( const string &sql )
@@ -61,6 +306,38 @@ void SqliteConnection::run_simple( const string &sql )
     builder.run_query( false );
 }
 
+/*
+ * Statements can't be prepared before the ones before them have been
+ * run, since they may refer to tables created by them. Instead, a
+ * semicolon ends a statement when sqlite3_complete() agrees, which
+ * handles quotes, comments and trigger bodies.
+ */
+void SqliteConnection::split_script( const string &script, vector<string> &statements )
+{
+    size_t start = 0;
+    for( size_t i = 0 ; i <= script.size() ; i++ ) {
+        bool at_end = i == script.size();
+        if( !at_end && script[i] != ';' ) {
+            continue;
+        }
+
+        string statement = script.substr( start, i - start + (at_end ? 0 : 1) );
+        if( !at_end && !sqlite3_complete( statement.c_str() ) ) {
+            continue;
+        }
+
+        // Preparing a statement with only whitespace and comments gives
+        // no statement, and never fails
+        sqlite3_stmt *prepared = NULL;
+        int result = sqlite3_prepare_v2( db, statement.c_str(), -1, &prepared, NULL );
+        if( result != SQLITE_OK || prepared != NULL ) {
+            statements.push_back( statement );
+        }
+        sqlite3_finalize( prepared );
+        start = i + 1;
+    }
+}
+
 void SqliteConnection::transaction_begin()
 {
     run_simple( "begin" );
@@ -100,20 +377,406 @@ void SqliteConnection::fill_tables( vector<string> &tables )
     }
 }
 
-void SqliteConnection::fill_cols( const string &table, vector<ColumnDescriptor> &cols )
+static const char *column_text( sqlite3_stmt *statement, int col )
+{
+    const unsigned char *text = sqlite3_column_text( statement, col );
+    return text == NULL ? "" : reinterpret_cast<const char *>( text );
+}
+
+void SqliteConnection::fill_table_info( const string &table, TableInfo &info )
 {
     sqlite3_stmt *statement;
     char *statement_content = sqlite3_mprintf( "pragma table_info('%q')", table.c_str() );
-    if( sqlite3_prepare_v2( get_db(), statement_content, -1, &statement, NULL ) != SQLITE_OK ) {
-        raise_sqlite_error( "Error getting table names" );
+    int prepare_result = sqlite3_prepare_v2( get_db(), statement_content, -1, &statement, NULL );
+    sqlite3_free( statement_content );
+    if( prepare_result != SQLITE_OK ) {
+        raise_sqlite_error( "Error getting table info" );
+    }
+
+    {
+        SqliteStmtWrapper statement_wrapper( statement );
+        while( sqlite3_step( statement ) == SQLITE_ROW ) {
+            info.columns.push_back( ColumnInfo( column_text( statement, 1 ), column_text( statement, 2 ),
+                                                sqlite3_column_int( statement, 3 ) == 0,
+                                                sqlite3_column_int( statement, 5 ) ) );
+        }
+    }
+
+    statement_content = sqlite3_mprintf( "pragma index_list('%q')", table.c_str() );
+    prepare_result = sqlite3_prepare_v2( get_db(), statement_content, -1, &statement, NULL );
+    sqlite3_free( statement_content );
+    if( prepare_result != SQLITE_OK ) {
+        raise_sqlite_error( "Error getting index list" );
+    }
+
+    {
+        SqliteStmtWrapper statement_wrapper( statement );
+        while( sqlite3_step( statement ) == SQLITE_ROW ) {
+            info.indexes.push_back( IndexInfo( column_text( statement, 1 ), sqlite3_column_int( statement, 2 ) != 0 ) );
+        }
+    }
+
+    for( vector<IndexInfo>::iterator i = info.indexes.begin() ; i != info.indexes.end() ; i++ ) {
+        statement_content = sqlite3_mprintf( "pragma index_info('%q')", i->name.c_str() );
+        prepare_result = sqlite3_prepare_v2( get_db(), statement_content, -1, &statement, NULL );
+        sqlite3_free( statement_content );
+        if( prepare_result != SQLITE_OK ) {
+            raise_sqlite_error( "Error getting index info" );
+        }
+
+        // Expressions in the index have no name
+        SqliteStmtWrapper statement_wrapper( statement );
+        while( sqlite3_step( statement ) == SQLITE_ROW ) {
+            if( sqlite3_column_type( statement, 2 ) == SQLITE_TEXT ) {
+                i->columns.push_back( column_text( statement, 2 ) );
+            }
+        }
+    }
+
+    // The estimate is only available after the table has been analyzed
+    if( sqlite3_prepare_v2( get_db(), "select stat from sqlite_stat1 where tbl = ?", -1,
+                            &statement, NULL ) == SQLITE_OK ) {
+        SqliteStmtWrapper statement_wrapper( statement );
+        sqlite3_bind_text( statement, 1, table.c_str(), -1, SQLITE_TRANSIENT );
+        if( sqlite3_step( statement ) == SQLITE_ROW ) {
+            info.row_estimate = atol( column_text( statement, 0 ) );
+        }
+    }
+}
+
+long SqliteConnection::read_pragma_long( const char *sql )
+{
+    sqlite3_stmt *statement;
+    if( sqlite3_prepare_v2( get_db(), sql, -1, &statement, NULL ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error reading pragma" );
     }
 
     SqliteStmtWrapper statement_wrapper( statement );
+    if( sqlite3_step( statement ) != SQLITE_ROW ) {
+        raise_sqlite_error( "Error reading pragma" );
+    }
+    return sqlite3_column_int64( statement, 0 );
+}
+
+/*
+ * The schema version is incremented by SQLite whenever the schema
+ * changes. Temporary tables have their own version.
+ */
+const string SqliteConnection::read_schema_version( void )
+{
+    stringstream out;
+    out << read_pragma_long( "pragma schema_version" ) << ":" << read_pragma_long( "pragma temp.schema_version" );
+    return out.str();
+}
+
+static sqlite3 *open_backup_file( const string &filename, int flags )
+{
+    sqlite3 *file_db;
+    if( sqlite3_open_v2( filename.c_str(), &file_db, flags, NULL ) != SQLITE_OK ) {
+        stringstream out;
+        out << "Error opening database file: " << sqlite3_errmsg( file_db );
+        sqlite3_close( file_db );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    return file_db;
+}
+
+// How long a backup keeps retrying while the database is busy or locked
+static const int BACKUP_BUSY_TIMEOUT_MS = 5000;
+static const int BACKUP_BUSY_SLEEP_MS = 10;
+
+/*
+ * Copies the main database from source to dest. A negative value for
+ * pages_per_step copies everything in one step. The backup fails if it
+ * can make no progress for BACKUP_BUSY_TIMEOUT_MS.
+ */
+static void run_backup( sqlite3 *dest, sqlite3 *source, int pages_per_step, sqlite3 *file_db )
+{
+    sqlite3_backup *backup = sqlite3_backup_init( dest, "main", source, "main" );
+    if( backup == NULL ) {
+        stringstream out;
+        out << "Error starting backup: " << sqlite3_errmsg( dest );
+        sqlite3_close( file_db );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+
     int result;
-    while( (result = sqlite3_step( statement_wrapper.get_statement() )) != SQLITE_DONE ) {
-        cols.push_back( ColumnDescriptor( reinterpret_cast<const char *>( sqlite3_column_text( statement, 1 ) ),
-                                          reinterpret_cast<const char *>( sqlite3_column_text( statement, 2 ) ) ) );
+    int busy_ms = 0;
+    do {
+        result = sqlite3_backup_step( backup, pages_per_step );
+        if( result == SQLITE_BUSY || result == SQLITE_LOCKED ) {
+            if( busy_ms >= BACKUP_BUSY_TIMEOUT_MS ) {
+                break;
+            }
+            sqlite3_sleep( BACKUP_BUSY_SLEEP_MS );
+            busy_ms += BACKUP_BUSY_SLEEP_MS;
+        }
+        else {
+            busy_ms = 0;
+        }
+    } while( result == SQLITE_OK || result == SQLITE_BUSY || result == SQLITE_LOCKED );
+    sqlite3_backup_finish( backup );
+
+    if( result != SQLITE_DONE ) {
+        stringstream out;
+        out << "Error during backup: " << sqlite3_errstr( result );
+        sqlite3_close( file_db );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+void SqliteConnection::load_file( const string &filename, int pages_per_step )
+{
+    sqlite3 *file_db = open_backup_file( filename, SQLITE_OPEN_READONLY );
+    run_backup( db, file_db, pages_per_step, file_db );
+    sqlite3_close( file_db );
+}
+
+void SqliteConnection::save_file( const string &filename, int pages_per_step )
+{
+    sqlite3 *file_db = open_backup_file( filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE );
+    run_backup( file_db, db, pages_per_step, file_db );
+    sqlite3_close( file_db );
+}
+
+Value_P SqliteConnection::serialize( void )
+{
+    // An empty database has no pages, and gives NULL with a size of 0
+    sqlite3_int64 size;
+    unsigned char *content = sqlite3_serialize( db, "main", &size, 0 );
+    if( size == 0 ) {
+        sqlite3_free( content );
+        return Idx0( LOC );
+    }
+    if( content == NULL ) {
+        raise_sqlite_error( "Error serializing database" );
     }
+
+    Value_P result( new Value( Shape( size ), LOC ) );
+    for( sqlite3_int64 i = 0 ; i < size ; i++ ) {
+        new (result->next_ravel()) IntCell( content[i] );
+    }
+    sqlite3_free( content );
+
+    result->check_value( LOC );
+    return result;
+}
+
+void SqliteConnection::deserialize( const vector<unsigned char> &content )
+{
+    // SQLite takes ownership of the buffer, so it has to be allocated
+    // using the SQLite allocator.
+    sqlite3_int64 size = content.size();
+    unsigned char *buf = static_cast<unsigned char *>( sqlite3_malloc64( size == 0 ? 1 : size ) );
+    if( buf == NULL ) {
+        Workspace::more_error() = "Failed to allocate memory for database content";
+        WS_FULL;
+    }
+    memcpy( buf, content.data(), size );
+
+    if( sqlite3_deserialize( db, "main", buf, size, size,
+                             SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error loading database content" );
+    }
+}
+
+void SqliteConnection::create_function( const string &sql_name, const string &apl_name, int num_args, bool aggregate )
+{
+    if( get_write_behind() != NULL ) {
+        Workspace::more_error() = "APL functions and tables can't be used while write-behind is enabled";
+        DOMAIN_ERROR;
+    }
+
+    // The function is only looked up when a statement calls it, so check
+    // it here to report a wrong name at registration
+    if( !SqliteFunction::is_defined_function( apl_name ) ) {
+        stringstream out;
+        out << "Not a defined APL function: " << apl_name;
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+
+    // The function object is owned by SQLite from this point, and is
+    // released through SqliteFunction::destroy, even if registration fails.
+    SqliteFunction *function = new SqliteFunction( this, apl_name );
+    int result;
+    if( aggregate ) {
+        result = sqlite3_create_function_v2( db, sql_name.c_str(), num_args, SQLITE_UTF8, function,
+                                             NULL, SqliteFunction::aggregate_step, SqliteFunction::aggregate_final,
+                                             SqliteFunction::destroy );
+    }
+    else {
+        result = sqlite3_create_function_v2( db, sql_name.c_str(), num_args, SQLITE_UTF8, function,
+                                             SqliteFunction::call_scalar, NULL, NULL,
+                                             SqliteFunction::destroy );
+    }
+    if( result != SQLITE_OK ) {
+        raise_sqlite_error( "Error registering function" );
+    }
+    functions_registered = true;
+}
+
+void SqliteConnection::create_virtual_table( const string &name, Value_P value, const vector<string> &column_names )
+{
+    if( get_write_behind() != NULL ) {
+        Workspace::more_error() = "APL functions and tables can't be used while write-behind is enabled";
+        DOMAIN_ERROR;
+    }
+
+    // The name is used unquoted in the module arguments, so only plain
+    // identifiers are allowed
+    if( name.size() == 0 || isdigit( name[0] ) ) {
+        Workspace::more_error() = "Illegal virtual table name";
+        DOMAIN_ERROR;
+    }
+    for( string::const_iterator i = name.begin() ; i != name.end() ; i++ ) {
+        if( !isalnum( *i ) && *i != '_' ) {
+            Workspace::more_error() = "Illegal virtual table name";
+            DOMAIN_ERROR;
+        }
+    }
+
+    if( virtual_tables.find( name ) != virtual_tables.end() ) {
+        Workspace::more_error() = "Virtual table already exists";
+        DOMAIN_ERROR;
+    }
+
+    if( !apl_module_registered ) {
+        if( sqlite3_create_module_v2( db, "apl", get_apl_virtual_table_module(), this, NULL ) != SQLITE_OK ) {
+            raise_sqlite_error( "Error registering APL table module" );
+        }
+        apl_module_registered = true;
+    }
+
+    virtual_tables[name] = new AplVirtualTable( value, column_names );
+
+    stringstream sql;
+    sql << "create virtual table temp." << name << " using apl(" << name << ")";
+    char *message;
+    if( sqlite3_exec( db, sql.str().c_str(), NULL, NULL, &message ) != SQLITE_OK ) {
+        stringstream out;
+        out << "Error creating virtual table: " << message;
+        sqlite3_free( message );
+        remove_virtual_table( name );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+AplVirtualTable *SqliteConnection::find_virtual_table( const string &name )
+{
+    map<string, AplVirtualTable *>::iterator i = virtual_tables.find( name );
+    return i == virtual_tables.end() ? NULL : i->second;
+}
+
+void SqliteConnection::remove_virtual_table( const string &name )
+{
+    map<string, AplVirtualTable *>::iterator i = virtual_tables.find( name );
+    if( i != virtual_tables.end() ) {
+        delete i->second;
+        virtual_tables.erase( i );
+    }
+}
+
+/*
+ * PRAGMA data_version only changes when another connection commits, so
+ * changes made through this connection are tracked by the update hook.
+ */
+long SqliteConnection::read_data_version( void )
+{
+    sqlite3_stmt *statement;
+    if( sqlite3_prepare_v2( db, "pragma data_version", -1, &statement, NULL ) != SQLITE_OK ) {
+        raise_sqlite_error( "Error reading data version" );
+    }
+
+    SqliteStmtWrapper statement_wrapper( statement );
+    if( sqlite3_step( statement ) != SQLITE_ROW ) {
+        raise_sqlite_error( "Error reading data version" );
+    }
+    return sqlite3_column_int64( statement, 0 );
+}
+
+void SqliteConnection::update_hook( void *arg, int, const char *, const char *, sqlite3_int64 )
+{
+    static_cast<SqliteConnection *>( arg )->modified_since_validate = true;
+}
+
+void SqliteConnection::enable_cache( long max_bytes, long ttl_ms, const string &channel )
+{
+    Connection::enable_cache( max_bytes, ttl_ms, channel );
+    sqlite3_update_hook( db, update_hook, this );
+    modified_since_validate = false;
+    last_data_version = read_data_version();
+}
+
+void SqliteConnection::disable_cache( void )
+{
+    sqlite3_update_hook( db, NULL, NULL );
+    Connection::disable_cache();
+}
+
+void SqliteConnection::validate_cache( void )
+{
+    long data_version = read_data_version();
+    if( modified_since_validate || data_version != last_data_version ) {
+        cache->clear();
+        modified_since_validate = false;
+        last_data_version = data_version;
+    }
+}
+
+/*
+ * While the slow query log is enabled, the counters of every finished
+ * statement are added up, and reported with the next logged statement.
+ */
+int SqliteConnection::trace_callback( unsigned int type, void *arg, void *p, void * )
+{
+    if( type == SQLITE_TRACE_PROFILE ) {
+        SqliteConnection *conn = static_cast<SqliteConnection *>( arg );
+        sqlite3_stmt *statement = static_cast<sqlite3_stmt *>( p );
+        conn->fullscan_steps += sqlite3_stmt_status( statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0 );
+        conn->sorts += sqlite3_stmt_status( statement, SQLITE_STMTSTATUS_SORT, 0 );
+        conn->autoindexes += sqlite3_stmt_status( statement, SQLITE_STMTSTATUS_AUTOINDEX, 0 );
+        conn->vm_steps += sqlite3_stmt_status( statement, SQLITE_STMTSTATUS_VM_STEP, 0 );
+    }
+    return 0;
+}
+
+void SqliteConnection::enable_slow_log( long threshold_ms, int capacity, const string &filename )
+{
+    Connection::enable_slow_log( threshold_ms, capacity, filename );
+    sqlite3_trace_v2( db, SQLITE_TRACE_PROFILE, trace_callback, this );
+}
+
+void SqliteConnection::disable_slow_log( void )
+{
+    sqlite3_trace_v2( db, 0, NULL, NULL );
+    Connection::disable_slow_log();
+}
+
+const string SqliteConnection::make_explain_prefix( bool )
+{
+    return "explain query plan ";
+}
+
+void SqliteConnection::reset_statement_details( void )
+{
+    fullscan_steps = 0;
+    sorts = 0;
+    autoindexes = 0;
+    vm_steps = 0;
+}
+
+const string SqliteConnection::take_statement_details( void )
+{
+    stringstream out;
+    out << "fullscan_steps=" << fullscan_steps << " sorts=" << sorts
+        << " autoindexes=" << autoindexes << " vm_steps=" << vm_steps;
+    reset_statement_details();
+    return out.str();
 }
 
 const string SqliteConnection::make_positional_param( int )
@@ -25,6 +25,12 @@
 
 #include <sqlite3.h>
 
+class AplVirtualTable;
+
+// Number of virtual machine instructions between checks for
+// interrupts and the time limit
+static const int PROGRESS_INTERVAL = 1000;
+
 class SqliteConnection : public Connection {
 public:
     SqliteConnection( sqlite3 *db_in );
@@ -35,16 +41,57 @@ public:
     virtual void transaction_begin();
     virtual void transaction_commit();
     virtual void transaction_rollback();
+    virtual bool in_transaction( void ) { return !sqlite3_get_autocommit( db ); }
 
     virtual void fill_tables( vector<string> &tables );
-    virtual void fill_cols( const string &table, vector<ColumnDescriptor> &cols );
+    virtual void fill_table_info( const string &table, TableInfo &info );
+    virtual const string read_schema_version( void );
     virtual const string make_positional_param( int pos );
+    virtual void split_script( const string &script, vector<string> &statements );
+
+    virtual void enable_cache( long max_bytes, long ttl_ms, const string &channel );
+    virtual void disable_cache( void );
+    virtual void validate_cache( void );
+
+    virtual void enable_slow_log( long threshold_ms, int capacity, const string &filename );
+    virtual void disable_slow_log( void );
+    virtual const string make_explain_prefix( bool query );
+    virtual void reset_statement_details( void );
+    virtual const string take_statement_details( void );
+    virtual BatchWriter *make_batch_writer( void );
+    virtual bool has_apl_callbacks( void ) { return functions_registered || !virtual_tables.empty(); }
+    virtual void upsert_rows( const UpsertSpec &spec, const vector<QueuedBind> &binds, long *inserted, long *updated );
+    virtual TableImporter *make_table_importer( const string &table, const vector<string> &columns );
+
+    void load_file( const string &filename, int pages_per_step );
+    void save_file( const string &filename, int pages_per_step );
+    Value_P serialize( void );
+    void deserialize( const vector<unsigned char> &content );
+    void create_function( const string &sql_name, const string &apl_name, int num_args, bool aggregate );
+    void create_virtual_table( const string &name, Value_P value, const vector<string> &column_names );
+    AplVirtualTable *find_virtual_table( const string &name );
+    void remove_virtual_table( const string &name );
 
     void raise_sqlite_error( const string &message );
     sqlite3 *get_db( void ) { return db; }
 
 private:
+    long read_pragma_long( const char *sql );
+    int run_bound_statement( sqlite3_stmt *statement, const QueuedBind *binds, int cols );
+
     sqlite3 *db;
+    bool apl_module_registered;
+    bool functions_registered;
+    bool modified_since_validate;
+    long last_data_version;
+    long read_data_version( void );
+    static void update_hook( void *arg, int op, const char *db_name, const char *table, sqlite3_int64 rowid );
+    static int trace_callback( unsigned int type, void *arg, void *p, void *x );
+    long fullscan_steps;
+    long sorts;
+    long autoindexes;
+    long vm_steps;
+    map<string, AplVirtualTable *> virtual_tables;
     void run_simple( const string &sql );
 };
 
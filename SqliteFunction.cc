@@ -0,0 +1,238 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SqliteFunction.hh"
+#include "SqliteConnection.hh"
+
+#include "Value.hh"
+#include "IntCell.hh"
+#include "PointerCell.hh"
+#include "Workspace.hh"
+#include "Command.hh"
+#include "Error.hh"
+
+/*
+ * The argument to the APL function is passed through a variable, since
+ * the function is invoked by evaluating an expression. The function may
+ * run another statement that calls a function, so each level of nesting
+ * has its own variable, which is expunged when the call returns.
+ */
+static const char *ARG_VAR_PREFIX = "SQL⍙udf_arg";
+static int call_depth = 0;
+
+class ArgVariable {
+public:
+    ArgVariable( Value_P arg );
+    ~ArgVariable();
+    const string &get_name( void ) { return name; }
+
+private:
+    string name;
+    Symbol *symbol;
+};
+
+ArgVariable::ArgVariable( Value_P arg )
+{
+    stringstream out;
+    out << ARG_VAR_PREFIX << call_depth;
+    name = out.str();
+    symbol = Workspace::lookup_symbol( ucs_string_from_string( name ) );
+    symbol->assign( arg, false, LOC );
+    call_depth++;
+}
+
+ArgVariable::~ArgVariable()
+{
+    call_depth--;
+    symbol->expunge();
+}
+
+bool SqliteFunction::is_defined_function( const string &apl_name )
+{
+    // The name is passed through a variable, so that it is never
+    // evaluated as an expression. ⎕NC is 3 for a defined function.
+    ArgVariable variable( Value_P( new Value( ucs_string_from_string( apl_name ), LOC ) ) );
+    UCS_string expression = ucs_string_from_string( "⎕NC " + variable.get_name() );
+    Token result = Command::do_APL_expression( expression );
+    if( result.get_Class() != TC_VALUE ) {
+        return false;
+    }
+    Value_P value = result.get_apl_val();
+    return value->element_count() == 1 && value->get_ravel( 0 ).is_integer_cell()
+        && value->get_ravel( 0 ).get_int_value() == 3;
+}
+
+typedef vector<vector<const ResultValue *> > AggregateRows;
+
+static void free_rows( AggregateRows *rows )
+{
+    for( AggregateRows::iterator row = rows->begin() ; row != rows->end() ; row++ ) {
+        for( vector<const ResultValue *>::iterator i = row->begin() ; i != row->end() ; i++ ) {
+            delete *i;
+        }
+    }
+    delete rows;
+}
+
+static void set_sqlite_result( sqlite3_context *context, Value_P value )
+{
+    if( value->element_count() == 0 ) {
+        sqlite3_result_null( context );
+    }
+    else if( value->is_char_string() ) {
+        string s = to_string( value->get_UCS_ravel() );
+        sqlite3_result_text( context, s.c_str(), s.size(), SQLITE_TRANSIENT );
+    }
+    else if( value->element_count() == 1 ) {
+        const Cell &cell = value->get_ravel( 0 );
+        if( cell.is_integer_cell() ) {
+            sqlite3_result_int64( context, cell.get_int_value() );
+        }
+        else if( cell.is_float_cell() ) {
+            sqlite3_result_double( context, cell.get_real_value() );
+        }
+        else if( cell.is_pointer_cell() ) {
+            set_sqlite_result( context, cell.get_pointer_value() );
+        }
+        else {
+            sqlite3_result_error( context, "Unsupported result type from APL function", -1 );
+        }
+    }
+    else {
+        sqlite3_result_error( context, "APL function must return a scalar or a string", -1 );
+    }
+}
+
+static void set_apl_error_result( sqlite3_context *context, const string &apl_name, const char *error_name )
+{
+    stringstream out;
+    out << "Error calling APL function " << apl_name;
+    if( error_name != NULL ) {
+        out << ": " << error_name;
+    }
+    string message = to_string( Workspace::more_error() );
+    if( message.size() > 0 ) {
+        out << ": " << message;
+    }
+    sqlite3_result_error( context, out.str().c_str(), -1 );
+}
+
+void SqliteFunction::invoke( sqlite3_context *context, Value_P arg )
+{
+    // APL errors are thrown as exceptions, which must not propagate
+    // through the SQLite stack frames. An interrupt stops the statement
+    // instead, and is raised again once SQLite has returned.
+    try {
+        ArgVariable variable( arg );
+        UCS_string expression = ucs_string_from_string( apl_name + " " + variable.get_name() );
+        Workspace::more_error() = "";
+        Token result = Command::do_APL_expression( expression );
+        if( result.get_Class() != TC_VALUE ) {
+            sqlite3_result_error( context, "APL function did not return a value", -1 );
+            return;
+        }
+        set_sqlite_result( context, result.get_apl_val() );
+    }
+    catch( Error &error ) {
+        StatementLimiter *limiter = connection->get_active_limiter();
+        if( error.get_error_code() == E_INTERRUPT && limiter != NULL ) {
+            limiter->interrupt();
+            sqlite3_result_error_code( context, SQLITE_INTERRUPT );
+            return;
+        }
+        set_apl_error_result( context, apl_name, Error::error_name( error.get_error_code() ) );
+    }
+    catch( ... ) {
+        set_apl_error_result( context, apl_name, NULL );
+    }
+}
+
+void SqliteFunction::call_scalar( sqlite3_context *context, int argc, sqlite3_value **argv )
+{
+    SqliteFunction *function = static_cast<SqliteFunction *>( sqlite3_user_data( context ) );
+
+    Value_P arg;
+    if( argc == 0 ) {
+        arg = Idx0( LOC );
+    }
+    else {
+        arg = new Value( Shape( argc ), LOC );
+        for( int i = 0 ; i < argc ; i++ ) {
+            ResultValue *value = make_result_value( argv[i] );
+            value->update( arg->next_ravel() );
+            delete value;
+        }
+    }
+    arg->check_value( LOC );
+
+    function->invoke( context, arg );
+}
+
+void SqliteFunction::aggregate_step( sqlite3_context *context, int argc, sqlite3_value **argv )
+{
+    AggregateRows **rows = static_cast<AggregateRows **>( sqlite3_aggregate_context( context, sizeof( AggregateRows * ) ) );
+    if( rows == NULL ) {
+        sqlite3_result_error_nomem( context );
+        return;
+    }
+    if( *rows == NULL ) {
+        *rows = new AggregateRows();
+    }
+
+    vector<const ResultValue *> row;
+    for( int i = 0 ; i < argc ; i++ ) {
+        row.push_back( make_result_value( argv[i] ) );
+    }
+    (*rows)->push_back( row );
+}
+
+void SqliteFunction::aggregate_final( sqlite3_context *context )
+{
+    SqliteFunction *function = static_cast<SqliteFunction *>( sqlite3_user_data( context ) );
+    AggregateRows **rows = static_cast<AggregateRows **>( sqlite3_aggregate_context( context, 0 ) );
+
+    Value_P arg;
+    if( rows == NULL || *rows == NULL || (*rows)->size() == 0 || (**rows)[0].size() == 0 ) {
+        arg = Idx0( LOC );
+    }
+    else {
+        int num_rows = (*rows)->size();
+        int num_cols = (**rows)[0].size();
+        arg = new Value( Shape( num_rows, num_cols ), LOC );
+        for( AggregateRows::iterator row = (*rows)->begin() ; row != (*rows)->end() ; row++ ) {
+            for( vector<const ResultValue *>::iterator i = row->begin() ; i != row->end() ; i++ ) {
+                (*i)->update( arg->next_ravel() );
+            }
+        }
+    }
+    arg->check_value( LOC );
+
+    if( rows != NULL && *rows != NULL ) {
+        free_rows( *rows );
+        *rows = NULL;
+    }
+
+    function->invoke( context, arg );
+}
+
+void SqliteFunction::destroy( void *function )
+{
+    delete static_cast<SqliteFunction *>( function );
+}
@@ -0,0 +1,54 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SQLITE_FUNCTION_HH
+#define SQLITE_FUNCTION_HH
+
+#include "apl-sqlite.hh"
+#include "SqliteResultValue.hh"
+
+#include <sqlite3.h>
+
+class SqliteConnection;
+
+/*
+ * An APL function registered with SQLite. Scalar functions are called
+ * once per row with a vector of the arguments. Aggregate functions
+ * buffer all rows of the group and are called once, with a matrix
+ * containing one row per input row.
+ */
+class SqliteFunction {
+public:
+    SqliteFunction( SqliteConnection *connection_in, const string &apl_name_in )
+        : connection( connection_in ), apl_name( apl_name_in ) {}
+
+    static void call_scalar( sqlite3_context *context, int argc, sqlite3_value **argv );
+    static void aggregate_step( sqlite3_context *context, int argc, sqlite3_value **argv );
+    static void aggregate_final( sqlite3_context *context );
+    static void destroy( void *function );
+    static bool is_defined_function( const string &apl_name );
+
+private:
+    void invoke( sqlite3_context *context, Value_P arg );
+    SqliteConnection *connection;
+    string apl_name;
+};
+
+#endif
@@ -21,22 +21,257 @@
 #include "SqliteProvider.hh"
 #include "SqliteConnection.hh"
 
+/*
+ * Pragmas are applied in this order. page_size has to come before
+ * journal_mode, since it can't be changed once the database is in WAL
+ * mode.
+ */
+static const char *pragma_names[] = { "page_size", "journal_mode", "synchronous", "cache_size",
+                                      "mmap_size", "temp_store", NULL };
+
+class SqliteOpenOptions {
+public:
+    SqliteOpenOptions() : readonly( false ), create( true ), flags( 0 ), busy_timeout( -1 ) {}
+    void set( const string &key, const string &value );
+    void apply_profile( const string &name );
+    void apply_pragmas( sqlite3 *db );
+    int get_open_flags( void );
+
+    bool readonly;
+    bool create;
+    int flags;
+    int busy_timeout;
+    map<string, string> pragmas;
+
+private:
+    void set_flag( int flag, const string &value );
+    void apply_pragma( sqlite3 *db, const string &name, const string &value );
+};
+
+static void raise_option_error( const string &message, const string &key )
+{
+    stringstream out;
+    out << message << ": " << key;
+    Workspace::more_error() = out.str().c_str();
+    DOMAIN_ERROR;
+}
+
+static bool option_to_bool( const string &value )
+{
+    if( value != "0" && value != "1" ) {
+        raise_option_error( "Flag value must be 0 or 1", value );
+    }
+    return value == "1";
+}
+
+void SqliteOpenOptions::set_flag( int flag, const string &value )
+{
+    if( option_to_bool( value ) ) {
+        flags |= flag;
+    }
+    else {
+        flags &= ~flag;
+    }
+}
+
+/*
+ * Read-only databases are never created, but the create option is kept
+ * so that it applies again if readonly is turned off later.
+ */
+int SqliteOpenOptions::get_open_flags( void )
+{
+    if( readonly ) {
+        return flags | SQLITE_OPEN_READONLY;
+    }
+    return flags | SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+}
+
+void SqliteOpenOptions::set( const string &key, const string &value )
+{
+    if( key == "profile" ) {
+        apply_profile( value );
+    }
+    else if( key == "readonly" ) {
+        readonly = option_to_bool( value );
+    }
+    else if( key == "create" ) {
+        create = option_to_bool( value );
+    }
+    else if( key == "nomutex" ) {
+        set_flag( SQLITE_OPEN_NOMUTEX, value );
+    }
+    else if( key == "uri" ) {
+        set_flag( SQLITE_OPEN_URI, value );
+    }
+    else if( key == "busy_timeout" ) {
+        char *endptr;
+        busy_timeout = strtol( value.c_str(), &endptr, 10 );
+        if( value.size() == 0 || *endptr != 0 ) {
+            raise_option_error( "Illegal busy_timeout", value );
+        }
+    }
+    else {
+        for( const char **name = pragma_names ; *name != NULL ; name++ ) {
+            if( key == *name ) {
+                // The value is inserted into the pragma statement as-is,
+                // so only allow plain words and numbers.
+                for( string::const_iterator i = value.begin() ; i != value.end() ; i++ ) {
+                    if( !isalnum( *i ) && *i != '-' && *i != '_' ) {
+                        raise_option_error( "Illegal pragma value", value );
+                    }
+                }
+                pragmas[key] = value;
+                return;
+            }
+        }
+        raise_option_error( "Unknown SQLite open option", key );
+    }
+}
+
+void SqliteOpenOptions::apply_profile( const string &name )
+{
+    if( name == "bulk-load" ) {
+        pragmas["journal_mode"] = "off";
+        pragmas["synchronous"] = "off";
+        pragmas["cache_size"] = "-262144";
+        pragmas["temp_store"] = "memory";
+    }
+    else if( name == "read-mostly" ) {
+        pragmas["journal_mode"] = "wal";
+        pragmas["synchronous"] = "normal";
+        pragmas["cache_size"] = "-65536";
+        pragmas["mmap_size"] = "268435456";
+        pragmas["temp_store"] = "memory";
+        busy_timeout = 5000;
+    }
+    else if( name == "durable" ) {
+        pragmas["journal_mode"] = "wal";
+        pragmas["synchronous"] = "full";
+        busy_timeout = 5000;
+    }
+    else {
+        raise_option_error( "Unknown SQLite profile", name );
+    }
+}
+
+/*
+ * SQLite doesn't fail when it refuses to change the journal mode, for
+ * example to WAL for an in-memory database. Instead the pragma returns
+ * the mode that is in effect, which is checked here.
+ */
+void SqliteOpenOptions::apply_pragma( sqlite3 *db, const string &name, const string &value )
+{
+    stringstream sql;
+    sql << "pragma " << name << " = " << value;
+    sqlite3_stmt *statement;
+    string error;
+    if( sqlite3_prepare_v2( db, sql.str().c_str(), -1, &statement, NULL ) != SQLITE_OK ) {
+        error = sqlite3_errmsg( db );
+    }
+    else {
+        int result;
+        while( (result = sqlite3_step( statement )) == SQLITE_ROW ) {
+            const char *mode = reinterpret_cast<const char *>( sqlite3_column_text( statement, 0 ) );
+            if( name == "journal_mode" && (mode == NULL || sqlite3_stricmp( mode, value.c_str() ) != 0) ) {
+                error = "database is in journal mode ";
+                error += mode == NULL ? "unknown" : mode;
+            }
+        }
+        if( result != SQLITE_DONE && error.size() == 0 ) {
+            error = sqlite3_errmsg( db );
+        }
+        sqlite3_finalize( statement );
+    }
+
+    if( error.size() > 0 ) {
+        stringstream out;
+        out << "Error setting " << name << ": " << error;
+        sqlite3_close( db );
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+void SqliteOpenOptions::apply_pragmas( sqlite3 *db )
+{
+    if( busy_timeout >= 0 ) {
+        sqlite3_busy_timeout( db, busy_timeout );
+    }
+
+    for( const char **name = pragma_names ; *name != NULL ; name++ ) {
+        map<string, string>::iterator i = pragmas.find( *name );
+        if( i != pragmas.end() ) {
+            apply_pragma( db, i->first, i->second );
+        }
+    }
+}
+
+static string option_cell_to_string( const Cell &cell )
+{
+    if( cell.is_integer_cell() ) {
+        stringstream out;
+        out << cell.get_int_value();
+        return out.str();
+    }
+
+    Value_P value = cell.to_value( LOC );
+    if( !value->is_char_string() ) {
+        Workspace::more_error() = "SQLite open options must be strings or integers";
+        DOMAIN_ERROR;
+    }
+    return to_string( value->get_UCS_ravel() );
+}
+
+static void parse_open_options( Value_P config, SqliteOpenOptions &options )
+{
+    if( config->is_char_string() ) {
+        options.apply_profile( to_string( config->get_UCS_ravel() ) );
+        return;
+    }
+
+    const Shape &shape = config->get_shape();
+    if( shape.get_rank() != 2 || shape.get_cols() != 2 ) {
+        Workspace::more_error() = "SQLite open options must be a profile name or a two-column key/value matrix";
+        RANK_ERROR;
+    }
+
+    for( int row = 0 ; row < shape.get_rows() ; row++ ) {
+        options.set( option_cell_to_string( config->get_ravel( row * 2 ) ),
+                     option_cell_to_string( config->get_ravel( row * 2 + 1 ) ) );
+    }
+}
+
 static SqliteConnection *create_sqlite_connection( Value_P B )
 {
-    if( !B->is_char_string() ) {
-        Workspace::more_error() = "SQLite database connect argument must be a single string";
+    string filename;
+    SqliteOpenOptions options;
+    if( B->is_char_string() ) {
+        filename = to_string( B->get_UCS_ravel() );
+    }
+    else if( B->get_rank() == 1 && B->element_count() == 2 ) {
+        Value_P name = B->get_ravel( 0 ).to_value( LOC );
+        if( !name->is_char_string() ) {
+            Workspace::more_error() = "SQLite database filename must be a string";
+            DOMAIN_ERROR;
+        }
+        filename = to_string( name->get_UCS_ravel() );
+        parse_open_options( B->get_ravel( 1 ).to_value( LOC ), options );
+    }
+    else {
+        Workspace::more_error() = "SQLite database connect argument must be a filename, or a filename and options";
         DOMAIN_ERROR;
     }
 
-    string filename = to_string( B->get_UCS_ravel() );
     sqlite3 *db;
-    if( sqlite3_open( filename.c_str(), &db ) != SQLITE_OK ) {
+    if( sqlite3_open_v2( filename.c_str(), &db, options.get_open_flags(), NULL ) != SQLITE_OK ) {
         stringstream out;
         out << "Error opening database: " << sqlite3_errmsg( db );
+        sqlite3_close( db );
         Workspace::more_error() = out.str().c_str();
         DOMAIN_ERROR;
     }
 
+    options.apply_pragmas( db );
     return new SqliteConnection( db );
 }
 
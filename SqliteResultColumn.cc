@@ -0,0 +1,383 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SqliteResultColumn.hh"
+
+#include <algorithm>
+
+#include "Value.hh"
+#include "IntCell.hh"
+#include "FloatCell.hh"
+#include "PointerCell.hh"
+
+ResultColumn::~ResultColumn()
+{
+    for( vector<pair<long, ResultValue *> >::iterator i = fallbacks.begin() ; i != fallbacks.end() ; i++ ) {
+        delete i->second;
+    }
+}
+
+void ResultColumn::add_fallback( long row, sqlite3_value *value )
+{
+    fallbacks.push_back( pair<long, ResultValue *>( row, make_result_value( value ) ) );
+}
+
+/*
+ * Records the row as a null if null sentinels are used. Returns true if
+ * the value was handled.
+ */
+bool ResultColumn::add_null( int type, long row )
+{
+    if( type != SQLITE_NULL || null_sentinel == NULL ) {
+        return false;
+    }
+    null_rows.push_back( row );
+    return true;
+}
+
+void ResultColumn::fill_deferred( Value *value, int col, int cols )
+{
+    for( vector<pair<long, ResultValue *> >::iterator i = fallbacks.begin() ; i != fallbacks.end() ; i++ ) {
+        i->second->update( &value->get_ravel( i->first * cols + col ) );
+    }
+    for( vector<long>::iterator i = null_rows.begin() ; i != null_rows.end() ; i++ ) {
+        null_sentinel->fill( &value->get_ravel( *i * cols + col ) );
+    }
+}
+
+static bool fallback_row_less( const pair<long, ResultValue *> &fallback, long row )
+{
+    return fallback.first < row;
+}
+
+/*
+ * The fallbacks and nulls are kept in row order, so the ones in the
+ * range are found using a binary search
+ */
+void ResultColumn::fill_deferred_range( Cell *cell, int cols, long start, long end )
+{
+    vector<pair<long, ResultValue *> >::iterator fallback = lower_bound( fallbacks.begin(), fallbacks.end(),
+                                                                         start, fallback_row_less );
+    for( ; fallback != fallbacks.end() && fallback->first < end ; fallback++ ) {
+        fallback->second->update( cell + (fallback->first - start) * cols );
+    }
+    vector<long>::iterator null_row = lower_bound( null_rows.begin(), null_rows.end(), start );
+    for( ; null_row != null_rows.end() && *null_row < end ; null_row++ ) {
+        null_sentinel->fill( cell + (*null_row - start) * cols );
+    }
+}
+
+void ResultColumn::mark_nulls( Value *mask, int col, int cols )
+{
+    for( vector<long>::iterator i = null_rows.begin() ; i != null_rows.end() ; i++ ) {
+        new (&mask->get_ravel( *i * cols + col )) IntCell( 1 );
+    }
+}
+
+template<class T>
+class ColumnTraits {
+};
+
+template<>
+class ColumnTraits<APL_Integer> {
+public:
+    static bool accepts( int type, bool ) { return type == SQLITE_INTEGER; }
+    static APL_Integer read( sqlite3_stmt *statement, int col ) { return sqlite3_column_int64( statement, col ); }
+    static void write( Cell *cell, APL_Integer value ) { new (cell) IntCell( value ); }
+};
+
+template<>
+class ColumnTraits<APL_Float> {
+public:
+    static bool accepts( int type, bool coerce ) { return type == SQLITE_FLOAT || (coerce && type == SQLITE_INTEGER); }
+    static APL_Float read( sqlite3_stmt *statement, int col ) { return sqlite3_column_double( statement, col ); }
+    static void write( Cell *cell, APL_Float value ) { new (cell) FloatCell( value ); }
+};
+
+/*
+ * A column of numbers. The cells are written without looking at the
+ * type of each value. Cells of rows that are fallbacks get a
+ * placeholder, which is replaced by fill_deferred(). When the type
+ * came from a hint, integers are converted to floats instead of being
+ * fallbacks.
+ */
+template<class T>
+class NumericResultColumn : public ResultColumn {
+public:
+    NumericResultColumn( bool coerce_in, const NullSentinel *null_sentinel_in )
+        : ResultColumn( null_sentinel_in ), coerce( coerce_in ) {}
+
+    virtual void fetch( sqlite3_stmt *statement, int col )
+    {
+        int type = sqlite3_column_type( statement, col );
+        if( ColumnTraits<T>::accepts( type, coerce ) ) {
+            values.push_back( ColumnTraits<T>::read( statement, col ) );
+        }
+        else if( add_null( type, values.size() ) ) {
+            values.push_back( T() );
+        }
+        else {
+            add_fallback( values.size(), sqlite3_column_value( statement, col ) );
+            values.push_back( T() );
+        }
+    }
+
+    virtual void fill_from_worker( Value *value, int col, int cols, long start, long end )
+    {
+        if( start >= end ) {
+            return;
+        }
+        Cell *cell = &value->get_ravel( start * cols + col );
+        const T *p = &values[start];
+        for( long row = start ; row < end ; row++ ) {
+            ColumnTraits<T>::write( cell, *p++ );
+            cell += cols;
+        }
+    }
+
+    virtual void fill_range( Cell *cell, int cols, long start, long end )
+    {
+        Cell *row_cell = cell;
+        for( long row = start ; row < end ; row++ ) {
+            ColumnTraits<T>::write( row_cell, values[row] );
+            row_cell += cols;
+        }
+        fill_deferred_range( cell, cols, start, end );
+    }
+
+private:
+    bool coerce;
+    vector<T> values;
+};
+
+/*
+ * The UTF-8 decoding can be done in parallel, but the allocation of
+ * the APL strings has to wait for fill_deferred(). When the type came
+ * from a hint, numbers are returned as text.
+ */
+class StringResultColumn : public ResultColumn {
+public:
+    StringResultColumn( bool coerce_in, const NullSentinel *null_sentinel_in )
+        : ResultColumn( null_sentinel_in ), coerce( coerce_in ) {}
+
+    virtual void fetch( sqlite3_stmt *statement, int col )
+    {
+        int type = sqlite3_column_type( statement, col );
+        if( type == SQLITE_TEXT || (coerce && (type == SQLITE_INTEGER || type == SQLITE_FLOAT)) ) {
+            const char *text = reinterpret_cast<const char *>( sqlite3_column_text( statement, col ) );
+            values.push_back( string( text, sqlite3_column_bytes( statement, col ) ) );
+        }
+        else if( add_null( type, values.size() ) ) {
+            values.push_back( string() );
+        }
+        else {
+            add_fallback( values.size(), sqlite3_column_value( statement, col ) );
+            values.push_back( string() );
+        }
+        decoded.push_back( UCS_string() );
+    }
+
+    virtual void fill_from_worker( Value *, int, int, long start, long end )
+    {
+        for( long row = start ; row < end ; row++ ) {
+            decoded[row] = ucs_string_from_string( values[row] );
+        }
+    }
+
+    virtual void fill_deferred( Value *value, int col, int cols )
+    {
+        // The fallback and null rows are sorted, and are filled in by the
+        // base class
+        vector<pair<long, ResultValue *> >::iterator next_fallback = fallbacks.begin();
+        vector<long>::iterator next_null = null_rows.begin();
+        Cell *cell = &value->get_ravel( col );
+        for( size_t row = 0 ; row < values.size() ; row++ ) {
+            if( next_fallback != fallbacks.end() && next_fallback->first == static_cast<long>( row ) ) {
+                next_fallback++;
+            }
+            else if( next_null != null_rows.end() && *next_null == static_cast<long>( row ) ) {
+                next_null++;
+            }
+            else if( values[row].size() == 0 ) {
+                new (cell) PointerCell( Str0( LOC ) );
+            }
+            else {
+                new (cell) PointerCell( make_ucs_string_cell( decoded[row], LOC ) );
+            }
+            cell += cols;
+        }
+        ResultColumn::fill_deferred( value, col, cols );
+    }
+
+    virtual void fill_range( Cell *cell, int cols, long start, long end )
+    {
+        // Rows that are fallbacks or nulls are left to the base class
+        vector<pair<long, ResultValue *> >::iterator next_fallback
+            = lower_bound( fallbacks.begin(), fallbacks.end(), start, fallback_row_less );
+        vector<long>::iterator next_null = lower_bound( null_rows.begin(), null_rows.end(), start );
+        Cell *row_cell = cell;
+        for( long row = start ; row < end ; row++ ) {
+            if( next_fallback != fallbacks.end() && next_fallback->first == row ) {
+                next_fallback++;
+            }
+            else if( next_null != null_rows.end() && *next_null == row ) {
+                next_null++;
+            }
+            else if( values[row].size() == 0 ) {
+                new (row_cell) PointerCell( Str0( LOC ) );
+            }
+            else {
+                new (row_cell) PointerCell( make_ucs_string_cell( ucs_string_from_string( values[row] ), LOC ) );
+            }
+            row_cell += cols;
+        }
+        fill_deferred_range( cell, cols, start, end );
+    }
+
+private:
+    bool coerce;
+    vector<string> values;
+    vector<UCS_string> decoded;
+};
+
+/*
+ * Used when the type of the column isn't known from the first row,
+ * and for date columns, which are converted according to the temporal
+ * mode of the connection.
+ */
+class GenericResultColumn : public ResultColumn {
+public:
+    GenericResultColumn( bool temporal_in, TemporalMode temporal_mode_in, const NullSentinel *null_sentinel_in )
+        : ResultColumn( null_sentinel_in ), temporal( temporal_in ), temporal_mode( temporal_mode_in ) {}
+
+    virtual ~GenericResultColumn()
+    {
+        for( vector<ResultValue *>::iterator i = values.begin() ; i != values.end() ; i++ ) {
+            delete *i;
+        }
+    }
+
+    virtual void fetch( sqlite3_stmt *statement, int col )
+    {
+        // Text values in date and time columns are converted, and
+        // anything else, including text that isn't a valid date, is
+        // kept as it is
+        sqlite3_value *value = sqlite3_column_value( statement, col );
+        TemporalValue parsed;
+        if( add_null( sqlite3_value_type( value ), values.size() ) ) {
+            values.push_back( NULL );
+            done.push_back( true );
+            return;
+        }
+        if( temporal && sqlite3_value_type( value ) == SQLITE_TEXT
+            && parse_temporal( reinterpret_cast<const char *>( sqlite3_value_text( value ) ),
+                               sqlite3_value_bytes( value ), parsed ) ) {
+            values.push_back( new TemporalResultValue( parsed, temporal_mode ) );
+        }
+        else {
+            values.push_back( make_result_value( value ) );
+        }
+        done.push_back( false );
+    }
+
+    virtual void fill_from_worker( Value *value, int col, int cols, long start, long end )
+    {
+        for( long row = start ; row < end ; row++ ) {
+            if( values[row] != NULL ) {
+                done[row] = values[row]->update_from_worker( &value->get_ravel( row * cols + col ) );
+            }
+        }
+    }
+
+    virtual void fill_deferred( Value *value, int col, int cols )
+    {
+        for( size_t row = 0 ; row < values.size() ; row++ ) {
+            if( !done[row] ) {
+                values[row]->update( &value->get_ravel( row * cols + col ) );
+            }
+        }
+        ResultColumn::fill_deferred( value, col, cols );
+    }
+
+    virtual void fill_range( Cell *cell, int cols, long start, long end )
+    {
+        Cell *row_cell = cell;
+        for( long row = start ; row < end ; row++ ) {
+            if( values[row] != NULL ) {
+                values[row]->update( row_cell );
+            }
+            row_cell += cols;
+        }
+        fill_deferred_range( cell, cols, start, end );
+    }
+
+private:
+    bool temporal;
+    TemporalMode temporal_mode;
+    vector<ResultValue *> values;
+    vector<char> done;
+};
+
+SqliteRetainedResult::~SqliteRetainedResult()
+{
+    for( vector<ResultColumn *>::iterator i = columns.begin() ; i != columns.end() ; i++ ) {
+        delete *i;
+    }
+}
+
+Value_P SqliteRetainedResult::fetch( long start, long end, const vector<int> &cols )
+{
+    int result_cols = cols.size();
+    Value_P value( new Value( Shape( end - start, result_cols ), LOC ) );
+    for( int col = 0 ; col < result_cols ; col++ ) {
+        columns[cols[col]]->fill_range( &value->get_ravel( col ), result_cols, start, end );
+    }
+    value->check_value( LOC );
+    return value;
+}
+
+ResultColumn *make_result_column( sqlite3_stmt *statement, int col, TypeHint kind,
+                                  TemporalMode temporal_mode, const NullSentinel *null_sentinel )
+{
+    if( temporal_mode != TEMPORAL_TEXT && is_temporal_type_name( sqlite3_column_decltype( statement, col ) ) ) {
+        return new GenericResultColumn( true, temporal_mode, null_sentinel );
+    }
+
+    bool coerce = kind != TYPE_HINT_AUTO;
+    if( kind == TYPE_HINT_AUTO ) {
+        switch( sqlite3_column_type( statement, col ) ) {
+        case SQLITE_INTEGER: kind = TYPE_HINT_INT; break;
+        case SQLITE_FLOAT: kind = TYPE_HINT_FLOAT; break;
+        case SQLITE_TEXT: kind = TYPE_HINT_STRING; break;
+        }
+    }
+
+    switch( kind ) {
+    case TYPE_HINT_INT:
+        return new NumericResultColumn<APL_Integer>( coerce, null_sentinel );
+    case TYPE_HINT_FLOAT:
+        return new NumericResultColumn<APL_Float>( coerce, null_sentinel );
+    case TYPE_HINT_STRING:
+        return new StringResultColumn( coerce, null_sentinel );
+    default:
+        return new GenericResultColumn( false, temporal_mode, null_sentinel );
+    }
+}
@@ -0,0 +1,91 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SQLITE_RESULT_COLUMN_HH
+#define SQLITE_RESULT_COLUMN_HH
+
+#include "apl-sqlite.hh"
+#include "ArgListBuilder.hh"
+#include "SqliteResultValue.hh"
+
+/*
+ * The results of a query are collected one column at a time. The type
+ * of each column is decided once per statement, from a type hint or
+ * from the first row, and the values are kept in a vector of that type.
+ * Values that don't match the type of their column (typically nulls)
+ * are kept separately as ResultValue instances. When null sentinels
+ * are used, only the rows of the nulls are kept.
+ */
+class ResultColumn {
+public:
+    ResultColumn( const NullSentinel *null_sentinel_in ) : null_sentinel( null_sentinel_in ) {}
+    virtual ~ResultColumn();
+
+    // Adds the value of the column in the current row
+    virtual void fetch( sqlite3_stmt *statement, int col ) = 0;
+
+    // Writes the cells of rows start to end that don't need an APL value
+    // to be allocated. May be called from worker threads.
+    virtual void fill_from_worker( Value *value, int col, int cols, long start, long end ) = 0;
+
+    // Writes the remaining cells, on the interpreter thread
+    virtual void fill_deferred( Value *value, int col, int cols );
+
+    // Sets the cells of the nulls in the mask to 1
+    void mark_nulls( Value *mask, int col, int cols );
+
+    // Writes rows start to end, one cell per row starting at cell, with
+    // cols cells between rows. Used by retained results, which convert
+    // a few rows at a time on the interpreter thread.
+    virtual void fill_range( Cell *cell, int cols, long start, long end ) = 0;
+
+protected:
+    void fill_deferred_range( Cell *cell, int cols, long start, long end );
+    void add_fallback( long row, sqlite3_value *value );
+    bool add_null( int type, long row );
+    vector<pair<long, ResultValue *> > fallbacks;
+    const NullSentinel *null_sentinel;
+    vector<long> null_rows;
+};
+
+/*
+ * A result whose rows have all been read from SQLite, but which is only
+ * converted to APL values a range of rows at a time
+ */
+class SqliteRetainedResult : public RetainedResult {
+public:
+    SqliteRetainedResult( const vector<ResultColumn *> &columns_in, int column_count_in, long row_count_in )
+        : columns( columns_in ), column_count( column_count_in ), row_count( row_count_in ) {}
+    virtual ~SqliteRetainedResult();
+    virtual long get_row_count( void ) { return row_count; }
+    virtual int get_column_count( void ) { return column_count; }
+    virtual Value_P fetch( long start, long end, const vector<int> &cols );
+
+private:
+    vector<ResultColumn *> columns;
+    int column_count;
+    long row_count;
+};
+
+ResultColumn *make_result_column( sqlite3_stmt *statement, int col, TypeHint kind,
+                                  TemporalMode temporal_mode, const NullSentinel *null_sentinel );
+
+#endif
@@ -42,42 +42,63 @@ void StringResultValue::update( Cell *cell ) const
     if( value.size() == 0 ) {
         new (cell) PointerCell( Str0( LOC ) );
     }
+    else if( decoded ) {
+        new (cell) PointerCell( make_ucs_string_cell( ucs_value, LOC ) );
+    }
     else {
         new (cell) PointerCell( make_string_cell( value, LOC ) );
     }
 }
 
+bool StringResultValue::update_from_worker( Cell * ) const
+{
+    // The UTF-8 decoding can be done in parallel, but the
+    // allocation of the APL string has to wait.
+    ucs_value = ucs_string_from_string( value );
+    decoded = true;
+    return false;
+}
+
+void TemporalResultValue::update( Cell *cell ) const
+{
+    if( mode == TEMPORAL_EPOCH_MS ) {
+        new (cell) IntCell( value.to_epoch_ms() );
+    }
+    else {
+        new (cell) PointerCell( make_timestamp_value( value ) );
+    }
+}
+
+bool TemporalResultValue::update_from_worker( Cell *cell ) const
+{
+    if( mode == TEMPORAL_EPOCH_MS ) {
+        update( cell );
+        return true;
+    }
+    return false;
+}
+
 void NullResultValue::update( Cell *cell ) const
 {
     new (cell) PointerCell( Idx0( LOC ) );
 }
 
-void ResultRow::add_values( sqlite3_stmt *statement )
+ResultValue *make_result_value( sqlite3_value *value )
 {
-    int n = sqlite3_column_count( statement );
-    for( int i = 0 ; i < n ; i++ ) {
-        ResultValue *value;
-        int type = sqlite3_column_type( statement, i );
-        switch( type ) {
-        case SQLITE_INTEGER:
-            value = new IntResultValue( sqlite3_column_int( statement, i ) );
-            break;
-        case SQLITE_FLOAT:
-            value = new DoubleResultValue( sqlite3_column_double( statement, i ) );
-            break;
-        case SQLITE_TEXT:
-            value = new StringResultValue( reinterpret_cast<const char *>( sqlite3_column_text( statement, i ) ) );
-            break;
-        case SQLITE_BLOB:
-            value = new NullResultValue();
-            break;
-        case SQLITE_NULL:
-            value = new NullResultValue();
-            break;
-        default:
-            CERR << "Unsupported column type, column=" << i << ", type+" << type << endl;
-            value = new NullResultValue();
-        }
-        values.push_back( value );
+    int type = sqlite3_value_type( value );
+    switch( type ) {
+    case SQLITE_INTEGER:
+        return new IntResultValue( sqlite3_value_int64( value ) );
+    case SQLITE_FLOAT:
+        return new DoubleResultValue( sqlite3_value_double( value ) );
+    case SQLITE_TEXT:
+        return new StringResultValue( reinterpret_cast<const char *>( sqlite3_value_text( value ) ) );
+    case SQLITE_BLOB:
+        return new NullResultValue();
+    case SQLITE_NULL:
+        return new NullResultValue();
+    default:
+        CERR << "Unsupported value type, type+" << type << endl;
+        return new NullResultValue();
     }
 }
@@ -22,6 +22,7 @@
 #define RESULT_VALUE_HH
 
 #include "Cell.hh"
+#include "TemporalConversion.hh"
 
 #include <string>
 #include <sqlite3.h>
@@ -31,16 +32,24 @@ class ResultValue
 public:
     virtual ~ResultValue() {}
     virtual void update( Cell *cell ) const = 0;
+
+    /*
+     * Called from a worker thread during parallel conversion. Returns
+     * true if the cell was filled in, or false if update() needs to
+     * be called later from the interpreter thread because an APL
+     * value has to be allocated.
+     */
+    virtual bool update_from_worker( Cell *cell ) const { update( cell ); return true; }
 };
 
 class IntResultValue : public ResultValue {
 public:
-    IntResultValue( int value_in ) : value( value_in ) {}
+    IntResultValue( APL_Integer value_in ) : value( value_in ) {}
     virtual ~IntResultValue() {}
     virtual void update( Cell *cell ) const;
 
 private:
-    int value;
+    APL_Integer value;
 };
 
 class DoubleResultValue : public ResultValue {
@@ -58,29 +67,37 @@ public:
     NullResultValue() {};
     virtual ~NullResultValue() {}
     virtual void update( Cell *cell ) const;
+    virtual bool update_from_worker( Cell *cell ) const { return false; }
 };
 
 class StringResultValue : public ResultValue {
 public:
-    StringResultValue( string value_in ) : value( value_in ) {}
+    StringResultValue( string value_in ) : value( value_in ), decoded( false ) {}
     virtual ~StringResultValue() {}
     virtual void update( Cell *cell ) const;
+    virtual bool update_from_worker( Cell *cell ) const;
   
 private:
     string value;
+    mutable UCS_string ucs_value;
+    mutable bool decoded;
 };
 
-class ResultRow
-{
+/*
+ * A date from a text column whose declared type is a date or time
+ */
+class TemporalResultValue : public ResultValue {
 public:
-    ResultRow( void ) {}
-    ResultRow( const ResultRow &orig ) : values( orig.values ) {}
-    ~ResultRow() {}
-    void add_values( sqlite3_stmt *statement );
-    const vector<const ResultValue *> &get_values() { return values; }
+    TemporalResultValue( const TemporalValue &value_in, TemporalMode mode_in ) : value( value_in ), mode( mode_in ) {}
+    virtual ~TemporalResultValue() {}
+    virtual void update( Cell *cell ) const;
+    virtual bool update_from_worker( Cell *cell ) const;
 
 private:
-    vector<const ResultValue *> values;
+    TemporalValue value;
+    TemporalMode mode;
 };
 
+ResultValue *make_result_value( sqlite3_value *value );
+
 #endif
@@ -0,0 +1,440 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SqliteVirtualTable.hh"
+#include "SqliteConnection.hh"
+
+#include <algorithm>
+#include <math.h>
+
+/*
+ * Operators in the constraint string passed from xBestIndex to xFilter
+ */
+static const char OP_EQ = '=';
+static const char OP_GT = '>';
+static const char OP_GE = 'g';
+static const char OP_LT = '<';
+static const char OP_LE = 'l';
+
+struct AplVtab {
+    sqlite3_vtab base;
+    SqliteConnection *connection;
+    string name;
+    AplVirtualTable *table;
+};
+
+struct AplVtabCursor {
+    sqlite3_vtab_cursor base;
+    const vector<int> *index;
+    int pos;
+    int end;
+};
+
+static string infer_column_type( Value_P value, int rows, int cols, int col )
+{
+    bool all_int = true;
+    bool all_numeric = true;
+    bool all_string = true;
+    for( int row = 0 ; row < rows ; row++ ) {
+        const Cell &cell = value->get_ravel( static_cast<long>( row ) * cols + col );
+        if( cell.is_integer_cell() ) {
+            all_string = false;
+        }
+        else if( cell.is_float_cell() ) {
+            all_int = false;
+            all_string = false;
+        }
+        else {
+            all_int = false;
+            all_numeric = false;
+            if( !cell.is_character_cell() && !(cell.is_pointer_cell() && cell.get_pointer_value()->is_char_string()) ) {
+                all_string = false;
+            }
+        }
+    }
+
+    if( all_int ) {
+        return "INTEGER";
+    }
+    else if( all_numeric ) {
+        return "REAL";
+    }
+    else if( all_string ) {
+        return "TEXT";
+    }
+    else {
+        return "";
+    }
+}
+
+AplVirtualTable::AplVirtualTable( Value_P value_in, const vector<string> &column_names_in )
+    : value( value_in ), column_names( column_names_in )
+{
+    if( value->get_rank() == 2 ) {
+        num_rows = value->get_rows();
+        num_cols = value->get_cols();
+    }
+    else {
+        num_rows = value->element_count();
+        num_cols = 1;
+    }
+
+    for( int col = 0 ; col < num_cols ; col++ ) {
+        if( col >= static_cast<int>( column_names.size() ) ) {
+            stringstream out;
+            out << "c" << (col + 1);
+            column_names.push_back( out.str() );
+        }
+        column_types.push_back( infer_column_type( value, num_rows, num_cols, col ) );
+    }
+}
+
+string AplVirtualTable::make_schema( void )
+{
+    stringstream out;
+    out << "create table x(";
+    for( int col = 0 ; col < num_cols ; col++ ) {
+        if( col > 0 ) {
+            out << ", ";
+        }
+        out << "\"";
+        for( string::iterator i = column_names[col].begin() ; i != column_names[col].end() ; i++ ) {
+            if( *i == '"' ) {
+                out << '"';
+            }
+            out << *i;
+        }
+        out << "\" " << column_types[col];
+    }
+    out << ")";
+    return out.str();
+}
+
+class ColumnOrder {
+public:
+    ColumnOrder( AplVirtualTable *table_in, int col_in ) : table( table_in ), col( col_in ) {}
+    bool operator()( int a, int b ) {
+        return table->get_cell( a, col ).get_real_value() < table->get_cell( b, col ).get_real_value();
+    }
+
+private:
+    AplVirtualTable *table;
+    int col;
+};
+
+/*
+ * Returns the row numbers ordered by the value in the given numeric
+ * column. The index is built the first time a column is filtered on.
+ */
+const vector<int> &AplVirtualTable::get_sorted_index( int col )
+{
+    map<int, vector<int> >::iterator i = sorted_indexes.find( col );
+    if( i != sorted_indexes.end() ) {
+        return i->second;
+    }
+
+    vector<int> &index = sorted_indexes[col];
+    index.resize( num_rows );
+    for( int row = 0 ; row < num_rows ; row++ ) {
+        index[row] = row;
+    }
+    std::stable_sort( index.begin(), index.end(), ColumnOrder( this, col ) );
+    return index;
+}
+
+static int vtab_connect( sqlite3 *db, void *aux, int argc, const char *const *argv,
+                         sqlite3_vtab **vtab_result, char **error )
+{
+    SqliteConnection *connection = static_cast<SqliteConnection *>( aux );
+    if( argc < 4 ) {
+        *error = sqlite3_mprintf( "Name of APL table missing" );
+        return SQLITE_ERROR;
+    }
+
+    string name = argv[3];
+    AplVirtualTable *table = connection->find_virtual_table( name );
+    if( table == NULL ) {
+        *error = sqlite3_mprintf( "No APL value registered with the name: %s", name.c_str() );
+        return SQLITE_ERROR;
+    }
+
+    int result = sqlite3_declare_vtab( db, table->make_schema().c_str() );
+    if( result != SQLITE_OK ) {
+        return result;
+    }
+
+    AplVtab *vtab = new AplVtab();
+    vtab->connection = connection;
+    vtab->name = name;
+    vtab->table = table;
+    *vtab_result = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int vtab_disconnect( sqlite3_vtab *base )
+{
+    delete reinterpret_cast<AplVtab *>( base );
+    return SQLITE_OK;
+}
+
+static int vtab_destroy( sqlite3_vtab *base )
+{
+    AplVtab *vtab = reinterpret_cast<AplVtab *>( base );
+    vtab->connection->remove_virtual_table( vtab->name );
+    delete vtab;
+    return SQLITE_OK;
+}
+
+static char constraint_op_to_char( unsigned char op )
+{
+    switch( op ) {
+    case SQLITE_INDEX_CONSTRAINT_EQ: return OP_EQ;
+    case SQLITE_INDEX_CONSTRAINT_GT: return OP_GT;
+    case SQLITE_INDEX_CONSTRAINT_GE: return OP_GE;
+    case SQLITE_INDEX_CONSTRAINT_LT: return OP_LT;
+    case SQLITE_INDEX_CONSTRAINT_LE: return OP_LE;
+    default: return 0;
+    }
+}
+
+/*
+ * Picks a single numeric column to filter on, preferring equality
+ * constraints. All usable constraints on that column are passed to
+ * xFilter, with their operators encoded in idxStr. SQLite still checks
+ * the constraints itself, since APL and SQL comparison rules differ.
+ */
+static int vtab_best_index( sqlite3_vtab *base, sqlite3_index_info *info )
+{
+    AplVirtualTable *table = reinterpret_cast<AplVtab *>( base )->table;
+
+    int best_col = -1;
+    bool best_is_eq = false;
+    for( int i = 0 ; i < info->nConstraint ; i++ ) {
+        const sqlite3_index_info::sqlite3_index_constraint &constraint = info->aConstraint[i];
+        char op = constraint_op_to_char( constraint.op );
+        if( !constraint.usable || op == 0 || constraint.iColumn < 0
+            || !table->is_numeric_column( constraint.iColumn ) ) {
+            continue;
+        }
+        if( best_col == -1 || (op == OP_EQ && !best_is_eq) ) {
+            best_col = constraint.iColumn;
+            best_is_eq = op == OP_EQ;
+        }
+    }
+
+    double rows = table->get_num_rows();
+    if( best_col == -1 ) {
+        info->idxNum = 0;
+        info->estimatedCost = rows;
+        info->estimatedRows = rows;
+        return SQLITE_OK;
+    }
+
+    string ops;
+    for( int i = 0 ; i < info->nConstraint ; i++ ) {
+        const sqlite3_index_info::sqlite3_index_constraint &constraint = info->aConstraint[i];
+        char op = constraint_op_to_char( constraint.op );
+        if( constraint.usable && op != 0 && constraint.iColumn == best_col ) {
+            ops += op;
+            info->aConstraintUsage[i].argvIndex = ops.size();
+            info->aConstraintUsage[i].omit = 0;
+        }
+    }
+
+    info->idxNum = best_col + 1;
+    info->idxStr = sqlite3_mprintf( "%s", ops.c_str() );
+    info->needToFreeIdxStr = 1;
+    if( best_is_eq ) {
+        info->estimatedCost = log( rows + 1 ) + 1;
+        info->estimatedRows = 1;
+    }
+    else {
+        info->estimatedCost = log( rows + 1 ) + rows / 3;
+        info->estimatedRows = rows / 3;
+    }
+    return SQLITE_OK;
+}
+
+static int vtab_open( sqlite3_vtab *, sqlite3_vtab_cursor **cursor_result )
+{
+    AplVtabCursor *cursor = new AplVtabCursor();
+    cursor->index = NULL;
+    cursor->pos = 0;
+    cursor->end = 0;
+    *cursor_result = &cursor->base;
+    return SQLITE_OK;
+}
+
+static int vtab_close( sqlite3_vtab_cursor *base )
+{
+    delete reinterpret_cast<AplVtabCursor *>( base );
+    return SQLITE_OK;
+}
+
+class SortedCellCompare {
+public:
+    SortedCellCompare( AplVirtualTable *table_in, int col_in ) : table( table_in ), col( col_in ) {}
+    bool operator()( int row, double value ) { return table->get_cell( row, col ).get_real_value() < value; }
+    bool operator()( double value, int row ) { return value < table->get_cell( row, col ).get_real_value(); }
+
+private:
+    AplVirtualTable *table;
+    int col;
+};
+
+static int vtab_filter( sqlite3_vtab_cursor *base, int idx_num, const char *idx_str,
+                        int argc, sqlite3_value **argv )
+{
+    AplVtabCursor *cursor = reinterpret_cast<AplVtabCursor *>( base );
+    AplVirtualTable *table = reinterpret_cast<AplVtab *>( base->pVtab )->table;
+
+    cursor->index = NULL;
+    cursor->pos = 0;
+    cursor->end = table->get_num_rows();
+    if( idx_num == 0 ) {
+        return SQLITE_OK;
+    }
+
+    // Non-numeric arguments fall back to a full scan, leaving the
+    // comparison to SQLite
+    for( int i = 0 ; i < argc ; i++ ) {
+        int type = sqlite3_value_numeric_type( argv[i] );
+        if( type != SQLITE_INTEGER && type != SQLITE_FLOAT ) {
+            return SQLITE_OK;
+        }
+    }
+
+    int col = idx_num - 1;
+    const vector<int> &index = table->get_sorted_index( col );
+    SortedCellCompare compare( table, col );
+    vector<int>::const_iterator lower = index.begin();
+    vector<int>::const_iterator upper = index.end();
+    for( int i = 0 ; i < argc ; i++ ) {
+        double value = sqlite3_value_double( argv[i] );
+        switch( idx_str[i] ) {
+        case OP_EQ:
+            lower = std::max( lower, std::lower_bound( index.begin(), index.end(), value, compare ) );
+            upper = std::min( upper, std::upper_bound( index.begin(), index.end(), value, compare ) );
+            break;
+        case OP_GT:
+            lower = std::max( lower, std::upper_bound( index.begin(), index.end(), value, compare ) );
+            break;
+        case OP_GE:
+            lower = std::max( lower, std::lower_bound( index.begin(), index.end(), value, compare ) );
+            break;
+        case OP_LT:
+            upper = std::min( upper, std::lower_bound( index.begin(), index.end(), value, compare ) );
+            break;
+        case OP_LE:
+            upper = std::min( upper, std::upper_bound( index.begin(), index.end(), value, compare ) );
+            break;
+        }
+    }
+
+    cursor->index = &index;
+    cursor->pos = lower - index.begin();
+    cursor->end = upper > lower ? upper - index.begin() : cursor->pos;
+    return SQLITE_OK;
+}
+
+static int vtab_next( sqlite3_vtab_cursor *base )
+{
+    reinterpret_cast<AplVtabCursor *>( base )->pos++;
+    return SQLITE_OK;
+}
+
+static int vtab_eof( sqlite3_vtab_cursor *base )
+{
+    AplVtabCursor *cursor = reinterpret_cast<AplVtabCursor *>( base );
+    return cursor->pos >= cursor->end;
+}
+
+static int cursor_row( AplVtabCursor *cursor )
+{
+    return cursor->index == NULL ? cursor->pos : (*cursor->index)[cursor->pos];
+}
+
+static void set_column_result( sqlite3_context *context, const Cell &cell )
+{
+    if( cell.is_integer_cell() ) {
+        sqlite3_result_int64( context, cell.get_int_value() );
+    }
+    else if( cell.is_float_cell() ) {
+        sqlite3_result_double( context, cell.get_real_value() );
+    }
+    else if( cell.is_character_cell() ) {
+        UCS_string ucs;
+        ucs.append( cell.get_char_value() );
+        string s = to_string( ucs );
+        sqlite3_result_text( context, s.c_str(), s.size(), SQLITE_TRANSIENT );
+    }
+    else if( cell.is_pointer_cell() ) {
+        Value_P value = cell.get_pointer_value();
+        if( value->element_count() == 0 ) {
+            sqlite3_result_null( context );
+        }
+        else if( value->is_char_string() ) {
+            string s = to_string( value->get_UCS_ravel() );
+            sqlite3_result_text( context, s.c_str(), s.size(), SQLITE_TRANSIENT );
+        }
+        else {
+            sqlite3_result_error( context, "Unsupported nested value in APL table", -1 );
+        }
+    }
+    else {
+        sqlite3_result_error( context, "Unsupported value in APL table", -1 );
+    }
+}
+
+static int vtab_column( sqlite3_vtab_cursor *base, sqlite3_context *context, int col )
+{
+    AplVtabCursor *cursor = reinterpret_cast<AplVtabCursor *>( base );
+    AplVirtualTable *table = reinterpret_cast<AplVtab *>( base->pVtab )->table;
+    set_column_result( context, table->get_cell( cursor_row( cursor ), col ) );
+    return SQLITE_OK;
+}
+
+static int vtab_rowid( sqlite3_vtab_cursor *base, sqlite3_int64 *rowid )
+{
+    *rowid = cursor_row( reinterpret_cast<AplVtabCursor *>( base ) );
+    return SQLITE_OK;
+}
+
+static sqlite3_module apl_module;
+
+sqlite3_module *get_apl_virtual_table_module( void )
+{
+    if( apl_module.xCreate == NULL ) {
+        apl_module.iVersion = 1;
+        apl_module.xCreate = vtab_connect;
+        apl_module.xConnect = vtab_connect;
+        apl_module.xBestIndex = vtab_best_index;
+        apl_module.xDisconnect = vtab_disconnect;
+        apl_module.xDestroy = vtab_destroy;
+        apl_module.xOpen = vtab_open;
+        apl_module.xClose = vtab_close;
+        apl_module.xFilter = vtab_filter;
+        apl_module.xNext = vtab_next;
+        apl_module.xEof = vtab_eof;
+        apl_module.xColumn = vtab_column;
+        apl_module.xRowid = vtab_rowid;
+    }
+    return &apl_module;
+}
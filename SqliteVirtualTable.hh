@@ -0,0 +1,54 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SQLITE_VIRTUAL_TABLE_HH
+#define SQLITE_VIRTUAL_TABLE_HH
+
+#include "apl-sqlite.hh"
+
+#include <sqlite3.h>
+
+/*
+ * A read-only virtual table that reads its rows directly from the ravel
+ * of an APL array. A matrix gives one row per APL row, and a vector is
+ * treated as a single column.
+ */
+class AplVirtualTable {
+public:
+    AplVirtualTable( Value_P value_in, const vector<string> &column_names_in );
+    string make_schema( void );
+    int get_num_rows( void ) { return num_rows; }
+    int get_num_cols( void ) { return num_cols; }
+    bool is_numeric_column( int col ) { return column_types[col] == "INTEGER" || column_types[col] == "REAL"; }
+    const Cell &get_cell( int row, int col ) { return value->get_ravel( static_cast<long>( row ) * num_cols + col ); }
+    const vector<int> &get_sorted_index( int col );
+
+private:
+    Value_P value;
+    int num_rows;
+    int num_cols;
+    vector<string> column_names;
+    vector<string> column_types;
+    map<int, vector<int> > sorted_indexes;
+};
+
+sqlite3_module *get_apl_virtual_table_module( void );
+
+#endif
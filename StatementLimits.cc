@@ -0,0 +1,97 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "StatementLimits.hh"
+#include "Connection.hh"
+
+StatementLimiter::StatementLimiter( Connection *conn_in )
+    : conn( conn_in ), previous( conn_in->get_active_limiter() ), limits( conn_in->get_limits() ),
+      reason( STOP_NONE ), rows( 0 ), bytes( 0 )
+{
+    if( limits.max_time_ms > 0 ) {
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds( limits.max_time_ms );
+    }
+    conn->set_active_limiter( this );
+    conn->set_statement_stopped( false );
+}
+
+StatementLimiter::~StatementLimiter()
+{
+    conn->set_active_limiter( previous );
+}
+
+bool StatementLimiter::should_stop( void )
+{
+    if( reason != STOP_NONE ) {
+        return true;
+    }
+    if( attention_raised || interrupt_raised ) {
+        reason = STOP_INTERRUPT;
+    }
+    else if( limits.max_time_ms > 0 && std::chrono::steady_clock::now() > deadline ) {
+        reason = STOP_TIME;
+    }
+    return reason != STOP_NONE;
+}
+
+bool StatementLimiter::add_row( long row_bytes )
+{
+    rows++;
+    bytes += row_bytes;
+    if( limits.max_rows > 0 && rows > limits.max_rows ) {
+        reason = STOP_ROWS;
+    }
+    else if( limits.max_bytes > 0 && bytes > limits.max_bytes ) {
+        reason = STOP_BYTES;
+    }
+    return reason != STOP_NONE;
+}
+
+void StatementLimiter::raise_stop_error( void )
+{
+    if( reason == STOP_NONE ) {
+        return;
+    }
+
+    conn->set_statement_stopped( true );
+    stringstream out;
+    switch( reason ) {
+    case STOP_NONE:
+        return;
+    case STOP_INTERRUPT:
+        // The interrupt has been handled by stopping the statement
+        attention_raised = false;
+        interrupt_raised = false;
+        Workspace::more_error() = "Statement interrupted";
+        INTERRUPT;
+    case STOP_TIME:
+        out << "Statement exceeded the time limit of " << limits.max_time_ms << " ms";
+        break;
+    case STOP_ROWS:
+        out << "Statement exceeded the limit of " << limits.max_rows << " rows";
+        break;
+    case STOP_BYTES:
+        out << "Statement exceeded the limit of " << limits.max_bytes << " bytes";
+        break;
+    }
+    Workspace::more_error() = out.str().c_str();
+    DOMAIN_ERROR;
+}
@@ -0,0 +1,81 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef STATEMENT_LIMITS_HH
+#define STATEMENT_LIMITS_HH
+
+#include "apl-sqlite.hh"
+
+#include <chrono>
+
+/*
+ * Limits for each statement run on a connection. Zero means no limit.
+ */
+class QueryLimits {
+public:
+    QueryLimits() : max_time_ms( 0 ), max_rows( 0 ), max_bytes( 0 ) {}
+    long max_time_ms;
+    long max_rows;
+    long max_bytes;
+};
+
+class Connection;
+
+/*
+ * Checks one running statement against the limits of its connection
+ * and against APL interrupts. While it exists, it is the active limiter
+ * of the connection, which is what the database callbacks look at.
+ *
+ * should_stop() is called from inside the database libraries, so it
+ * only records why the statement has to stop. The error is raised by
+ * raise_stop_error() once the library has returned.
+ */
+class StatementLimiter {
+public:
+    StatementLimiter( Connection *conn_in );
+    ~StatementLimiter();
+    bool should_stop( void );
+    bool is_stopped( void ) { return reason != STOP_NONE; }
+    void raise_stop_error( void );
+
+    // Stops the statement because an APL function that it called was
+    // interrupted
+    void interrupt( void ) { reason = STOP_INTERRUPT; }
+
+    // Counts rows as they are materialised. Returns true when a limit
+    // has been exceeded.
+    bool add_row( long bytes );
+
+    bool is_counting_bytes( void ) { return limits.max_bytes > 0; }
+
+private:
+    enum StopReason { STOP_NONE, STOP_INTERRUPT, STOP_TIME, STOP_ROWS, STOP_BYTES };
+
+    Connection *conn;
+    StatementLimiter *previous;
+    QueryLimits limits;
+    std::chrono::steady_clock::time_point deadline;
+    StopReason reason;
+    long rows;
+    long bytes;
+};
+
+#endif
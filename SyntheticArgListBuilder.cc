@@ -0,0 +1,181 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SyntheticArgListBuilder.hh"
+#include "QueryStats.hh"
+
+#include "IntCell.hh"
+#include "FloatCell.hh"
+#include "PointerCell.hh"
+
+SyntheticArgListBuilder::SyntheticArgListBuilder( SyntheticConnection *connection_in, const string &sql, bool query_in )
+    : connection( connection_in ), spec( connection_in->get_spec() ), query( query_in ), num_bound( 0 )
+{
+    PhaseTimer timer( PHASE_PREPARE );
+    spec.parse( sql, true );
+    explain = sql.compare( 0, 8, "explain " ) == 0;
+    num_params = 0;
+    for( string::const_iterator i = sql.begin() ; i != sql.end() ; i++ ) {
+        if( *i == '?' ) {
+            num_params++;
+        }
+    }
+}
+
+void SyntheticArgListBuilder::check_pos( int pos )
+{
+    if( pos < 0 || pos >= num_params ) {
+        stringstream out;
+        out << "Bind parameter " << pos << " out of range, statement has " << num_params << " parameters";
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    num_bound++;
+}
+
+void SyntheticArgListBuilder::append_string( const string &, int pos )
+{
+    check_pos( pos );
+}
+
+void SyntheticArgListBuilder::append_long( long, int pos )
+{
+    check_pos( pos );
+}
+
+void SyntheticArgListBuilder::append_double( double, int pos )
+{
+    check_pos( pos );
+}
+
+void SyntheticArgListBuilder::append_null( int pos )
+{
+    check_pos( pos );
+}
+
+void SyntheticArgListBuilder::clear_args( void )
+{
+    num_bound = 0;
+}
+
+/*
+ * splitmix64, which gives each cell an independent random number
+ * derived from the seed and the cell position.
+ */
+static unsigned long long mix( unsigned long long x )
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Returns true if the cell is null
+ */
+bool SyntheticArgListBuilder::fill_cell( Cell *cell, long row, int col, string &buf )
+{
+    char type = spec.types[col];
+    unsigned long long r = mix( spec.seed ^ mix( static_cast<unsigned long long>( row ) * spec.types.size() + col ) );
+    if( type == 'n' || static_cast<int>( r % 100 ) < spec.null_percent ) {
+        if( null_sentinels == NULL ) {
+            new (cell) PointerCell( Idx0( LOC ) );
+        }
+        else {
+            null_sentinels->for_column( col ).fill( cell );
+        }
+        return true;
+    }
+
+    r >>= 7;
+    switch( type ) {
+    case 'i':
+        new (cell) IntCell( static_cast<long>( r % 2000000001 ) - 1000000000 );
+        break;
+    case 'f':
+        new (cell) FloatCell( static_cast<double>( r % 100000000 ) / 1000 );
+        break;
+    default: {
+        int length = type == 's' ? 4 + r % 12 : spec.string_length;
+        if( length == 0 ) {
+            new (cell) PointerCell( Str0( LOC ) );
+            break;
+        }
+        buf.resize( length );
+        for( int i = 0 ; i < length ; i++ ) {
+            r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+            buf[i] = 'a' + (r >> 33) % 26;
+        }
+        new (cell) PointerCell( make_string_cell( buf, LOC ) );
+    }
+    }
+    return false;
+}
+
+Value_P SyntheticArgListBuilder::run_query( bool ignore_result )
+{
+    if( num_bound != num_params ) {
+        stringstream out;
+        out << "Statement has " << num_params << " parameters, but " << num_bound << " were bound";
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+
+    if( !query ) {
+        connection->add_updated_row();
+        return Idx0( LOC );
+    }
+
+    if( explain ) {
+        Value_P plan( new Value( Shape( 1, 1 ), LOC ) );
+        new (plan->next_ravel()) PointerCell( make_string_cell( "SYNTHETIC SCAN", LOC ) );
+        plan->check_value( LOC );
+        return plan;
+    }
+
+    if( ignore_result || spec.rows == 0 || spec.types.size() == 0 ) {
+        if( null_sentinels != NULL ) {
+            null_sentinels->set_mask( Idx0( LOC ) );
+        }
+        return Idx0( LOC );
+    }
+
+    PhaseTimer timer( PHASE_CONVERT );
+    int cols = spec.types.size();
+    Value_P db_result_value( new Value( Shape( spec.rows, cols ), LOC ) );
+    Value_P mask;
+    if( null_sentinels != NULL ) {
+        mask = make_null_mask( spec.rows, cols );
+    }
+    string buf;
+    for( long row = 0 ; row < spec.rows ; row++ ) {
+        for( int col = 0 ; col < cols ; col++ ) {
+            if( fill_cell( db_result_value->next_ravel(), row, col, buf ) && null_sentinels != NULL ) {
+                new (&mask->get_ravel( row * cols + col )) IntCell( 1 );
+            }
+        }
+    }
+    db_result_value->check_value( LOC );
+    if( null_sentinels != NULL ) {
+        null_sentinels->set_mask( mask );
+    }
+    return db_result_value;
+}
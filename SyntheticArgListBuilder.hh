@@ -0,0 +1,53 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SYNTHETIC_ARG_LIST_BUILDER_HH
+#define SYNTHETIC_ARG_LIST_BUILDER_HH
+
+#include "apl-sqlite.hh"
+#include "SyntheticConnection.hh"
+#include "ArgListBuilder.hh"
+
+class SyntheticArgListBuilder : public ArgListBuilder {
+public:
+    SyntheticArgListBuilder( SyntheticConnection *connection_in, const string &sql, bool query_in );
+    virtual ~SyntheticArgListBuilder() {}
+    virtual void append_string( const string &arg, int pos );
+    virtual void append_long( long arg, int pos );
+    virtual void append_double( double arg, int pos );
+    virtual void append_null( int pos );
+    virtual Value_P run_query( bool ignore_result );
+    virtual void clear_args( void );
+    virtual int get_param_count( void ) { return num_params; }
+    virtual void describe_columns( vector<ColumnDescriptor> &cols ) { spec.describe_columns( cols ); }
+
+private:
+    void check_pos( int pos );
+    bool fill_cell( Cell *cell, long row, int col, string &buf );
+    SyntheticConnection *connection;
+    SyntheticSpec spec;
+    bool query;
+    bool explain;
+    int num_params;
+    int num_bound;
+};
+
+#endif
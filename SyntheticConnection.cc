@@ -0,0 +1,177 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SyntheticConnection.hh"
+#include "SyntheticArgListBuilder.hh"
+
+#include <limits.h>
+
+static const char *SYNTHETIC_TYPES = "ifstn";
+
+static long parse_spec_number( const string &key, const string &value, long min, long max )
+{
+    char *endptr;
+    long result = strtol( value.c_str(), &endptr, 10 );
+    if( value.size() == 0 || *endptr != 0 || result < min || result > max ) {
+        stringstream out;
+        out << "Illegal value for " << key << ": " << value;
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    return result;
+}
+
+void SyntheticSpec::set( const string &key, const string &value )
+{
+    if( key == "rows" ) {
+        rows = parse_spec_number( key, value, 0, 1L << 40 );
+    }
+    else if( key == "types" ) {
+        if( value.find_first_not_of( SYNTHETIC_TYPES ) != string::npos ) {
+            stringstream out;
+            out << "Synthetic column types must be one of " << SYNTHETIC_TYPES << ": " << value;
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+        types = value;
+    }
+    else if( key == "seed" ) {
+        seed = parse_spec_number( key, value, 0, LONG_MAX );
+    }
+    else if( key == "string_length" ) {
+        string_length = parse_spec_number( key, value, 0, 1 << 24 );
+    }
+    else if( key == "null_percent" ) {
+        null_percent = parse_spec_number( key, value, 0, 100 );
+    }
+    else {
+        stringstream out;
+        out << "Unknown synthetic database option: " << key;
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+}
+
+/*
+ * Applies each word of the form key=value in text. Other words are
+ * ignored, so that an ordinary select statement gives the default
+ * result of the connection. When parsing a statement, words with
+ * unknown keys are ignored as well.
+ */
+void SyntheticSpec::parse( const string &text, bool ignore_unknown )
+{
+    static const char *keys[] = { "rows", "types", "seed", "string_length", "null_percent", NULL };
+
+    stringstream in( text );
+    string word;
+    while( in >> word ) {
+        size_t separator = word.find( '=' );
+        if( separator == string::npos || separator == 0 ) {
+            continue;
+        }
+
+        string key = word.substr( 0, separator );
+        bool known = false;
+        for( const char **i = keys ; *i != NULL ; i++ ) {
+            if( key == *i ) {
+                known = true;
+            }
+        }
+        if( known || !ignore_unknown ) {
+            set( key, word.substr( separator + 1 ) );
+        }
+    }
+}
+
+void SyntheticSpec::describe_columns( vector<ColumnDescriptor> &cols ) const
+{
+    for( size_t i = 0 ; i < types.size() ; i++ ) {
+        stringstream name;
+        name << "c" << i;
+        string type;
+        switch( types[i] ) {
+        case 'i': type = "integer"; break;
+        case 'f': type = "float"; break;
+        case 'n': type = "null"; break;
+        default: type = "text";
+        }
+        cols.push_back( ColumnDescriptor( name.str(), type ) );
+    }
+}
+
+class SyntheticBatchWriter : public BatchWriter {
+public:
+    virtual bool begin( string & ) { return true; }
+    virtual bool execute( const QueuedStatement &, string & ) { return true; }
+    virtual bool commit( string & ) { return true; }
+    virtual void rollback( void ) {}
+};
+
+BatchWriter *SyntheticConnection::make_batch_writer( void )
+{
+    return new SyntheticBatchWriter();
+}
+
+ArgListBuilder *SyntheticConnection::make_prepared_query( const string &sql )
+{
+    return new SyntheticArgListBuilder( this, sql, true );
+}
+
+ArgListBuilder *SyntheticConnection::make_prepared_update( const string &sql )
+{
+    return new SyntheticArgListBuilder( this, sql, false );
+}
+
+void SyntheticConnection::fill_tables( vector<string> &tables )
+{
+    tables.push_back( "synthetic" );
+}
+
+void SyntheticConnection::fill_table_info( const string &table, TableInfo &info )
+{
+    if( table != "synthetic" ) {
+        Workspace::more_error() = "The only table in a synthetic database is synthetic";
+        DOMAIN_ERROR;
+    }
+
+    vector<ColumnDescriptor> cols;
+    spec.describe_columns( cols );
+    for( vector<ColumnDescriptor>::iterator i = cols.begin() ; i != cols.end() ; i++ ) {
+        info.columns.push_back( ColumnInfo( i->get_name(), i->get_type(), true, 0 ) );
+    }
+    info.row_estimate = spec.rows;
+}
+
+const string SyntheticConnection::read_schema_version( void )
+{
+    // The schema never changes
+    return "";
+}
+
+const string SyntheticConnection::make_positional_param( int )
+{
+    return "?";
+}
+
+const string SyntheticConnection::make_explain_prefix( bool )
+{
+    return "explain ";
+}
@@ -0,0 +1,85 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SYNTHETIC_CONNECTION_HH
+#define SYNTHETIC_CONNECTION_HH
+
+#include "Connection.hh"
+
+/*
+ * Describes the result generated by the synthetic provider. Each
+ * character in types gives the type of one column:
+ *
+ *   i  integer
+ *   f  float
+ *   s  short string
+ *   t  long string, string_length characters
+ *   n  null
+ *
+ * Any column other than n is null in null_percent percent of the rows.
+ */
+class SyntheticSpec {
+public:
+    SyntheticSpec() : rows( 1000 ), types( "ifs" ), seed( 1 ), string_length( 200 ), null_percent( 0 ) {}
+    void set( const string &key, const string &value );
+    void parse( const string &text, bool ignore_unknown );
+    void describe_columns( vector<ColumnDescriptor> &cols ) const;
+
+    long rows;
+    string types;
+    unsigned long seed;
+    int string_length;
+    int null_percent;
+};
+
+/*
+ * A connection which doesn't talk to any database. Queries return
+ * generated rows, which makes it possible to measure the cost of
+ * creating the APL result without any I/O.
+ */
+class SyntheticConnection : public Connection {
+public:
+    SyntheticConnection( const SyntheticSpec &spec_in ) : spec( spec_in ), updated_rows( 0 ) {}
+    virtual ~SyntheticConnection() {}
+    virtual ArgListBuilder *make_prepared_query( const string &sql );
+    virtual ArgListBuilder *make_prepared_update( const string &sql );
+
+    virtual void transaction_begin() {}
+    virtual void transaction_commit() {}
+    virtual void transaction_rollback() {}
+    virtual bool in_transaction() { return false; }
+
+    virtual void fill_tables( vector<string> &tables );
+    virtual void fill_table_info( const string &table, TableInfo &info );
+    virtual const string read_schema_version( void );
+    virtual const string make_positional_param( int pos );
+    virtual const string make_explain_prefix( bool query );
+    virtual BatchWriter *make_batch_writer( void );
+
+    const SyntheticSpec &get_spec( void ) { return spec; }
+    void add_updated_row( void ) { updated_rows++; }
+
+private:
+    SyntheticSpec spec;
+    long updated_rows;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "SyntheticProvider.hh"
+#include "SyntheticConnection.hh"
+
+static string spec_cell_to_string( const Cell &cell )
+{
+    if( cell.is_integer_cell() ) {
+        stringstream out;
+        out << cell.get_int_value();
+        return out.str();
+    }
+
+    Value_P value = cell.to_value( LOC );
+    if( !value->is_char_string() ) {
+        Workspace::more_error() = "Synthetic database options must be strings or integers";
+        DOMAIN_ERROR;
+    }
+    return to_string( value->get_UCS_ravel() );
+}
+
+Connection *SyntheticProvider::open_database( Value_P B )
+{
+    SyntheticSpec spec;
+    if( B->is_char_string() ) {
+        spec.parse( to_string( B->get_UCS_ravel() ), false );
+    }
+    else if( B->get_rank() == 2 && B->get_cols() == 2 ) {
+        for( int row = 0 ; row < B->get_rows() ; row++ ) {
+            spec.set( spec_cell_to_string( B->get_ravel( row * 2 ) ),
+                      spec_cell_to_string( B->get_ravel( row * 2 + 1 ) ) );
+        }
+    }
+    else if( B->element_count() != 0 ) {
+        Workspace::more_error() = "Synthetic database argument must be a string or a two-column key/value matrix";
+        DOMAIN_ERROR;
+    }
+
+    return new SyntheticConnection( spec );
+}
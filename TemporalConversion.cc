@@ -0,0 +1,312 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "TemporalConversion.hh"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Value.hh"
+#include "IntCell.hh"
+
+static const long MS_PER_DAY = 24L * 60 * 60 * 1000;
+
+/*
+ * Conversion between days since 1970-01-01 and the proleptic
+ * Gregorian calendar, from Howard Hinnant's date algorithms.
+ */
+static long days_from_civil( long year, int month, int day )
+{
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+static void civil_from_days( long days, int *year, int *month, int *day )
+{
+    days += 719468;
+    long era = (days >= 0 ? days : days - 146096) / 146097;
+    long day_of_era = days - era * 146097;
+    long year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    long day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    long mp = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+}
+
+long TemporalValue::to_epoch_ms( void ) const
+{
+    long ms = ((parts[3] * 60L + parts[4]) * 60 + parts[5]) * 1000 + parts[6];
+    if( has_date ) {
+        ms += days_from_civil( parts[0], parts[1], parts[2] ) * MS_PER_DAY;
+    }
+    return ms;
+}
+
+static bool read_number( const char *&p, const char *end, int min_digits, int max_digits, int *result )
+{
+    int n = 0;
+    int digits = 0;
+    while( p < end && digits < max_digits && *p >= '0' && *p <= '9' ) {
+        n = n * 10 + (*p - '0');
+        p++;
+        digits++;
+    }
+    *result = n;
+    return digits >= min_digits;
+}
+
+static bool expect( const char *&p, const char *end, char ch )
+{
+    if( p < end && *p == ch ) {
+        p++;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_time( const char *&p, const char *end, TemporalValue &result )
+{
+    if( !read_number( p, end, 2, 2, &result.parts[3] )
+        || !expect( p, end, ':' )
+        || !read_number( p, end, 2, 2, &result.parts[4] ) ) {
+        return false;
+    }
+    if( expect( p, end, ':' ) && !read_number( p, end, 2, 2, &result.parts[5] ) ) {
+        return false;
+    }
+    if( expect( p, end, '.' ) ) {
+        // Only milliseconds are kept, the remaining digits are ignored
+        int digits = 0;
+        while( p < end && *p >= '0' && *p <= '9' ) {
+            if( digits < 3 ) {
+                result.parts[6] = result.parts[6] * 10 + (*p - '0');
+            }
+            p++;
+            digits++;
+        }
+        if( digits == 0 ) {
+            return false;
+        }
+        for( ; digits < 3 ; digits++ ) {
+            result.parts[6] *= 10;
+        }
+    }
+    return result.parts[3] <= 24 && result.parts[4] < 60 && result.parts[5] <= 60;
+}
+
+/*
+ * Parses an optional time zone offset, Z or +HH[:MM[:SS]], and returns
+ * it in milliseconds.
+ */
+static bool parse_zone( const char *&p, const char *end, long *offset_ms )
+{
+    *offset_ms = 0;
+    if( p == end ) {
+        return true;
+    }
+    if( expect( p, end, 'Z' ) ) {
+        return p == end;
+    }
+
+    int sign;
+    if( expect( p, end, '+' ) ) {
+        sign = 1;
+    }
+    else if( expect( p, end, '-' ) ) {
+        sign = -1;
+    }
+    else {
+        return false;
+    }
+
+    int hours;
+    int minutes = 0;
+    int seconds = 0;
+    if( !read_number( p, end, 2, 2, &hours ) ) {
+        return false;
+    }
+    expect( p, end, ':' );
+    if( p < end && !read_number( p, end, 2, 2, &minutes ) ) {
+        return false;
+    }
+    expect( p, end, ':' );
+    if( p < end && !read_number( p, end, 2, 2, &seconds ) ) {
+        return false;
+    }
+    *offset_ms = sign * ((hours * 60L + minutes) * 60 + seconds) * 1000;
+    return p == end;
+}
+
+/*
+ * Accepts the ISO 8601 style formats used by PostgreSQL and SQLite:
+ * YYYY-MM-DD, HH:MM[:SS[.fff]] and YYYY-MM-DD HH:MM[:SS[.fff]] with T
+ * allowed as separator. Times may be followed by a time zone.
+ */
+bool parse_temporal( const char *text, int length, TemporalValue &result )
+{
+    memset( &result, 0, sizeof( result ) );
+    const char *p = text;
+    const char *end = text + length;
+
+    const char *time_start = p;
+    int first;
+    if( !read_number( p, end, 2, 6, &first ) ) {
+        return false;
+    }
+
+    if( p < end && *p == ':' ) {
+        p = time_start;
+    }
+    else {
+        result.parts[0] = first;
+        if( p - time_start < 4
+            || !expect( p, end, '-' )
+            || !read_number( p, end, 2, 2, &result.parts[1] )
+            || !expect( p, end, '-' )
+            || !read_number( p, end, 2, 2, &result.parts[2] ) ) {
+            return false;
+        }
+        if( result.parts[1] < 1 || result.parts[1] > 12 || result.parts[2] < 1 || result.parts[2] > 31 ) {
+            return false;
+        }
+        result.has_date = true;
+        if( p == end ) {
+            return true;
+        }
+        if( !expect( p, end, ' ' ) && !expect( p, end, 'T' ) ) {
+            return false;
+        }
+    }
+
+    if( !parse_time( p, end, result ) ) {
+        return false;
+    }
+    result.has_time = true;
+
+    long offset_ms;
+    if( !parse_zone( p, end, &offset_ms ) ) {
+        return false;
+    }
+    if( offset_ms != 0 ) {
+        long ms = result.to_epoch_ms() - offset_ms;
+        long days = ms / MS_PER_DAY;
+        ms %= MS_PER_DAY;
+        if( ms < 0 ) {
+            ms += MS_PER_DAY;
+            days--;
+        }
+        if( result.has_date ) {
+            civil_from_days( days, &result.parts[0], &result.parts[1], &result.parts[2] );
+        }
+        result.parts[6] = ms % 1000;
+        result.parts[5] = ms / 1000 % 60;
+        result.parts[4] = ms / (60 * 1000) % 60;
+        result.parts[3] = ms / (60 * 60 * 1000);
+    }
+    return true;
+}
+
+/*
+ * SQLite has no date types, so the declared type of the column is used
+ * to decide which text values are dates.
+ */
+bool is_temporal_type_name( const char *type_name )
+{
+    if( type_name == NULL ) {
+        return false;
+    }
+    string upper;
+    for( const char *p = type_name ; *p != 0 ; p++ ) {
+        upper += toupper( *p );
+    }
+    return upper.find( "DATE" ) != string::npos || upper.find( "TIME" ) != string::npos;
+}
+
+const string format_temporal( const TemporalValue &value, bool with_zone )
+{
+    char buf[64];
+    if( !value.has_time ) {
+        snprintf( buf, sizeof( buf ), "%04d-%02d-%02d", value.parts[0], value.parts[1], value.parts[2] );
+    }
+    else {
+        snprintf( buf, sizeof( buf ), "%04d-%02d-%02d %02d:%02d:%02d.%03d%s",
+                  value.parts[0], value.parts[1], value.parts[2],
+                  value.parts[3], value.parts[4], value.parts[5], value.parts[6],
+                  with_zone ? "+00" : "" );
+    }
+    return buf;
+}
+
+Value_P make_timestamp_value( const TemporalValue &value )
+{
+    Value_P result( new Value( Shape( 7 ), LOC ) );
+    for( int i = 0 ; i < 7 ; i++ ) {
+        new (result->next_ravel()) IntCell( value.parts[i] );
+    }
+    result->check_value( LOC );
+    return result;
+}
+
+bool timestamp_value_to_temporal( Value_P value, TemporalValue &result )
+{
+    int n = value->element_count();
+    if( value->get_rank() != 1 || (n != 3 && n != 7) ) {
+        return false;
+    }
+
+    memset( &result, 0, sizeof( result ) );
+    for( int i = 0 ; i < n ; i++ ) {
+        const Cell &cell = value->get_ravel( i );
+        if( !cell.is_integer_cell() ) {
+            return false;
+        }
+        result.parts[i] = cell.get_int_value();
+    }
+    result.has_date = true;
+    result.has_time = n == 7;
+    return true;
+}
+
+bool is_valid_temporal( const TemporalValue &value )
+{
+    const int *parts = value.parts;
+    if( value.has_date ) {
+        if( parts[0] < 0 || parts[0] > 9999 || parts[1] < 1 || parts[1] > 12 || parts[2] < 1 ) {
+            return false;
+        }
+        long next_month = parts[1] == 12 ? days_from_civil( parts[0] + 1, 1, 1 ) : days_from_civil( parts[0], parts[1] + 1, 1 );
+        if( parts[2] > next_month - days_from_civil( parts[0], parts[1], 1 ) ) {
+            return false;
+        }
+    }
+    if( value.has_time ) {
+        if( parts[3] < 0 || parts[3] > 23 || parts[4] < 0 || parts[4] > 59 || parts[5] < 0 || parts[5] > 60
+            || parts[6] < 0 || parts[6] > 999 ) {
+            return false;
+        }
+    }
+    return true;
+}
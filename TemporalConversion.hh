@@ -0,0 +1,70 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef TEMPORAL_CONVERSION_HH
+#define TEMPORAL_CONVERSION_HH
+
+#include "apl-sqlite.hh"
+
+/*
+ * How date and time columns are returned. In the text mode they are
+ * returned as the database sends them.
+ */
+enum TemporalMode {
+    TEMPORAL_TEXT = 0,
+    TEMPORAL_EPOCH_MS = 1,
+    TEMPORAL_TIMESTAMP = 2
+};
+
+/*
+ * A date or time split into the same parts as ⎕TS: year, month, day,
+ * hour, minute, second and millisecond. Values with a time zone are
+ * converted to UTC. Times without a date have zero year, month and day.
+ */
+class TemporalValue {
+public:
+    int parts[7];
+    bool has_date;
+    bool has_time;
+
+    // Milliseconds since 1970-01-01 UTC, or since midnight for a time
+    long to_epoch_ms( void ) const;
+};
+
+// The parsing functions don't allocate any APL values, so they can be
+// called from the worker threads
+bool parse_temporal( const char *text, int length, TemporalValue &result );
+bool is_temporal_type_name( const char *type_name );
+
+// Formats the value as YYYY-MM-DD HH:MM:SS.mmm, optionally followed by
+// the UTC time zone
+const string format_temporal( const TemporalValue &value, bool with_zone );
+
+Value_P make_timestamp_value( const TemporalValue &value );
+
+// Accepts a 7 element ⎕TS style vector, or a 3 element date
+bool timestamp_value_to_temporal( Value_P value, TemporalValue &result );
+
+// True if each part of the date, and of the time if there is one, is in
+// range
+bool is_valid_temporal( const TemporalValue &value );
+
+#endif
@@ -0,0 +1,146 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadPool.hh"
+
+#include <signal.h>
+#include <pthread.h>
+#include <exception>
+
+static ThreadPool *instance = NULL;
+
+ThreadPool *ThreadPool::get_instance( void )
+{
+    if( instance == NULL ) {
+        int num_threads = std::thread::hardware_concurrency();
+        instance = new ThreadPool( num_threads > 1 ? num_threads - 1 : 0 );
+    }
+    return instance;
+}
+
+void ThreadPool::shutdown( void )
+{
+    delete instance;
+    instance = NULL;
+}
+
+ThreadPool::ThreadPool( int num_threads )
+    : stopping( false )
+{
+    // Signals such as ^C have to be delivered to the interpreter thread,
+    // so block them in the workers.
+    sigset_t all_signals;
+    sigset_t old_signals;
+    sigfillset( &all_signals );
+    pthread_sigmask( SIG_SETMASK, &all_signals, &old_signals );
+    for( int i = 0 ; i < num_threads ; i++ ) {
+        workers.push_back( std::thread( &ThreadPool::worker_loop, this ) );
+    }
+    pthread_sigmask( SIG_SETMASK, &old_signals, NULL );
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> guard( lock );
+        stopping = true;
+    }
+    task_available.notify_all();
+    for( std::vector<std::thread>::iterator i = workers.begin() ; i != workers.end() ; i++ ) {
+        i->join();
+    }
+}
+
+void ThreadPool::worker_loop( void )
+{
+    while( true ) {
+        std::function<void ()> task;
+        {
+            std::unique_lock<std::mutex> guard( lock );
+            while( !stopping && tasks.empty() ) {
+                task_available.wait( guard );
+            }
+            if( tasks.empty() ) {
+                return;
+            }
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::run_partitioned( long count, const SliceFunction &fn )
+{
+    int num_slices = get_num_slices();
+    if( count < num_slices ) {
+        num_slices = count > 0 ? count : 1;
+    }
+    long slice_size = count / num_slices;
+    long remainder = count % num_slices;
+
+    std::mutex done_lock;
+    std::condition_variable done_cond;
+    int remaining = num_slices - 1;
+    std::exception_ptr error;
+
+    // Every slice catches its own exception, since the locals above
+    // must outlive all of them, and an exception escaping a worker
+    // would terminate the process. The first one is rethrown below.
+    std::function<void ( int, long, long )> run_slice = [&]( int slice, long slice_start, long slice_end ) {
+        try {
+            fn( slice, slice_start, slice_end );
+        }
+        catch( ... ) {
+            std::unique_lock<std::mutex> done_guard( done_lock );
+            if( !error ) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    long start = slice_size + (remainder > 0 ? 1 : 0);
+    {
+        std::unique_lock<std::mutex> guard( lock );
+        for( int slice = 1 ; slice < num_slices ; slice++ ) {
+            long end = start + slice_size + (slice < remainder ? 1 : 0);
+            tasks.push_back( [&, slice, start, end]() {
+                    run_slice( slice, start, end );
+                    std::unique_lock<std::mutex> done_guard( done_lock );
+                    if( --remaining == 0 ) {
+                        done_cond.notify_one();
+                    }
+                } );
+            start = end;
+        }
+    }
+    task_available.notify_all();
+
+    // The calling thread processes the first slice itself
+    run_slice( 0, 0, slice_size + (remainder > 0 ? 1 : 0) );
+
+    std::unique_lock<std::mutex> done_guard( done_lock );
+    while( remaining > 0 ) {
+        done_cond.wait( done_guard );
+    }
+    if( error ) {
+        std::rethrow_exception( error );
+    }
+}
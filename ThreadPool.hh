@@ -0,0 +1,66 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Results smaller than this number of cells are converted on the
+ * calling thread, since the cost of waking up the workers would
+ * dominate.
+ */
+static const long PARALLEL_CONVERSION_THRESHOLD = 50000;
+
+/*
+ * A fixed set of worker threads used to split the conversion of large
+ * result sets. Functions executed by the pool must never allocate APL
+ * values or raise APL errors, since neither is safe outside of the
+ * interpreter thread.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void ( int slice, long start, long end )> SliceFunction;
+
+    static ThreadPool *get_instance( void );
+    static void shutdown( void );
+
+    int get_num_slices( void ) { return workers.size() + 1; }
+    void run_partitioned( long count, const SliceFunction &fn );
+
+private:
+    ThreadPool( int num_threads );
+    ~ThreadPool();
+    void worker_loop( void );
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void ()> > tasks;
+    std::mutex lock;
+    std::condition_variable task_available;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "Upsert.hh"
+
+bool UpsertSpec::is_key( const string &column ) const
+{
+    for( vector<string>::const_iterator i = keys.begin() ; i != keys.end() ; i++ ) {
+        if( *i == column ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Both SQLite and PostgreSQL quote identifiers with double quotes
+ */
+const string quote_identifier( const string &name )
+{
+    stringstream out;
+    out << "\"";
+    for( string::const_iterator i = name.begin() ; i != name.end() ; i++ ) {
+        if( *i == '"' ) {
+            out << "\"";
+        }
+        out << *i;
+    }
+    out << "\"";
+    return out.str();
+}
+
+/*
+ * Quotes each dot-separated part of a table name, so that names
+ * qualified with a schema keep working
+ */
+const string quote_table_name( const string &table )
+{
+    string quoted;
+    size_t start = 0;
+    while( true ) {
+        size_t end = table.find( '.', start );
+        quoted += quote_identifier( table.substr( start, end == string::npos ? string::npos : end - start ) );
+        if( end == string::npos ) {
+            return quoted;
+        }
+        quoted += '.';
+        start = end + 1;
+    }
+}
+
+static void append_list( stringstream &out, const vector<string> &names )
+{
+    for( vector<string>::const_iterator i = names.begin() ; i != names.end() ; i++ ) {
+        if( i != names.begin() ) {
+            out << ", ";
+        }
+        out << quote_identifier( *i );
+    }
+}
+
+const string make_upsert_insert_sql( const UpsertSpec &spec, const string &source, bool update )
+{
+    stringstream out;
+    out << "insert into " << quote_table_name( spec.table ) << " (";
+    append_list( out, spec.columns );
+    out << ") " << source << " on conflict (";
+    append_list( out, spec.keys );
+    out << ") do ";
+
+    bool first = true;
+    for( vector<string>::const_iterator i = spec.columns.begin() ; update && i != spec.columns.end() ; i++ ) {
+        if( !spec.is_key( *i ) ) {
+            out << (first ? "update set " : ", ") << quote_identifier( *i ) << " = excluded." << quote_identifier( *i );
+            first = false;
+        }
+    }
+    if( first ) {
+        out << "nothing";
+    }
+    return out.str();
+}
+
+const string make_upsert_update_sql( const UpsertSpec &spec, const vector<string> &params )
+{
+    stringstream set;
+    stringstream where;
+    for( size_t i = 0 ; i < spec.columns.size() ; i++ ) {
+        const string &column = spec.columns[i];
+        if( spec.is_key( column ) ) {
+            where << (where.tellp() > 0 ? " and " : "") << quote_identifier( column ) << " = " << params[i];
+        }
+        else {
+            set << (set.tellp() > 0 ? ", " : "") << quote_identifier( column ) << " = " << params[i];
+        }
+    }
+    if( set.tellp() == 0 ) {
+        return "";
+    }
+    return "update " + quote_table_name( spec.table ) + " set " + set.str() + " where " + where.str();
+}
@@ -0,0 +1,51 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UPSERT_HH
+#define UPSERT_HH
+
+#include "apl-sqlite.hh"
+
+/*
+ * The target of a bulk upsert. Rows are inserted into the table, or
+ * update the existing row with the same values in the key columns.
+ */
+class UpsertSpec {
+public:
+    string table;
+    vector<string> columns;
+    vector<string> keys;
+
+    bool is_key( const string &column ) const;
+};
+
+const string quote_identifier( const string &name );
+const string quote_table_name( const string &table );
+
+// Insert of the rows returned by source. Conflicting rows are updated,
+// or ignored when update is false or all columns are keys.
+const string make_upsert_insert_sql( const UpsertSpec &spec, const string &source, bool update );
+
+// Update of one row by its key, with params giving the value of each
+// column. Returns an empty string when all columns are keys.
+const string make_upsert_update_sql( const UpsertSpec &spec, const vector<string> &params );
+
+#endif
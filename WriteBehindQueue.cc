@@ -0,0 +1,197 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "WriteBehindQueue.hh"
+
+#include <signal.h>
+#include <pthread.h>
+
+WriteBehindQueue::WriteBehindQueue( BatchWriter *writer_in, std::recursive_mutex &db_lock_in,
+                                    long max_rows_in, long max_delay_ms_in )
+    : writer( writer_in ), db_lock( db_lock_in ), max_rows( max_rows_in ), max_delay_ms( max_delay_ms_in ),
+      head( &stub ), tail( &stub ), stub( "", 0, 0 ), enqueued_rows( 0 ), written_rows( 0 ),
+      stopping( false ), flush_requested( false )
+{
+    // Signals such as ^C have to be delivered to the interpreter thread
+    sigset_t all_signals;
+    sigset_t old_signals;
+    sigfillset( &all_signals );
+    pthread_sigmask( SIG_SETMASK, &all_signals, &old_signals );
+    thread = std::thread( &WriteBehindQueue::run, this );
+    pthread_sigmask( SIG_SETMASK, &old_signals, NULL );
+}
+
+WriteBehindQueue::~WriteBehindQueue()
+{
+    {
+        std::lock_guard<std::mutex> guard( state_lock );
+        stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+    delete writer;
+}
+
+/*
+ * The queue is the intrusive multi-producer, single-consumer queue
+ * described by Dmitry Vyukov. Producers only swap the head pointer,
+ * and the writer thread is the only one touching tail.
+ */
+void WriteBehindQueue::push( QueuedStatement *statement )
+{
+    statement->next.store( NULL, std::memory_order_relaxed );
+    QueuedStatement *prev = head.exchange( statement, std::memory_order_acq_rel );
+    prev->next.store( statement, std::memory_order_release );
+}
+
+QueuedStatement *WriteBehindQueue::pop( void )
+{
+    QueuedStatement *current = tail;
+    QueuedStatement *next = current->next.load( std::memory_order_acquire );
+    if( current == &stub ) {
+        if( next == NULL ) {
+            return NULL;
+        }
+        tail = next;
+        current = next;
+        next = next->next.load( std::memory_order_acquire );
+    }
+
+    if( next != NULL ) {
+        tail = next;
+        return current;
+    }
+
+    // A push is in progress, the statement will be picked up later
+    if( current != head.load( std::memory_order_acquire ) ) {
+        return NULL;
+    }
+
+    push( &stub );
+    next = current->next.load( std::memory_order_acquire );
+    if( next != NULL ) {
+        tail = next;
+        return current;
+    }
+    return NULL;
+}
+
+void WriteBehindQueue::enqueue( QueuedStatement *statement )
+{
+    long pending = enqueued_rows.fetch_add( statement->rows ) + statement->rows - written_rows.load();
+    push( statement );
+    if( pending >= max_rows ) {
+        wake.notify_one();
+    }
+}
+
+void WriteBehindQueue::flush( void )
+{
+    long target = enqueued_rows.load();
+    std::unique_lock<std::mutex> lock( state_lock );
+    while( written_rows.load() < target ) {
+        flush_requested = true;
+        wake.notify_one();
+        written.wait_for( lock, std::chrono::milliseconds( 10 ) );
+    }
+}
+
+string WriteBehindQueue::take_error( void )
+{
+    std::lock_guard<std::mutex> guard( state_lock );
+    string result = error;
+    error = "";
+    return result;
+}
+
+void WriteBehindQueue::run( void )
+{
+    std::unique_lock<std::mutex> lock( state_lock );
+    while( true ) {
+        wake.wait_for( lock, std::chrono::milliseconds( max_delay_ms ), [this]() {
+                return stopping || flush_requested || enqueued_rows.load() - written_rows.load() >= max_rows;
+            } );
+        bool stop = stopping;
+        flush_requested = false;
+
+        lock.unlock();
+        write_pending();
+        lock.lock();
+        written.notify_all();
+
+        if( stop && written_rows.load() >= enqueued_rows.load() ) {
+            break;
+        }
+    }
+}
+
+void WriteBehindQueue::write_pending( void )
+{
+    if( written_rows.load() >= enqueued_rows.load() ) {
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard( db_lock );
+    QueuedStatement *statement;
+    while( (statement = pop()) != NULL ) {
+        write_transaction( statement );
+    }
+}
+
+/*
+ * Writes statements, starting with first, until max_rows rows have
+ * been written or the queue is empty. After an error, the remaining
+ * statements of the transaction are discarded.
+ */
+void WriteBehindQueue::write_transaction( QueuedStatement *first )
+{
+    string message;
+    bool failed = !writer->begin( message );
+    long rows = 0;
+    QueuedStatement *statement = first;
+    while( statement != NULL ) {
+        if( !failed && !writer->execute( *statement, message ) ) {
+            failed = true;
+            writer->rollback();
+        }
+        rows += statement->rows;
+        delete statement;
+        if( rows >= max_rows ) {
+            break;
+        }
+        statement = pop();
+    }
+
+    if( !failed && !writer->commit( message ) ) {
+        failed = true;
+        writer->rollback();
+    }
+
+    if( failed ) {
+        stringstream out;
+        out << "Write-behind transaction of " << rows << " rows was rolled back: " << message;
+        std::lock_guard<std::mutex> guard( state_lock );
+        if( error.size() == 0 ) {
+            error = out.str();
+        }
+    }
+    written_rows.fetch_add( rows );
+}
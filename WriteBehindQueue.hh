@@ -0,0 +1,116 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef WRITE_BEHIND_QUEUE_HH
+#define WRITE_BEHIND_QUEUE_HH
+
+#include "apl-sqlite.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+ * Bind values are copied out of the APL array when a statement is
+ * queued, since APL values must not be touched by the writer thread.
+ */
+class QueuedBind {
+public:
+    enum Type { BIND_NULL, BIND_LONG, BIND_DOUBLE, BIND_STRING };
+    QueuedBind() : type( BIND_NULL ), long_value( 0 ), double_value( 0 ) {}
+    Type type;
+    long long_value;
+    double double_value;
+    string string_value;
+};
+
+class QueuedStatement {
+public:
+    QueuedStatement( const string &statement_in, long rows_in, int cols_in )
+        : statement( statement_in ), rows( rows_in ), cols( cols_in ), binds( rows_in * cols_in ), next( NULL ) {}
+    const string statement;
+    const long rows;
+    const int cols;
+    vector<QueuedBind> binds;
+    std::atomic<QueuedStatement *> next;
+};
+
+/*
+ * Executes queued statements on the writer thread. Implementations
+ * use the database library directly and report errors as messages,
+ * without calling into the interpreter.
+ */
+class BatchWriter {
+public:
+    virtual ~BatchWriter() {}
+    virtual bool begin( string &error ) = 0;
+    virtual bool execute( const QueuedStatement &statement, string &error ) = 0;
+    virtual bool commit( string &error ) = 0;
+    virtual void rollback( void ) = 0;
+};
+
+/*
+ * Statements are pushed onto a lock-free multi-producer queue, and a
+ * background thread writes them in transactions of up to max_rows
+ * rows. The thread wakes up when max_rows rows are pending, or after
+ * max_delay_ms milliseconds. The thread holds db_lock while writing.
+ *
+ * If a transaction fails, it is rolled back and the error is kept
+ * until it is picked up by take_error().
+ */
+class WriteBehindQueue {
+public:
+    WriteBehindQueue( BatchWriter *writer_in, std::recursive_mutex &db_lock_in, long max_rows_in, long max_delay_ms_in );
+    ~WriteBehindQueue();
+    void enqueue( QueuedStatement *statement );
+    void flush( void );
+    string take_error( void );
+
+private:
+    void push( QueuedStatement *statement );
+    QueuedStatement *pop( void );
+    void run( void );
+    void write_pending( void );
+    void write_transaction( QueuedStatement *first );
+
+    BatchWriter *writer;
+    std::recursive_mutex &db_lock;
+    const long max_rows;
+    const long max_delay_ms;
+
+    std::atomic<QueuedStatement *> head;
+    QueuedStatement *tail;
+    QueuedStatement stub;
+    std::atomic<long> enqueued_rows;
+    std::atomic<long> written_rows;
+
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable written;
+    bool stopping;
+    bool flush_requested;
+    string error;
+
+    std::thread thread;
+};
+
+#endif
@@ -25,12 +25,18 @@
 
 #include <vector>
 #include <map>
+#include <mutex>
+#include <chrono>
 #include <typeinfo>
 
 #include <string.h>
 
 #include "Connection.hh"
 #include "Provider.hh"
+#include "ConnectionRegistry.hh"
+#include "QueryStats.hh"
+#include "ThreadPool.hh"
+#include "SyntheticProvider.hh"
 
 #ifdef HAVE_SQLITE3
 # include "SqliteResultValue.hh"
@@ -43,10 +49,9 @@
 # include "PostgresProvider.hh"
 #endif
 
-typedef vector<Connection *> DbConnectionVector;
-
 map<const string, Provider *> providers;
-DbConnectionVector connections;
+static std::once_flag providers_initialised;
+ConnectionRegistry connections;
 
 extern "C" {
     void *get_function_mux( const char *function_name );
@@ -73,6 +78,8 @@ static void init_provider_map( void )
 #  warning "The PostgreSQL library seems to be installed, but the header file(s) are missing"
 # endif
 #endif
+
+    add_provider( new SyntheticProvider() );
 }
 
 static Token list_functions( ostream &out )
@@ -86,22 +93,44 @@ static Token list_functions( ostream &out )
         << "FN[6] ref           - commit transaction" << endl
         << "FN[7] ref           - rollback transaction" << endl
         << "FN[8] ref           - list tables" << endl
-        << "ref FN[9] table     - list columns for table" << endl;
+        << "ref FN[9] table     - list columns for table" << endl
+        << "file FN[10,db] steps   - load SQLite database file into db" << endl
+        << "file FN[11,db] steps   - save SQLite database db to file" << endl
+        << "FN[12] ref          - serialize SQLite database to bytes" << endl
+        << "ref FN[13] bytes    - load SQLite database from bytes" << endl
+        << "names FN[14,db] n   - register APL function as SQL function" << endl
+        << "names FN[15,db] n   - register APL function as SQL aggregate" << endl
+        << "names FN[16,db] value  - create SQL table from APL value" << endl
+        << "ref FN[17] config   - configure result cache" << endl
+        << "FN[18] ref          - result cache statistics" << endl
+        << "FN[19] 0            - statement timing statistics" << endl
+        << "FN[20] 0            - reset statement timing statistics" << endl
+        << "FN[21] level        - set statistics level" << endl
+        << "ref FN[22] config   - configure slow query log" << endl
+        << "FN[23] ref          - read slow query log" << endl
+        << "stmt FN[24,ref] q   - prepare statement" << endl
+        << "h FN[25,ref] args   - execute prepared statement" << endl
+        << "ref FN[26] h        - describe prepared statement" << endl
+        << "ref FN[27] h        - finalize prepared statement" << endl
+        << "ref FN[28] config   - configure write-behind" << endl
+        << "FN[29] ref          - flush write-behind queue" << endl
+        << "stmt FN[30,ref] m   - select once per row of m" << endl
+        << "list FN[31,ref] 0   - run statements in one transaction" << endl
+        << "stmt FN[32,ref] m   - bulk load, returning rejected rows" << endl
+        << "ref FN[33] mode     - set date and time conversion" << endl
+        << "h FN[34,ref] types  - set result type hints of statement" << endl
+        << "ref FN[35] table    - show columns, indexes and size of table" << endl
+        << "ref FN[36] limits   - set time, row and byte limits" << endl
+        << "(q s) FN[37,ref] p  - query with null sentinels and mask" << endl
+        << "query FN[38,ref] p  - run query and keep result, returns handle" << endl
+        << "h FN[39,ref] range  - fetch rows and columns of kept result" << endl
+        << "ref FN[40] h        - row and column count of kept result" << endl
+        << "ref FN[41] h        - release kept result" << endl
+        << "(t c k) FN[42,ref] m - upsert rows of m into table t by keys k" << endl
+        << "file FN[43,ref] t   - import delimited file into table t" << endl;
     return Token(TOK_APL_VALUE1, Str0( LOC ) );
 }
 
-static int find_free_connection( void )
-{
-    for( int i = 0 ; i < static_cast<int>( connections.size() ) ; i++ ) {
-        if( connections[i] == NULL ) {
-            return i;
-        }
-    }
-
-    connections.push_back( NULL );
-    return connections.size() - 1;
-}
-
 static Token open_database( Value_P A, Value_P B )
 {
     if( !A->is_apl_char_vector() ) {
@@ -117,10 +146,15 @@ static Token open_database( Value_P A, Value_P B )
         VALUE_ERROR;
     }
 
-    int connection_index = find_free_connection();
-    connections[connection_index] = provider_iterator->second->open_database( B );
+    Connection *conn = provider_iterator->second->open_database( B );
+    long handle = connections.add( conn );
+    if( handle < 0 ) {
+        delete conn;
+        Workspace::more_error() = "Too many open database connections";
+        DOMAIN_ERROR;
+    }
 
-    return Token( TOK_APL_VALUE1, Value_P( new Value( IntCell( connection_index ), LOC ) ) );
+    return Token( TOK_APL_VALUE1, Value_P( new Value( IntCell( handle ), LOC ) ) );
 }
 
 static void throw_illegal_db_id( void )
@@ -129,26 +163,29 @@ static void throw_illegal_db_id( void )
     DOMAIN_ERROR;
 }
 
-static Connection *db_id_to_connection( int db_id )
+/*
+ * Unless exclusive is false, this waits for the write-behind queue of
+ * the connection to be written, and raises any error from it.
+ */
+static ConnectionRef db_id_to_connection( long db_id, bool exclusive = true )
 {
-   if( db_id < 0 || db_id >= (int)connections.size() ) {
-        throw_illegal_db_id();
-    }
-    Connection *conn = connections[db_id];
-    if( conn == NULL ) {
+    RegistrySlot *slot;
+    if( !connections.lookup( db_id, &slot ) ) {
         throw_illegal_db_id();
     }
 
-    return conn;
+    ConnectionRef ref( slot, exclusive );
+    ref->raise_write_behind_error();
+    return ref;
 }
 
-static Connection *value_to_db_id( APL_Float qct, Value_P value )
+static ConnectionRef value_to_db_id( APL_Float qct, Value_P value )
 {
     if( !value->is_int_scalar( qct ) ) {
         throw_illegal_db_id();
     }
 
-    int db_id = value->get_ravel( 0 ).get_int_value();
+    long db_id = value->get_ravel( 0 ).get_int_value();
     return db_id_to_connection( db_id );
  }
 
@@ -159,25 +196,38 @@ static Token close_database( APL_Float qct, Value_P B )
         DOMAIN_ERROR;
     }
 
-    int db_id = B->get_ravel( 0 ).get_int_value();
-    if( db_id < 0 || db_id >= (int)connections.size() ) {
-        throw_illegal_db_id();
-    }
-    Connection *conn = connections[db_id];
-    if( conn == NULL ) {
+    long db_id = B->get_ravel( 0 ).get_int_value();
+    if( !connections.remove( db_id ) ) {
         throw_illegal_db_id();
     }
 
-    connections[db_id] = NULL;
-    delete conn;
-
     return Token( TOK_APL_VALUE1, Str0( LOC ) );
 }
 
-static Value_P run_generic_one_query( ArgListBuilder *arg_list,
-                                      Value_P B, int start, int num_args,
-                                      bool ignore_result )
+/*
+ * ⎕TS style vectors and dates are only bound as dates and times when the
+ * connection returns them in a numeric format, so that in text mode they
+ * are rejected like other nested values. Returns false if value is not
+ * one of them.
+ */
+static bool bind_value_to_temporal( Value_P value, TemporalMode temporal_mode, int pos, TemporalValue &temporal )
+{
+    if( temporal_mode == TEMPORAL_TEXT || !timestamp_value_to_temporal( value, temporal ) ) {
+        return false;
+    }
+    if( !is_valid_temporal( temporal ) ) {
+        stringstream out;
+        out << "Date or time out of range in argument " << pos << " of arglist";
+        Workspace::more_error() = out.str().c_str();
+        DOMAIN_ERROR;
+    }
+    return true;
+}
+
+static void bind_args( ArgListBuilder *arg_list, Value_P B, int start, int num_args, TemporalMode temporal_mode )
 {
+    PhaseTimer timer( PHASE_BIND );
+    TemporalValue temporal;
     for( int i = 0 ; i < num_args ; i++ ) {
         const Cell &cell = B->get_ravel( start + i );
         if( cell.is_integer_cell() ) {
@@ -194,6 +244,9 @@ static Value_P run_generic_one_query( ArgListBuilder *arg_list,
             else if( value->is_char_string() ) {
                 arg_list->append_string( to_string( value->get_UCS_ravel() ), i );
             }
+            else if( bind_value_to_temporal( value, temporal_mode, i, temporal ) ) {
+                arg_list->append_timestamp( temporal, i );
+            }
             else {
                 stringstream out;
                 out << "Illegal data type in argument " << i << " of arglist";
@@ -202,31 +255,26 @@ static Value_P run_generic_one_query( ArgListBuilder *arg_list,
             }
         }
     }
+}
 
+static Value_P run_generic_one_query( ArgListBuilder *arg_list,
+                                      Value_P B, int start, int num_args,
+                                      bool ignore_result, TemporalMode temporal_mode )
+{
+    bind_args( arg_list, B, start, num_args, temporal_mode );
     return arg_list->run_query( ignore_result );
 }
 
-static Value_P run_generic( Connection *conn, Value_P A, Value_P B, bool query )
+/*
+ * Runs the statement once for a scalar or vector B, and once per row
+ * for a matrix B. Only the result of the last row is returned.
+ */
+static Value_P run_builder( ArgListBuilder *arg_list, Value_P B, TemporalMode temporal_mode )
 {
-    if( !A->is_char_string() ) {
-        Workspace::more_error() = "Illegal query argument type";
-        VALUE_ERROR;
-    }
-
-    string statement = conn->replace_bind_args( to_string( A->get_UCS_ravel() ) );
-    ArgListBuilder *builder;
-    if( query ) {
-        builder = conn->make_prepared_query( statement );
-    }
-    else {
-        builder = conn->make_prepared_update( statement );
-    }
-    auto_ptr<ArgListBuilder> arg_list( builder );
-
     const Shape &shape = B->get_shape();
     if( shape.get_rank() == 0 || shape.get_rank() == 1 ) {
         int num_args = shape.get_volume();
-        return run_generic_one_query( arg_list.get(), B, 0, num_args, false );
+        return run_generic_one_query( arg_list, B, 0, num_args, false, temporal_mode );
     }
     else if( shape.get_rank() == 2 ) {
         int rows = shape.get_rows();
@@ -239,7 +287,7 @@ static Value_P run_generic( Connection *conn, Value_P A, Value_P B, bool query )
             Value_P result;
             for( int row = 0 ; row < rows ; row++ ) {
                 bool not_last = row < rows - 1;
-                result = run_generic_one_query( arg_list.get(), B, row * cols, cols, not_last );
+                result = run_generic_one_query( arg_list, B, row * cols, cols, not_last, temporal_mode );
                 if( not_last ) {
                     arg_list->clear_args();
                 }
@@ -253,213 +301,1824 @@ static Value_P run_generic( Connection *conn, Value_P A, Value_P B, bool query )
     }
 }
 
-static Token run_query( Connection *conn, Value_P A, Value_P B )
+static Value_P run_generic_uncached( Connection *conn, const string &statement, Value_P B, bool query )
 {
-    return Token( TOK_APL_VALUE1, run_generic( conn, A, B, true ) );
+    ArgListBuilder *builder;
+    if( query ) {
+        builder = conn->make_prepared_query( statement );
+    }
+    else {
+        builder = conn->make_prepared_update( statement );
+    }
+    auto_ptr<ArgListBuilder> arg_list( builder );
+    return run_builder( arg_list.get(), B, conn->get_temporal_mode() );
 }
 
-static Token run_update( Connection *conn, Value_P A, Value_P B )
+static Value_P run_generic_cached( Connection *conn, const string &statement, Value_P B, bool query )
 {
-    return Token( TOK_APL_VALUE1, run_generic( conn, A, B, false ) );
-}
+    ResultCache *cache = conn->get_cache();
+    if( cache == NULL ) {
+        return run_generic_uncached( conn, statement, B, query );
+    }
 
-static Token run_transaction_begin( APL_Float qct, Value_P B )
-{
-    Connection *conn = value_to_db_id( qct, B );
-    conn->transaction_begin();
-    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
-}
+    if( !query ) {
+        // Updates may change anything, so drop all cached results
+        Value_P result = run_generic_uncached( conn, statement, B, query );
+        cache->clear();
+        return result;
+    }
 
-static Token run_transaction_commit( APL_Float qct, Value_P B )
-{
-    Connection *conn = value_to_db_id( qct, B );
-    conn->transaction_commit();
-    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
-}
+    conn->validate_cache();
+    string key = make_cache_key( statement, B );
+    Value_P cached = cache->lookup( key );
+    if( cached.get() != NULL ) {
+        return cached->clone( LOC );
+    }
 
-static Token run_transaction_rollback( APL_Float qct, Value_P B )
-{
-    Connection *conn = value_to_db_id( qct, B );
-    conn->transaction_rollback();
-    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+    // The caller may modify the result in place, so it never gets the
+    // value that is kept in the cache
+    Value_P result = run_generic_uncached( conn, statement, B, query );
+    cache->insert( key, result );
+    return result->clone( LOC );
 }
 
-static Token show_tables( APL_Float qct, Value_P B )
+/*
+ * True if the statement starts with SELECT. Other statements that
+ * return rows, such as INSERT ... RETURNING or WITH, may write to the
+ * database.
+ */
+static bool is_select_statement( const string &statement )
 {
-    Connection *conn = value_to_db_id( qct, B );
-    vector<string> tables;
-    conn->fill_tables( tables );
-
-    Value_P value;
-    if( tables.size() == 0 ) {
-        value = Idx0( LOC );
+    size_t i = statement.find_first_not_of( " \t\r\n(" );
+    if( i == string::npos ) {
+        return false;
     }
-    else {
-        Shape shape( tables.size () );
-        value = new Value( shape, LOC );
-        for( vector<string>::iterator i = tables.begin() ; i != tables.end() ; i++ ) {
-            new (value->next_ravel()) PointerCell( make_string_cell( *i, LOC ) );
+    for( const char *k = "select" ; *k != 0 ; k++, i++ ) {
+        if( i == statement.size() || tolower( static_cast<unsigned char>( statement[i] ) ) != *k ) {
+            return false;
         }
     }
-
-    value->check_value( LOC );
-    return Token( TOK_APL_VALUE1, value );
+    return i == statement.size() || !(isalnum( static_cast<unsigned char>( statement[i] ) ) || statement[i] == '_');
 }
 
-static Token show_cols( APL_Float qct, Value_P A, Value_P B )
+static string read_plan( Connection *conn, const string &sql, Value_P B )
 {
-    Connection *conn = value_to_db_id( qct, A );
-    vector<ColumnDescriptor> cols;
-
-    if( !B->is_apl_char_vector() ) {
-        Workspace::more_error() = "Illegal table name";
-        VALUE_ERROR;
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_query( sql ) );
+    int num_args = B->get_rank() == 2 ? B->get_cols() : B->element_count();
+    if( B->element_count() > 0 ) {
+        bind_args( arg_list.get(), B, 0, num_args, conn->get_temporal_mode() );
+    }
+    Value_P plan = arg_list->run_query( false );
+    if( plan->get_rank() != 2 ) {
+        return "";
     }
 
-    string name = to_string( B->get_UCS_ravel() );
-    conn->fill_cols( name, cols );
+    // The description is in the last column of each row
+    stringstream out;
+    int cols = plan->get_cols();
+    for( int row = 0 ; row < plan->get_rows() ; row++ ) {
+        Value_P line = plan->get_ravel( row * cols + cols - 1 ).to_value( LOC );
+        if( line->is_char_string() ) {
+            out << to_string( line->get_UCS_ravel() ) << endl;
+        }
+    }
+    return out.str();
+}
 
-    Value_P value;
-    if( cols.size() == 0 ) {
-        value = Idx0( LOC );
+/*
+ * Returns the plan of the statement, using the first row of bind
+ * parameters. Failing to get the plan must not make the statement
+ * itself fail, so errors are returned as the plan.
+ *
+ * EXPLAIN ANALYZE runs the statement again, so it is only used for
+ * SELECT, and the plan is always read in a transaction or savepoint
+ * that is rolled back. On Postgres, this also keeps a failed EXPLAIN
+ * from aborting the transaction of the caller.
+ */
+static string explain_statement( Connection *conn, const string &statement, Value_P B, bool query )
+{
+    string plan;
+    bool nested = false;
+    try {
+        conn->nested_begin();
+        nested = true;
+        plan = read_plan( conn, conn->make_explain_prefix( query && is_select_statement( statement ) ) + statement, B );
+    }
+    catch( ... ) {
+        plan = "Unable to get plan: " + to_string( Workspace::more_error() );
     }
-    else {
-        Shape shape( cols.size(), 2 );
-        value = new Value( shape, LOC );
-        for( vector<ColumnDescriptor>::iterator i = cols.begin() ; i != cols.end() ; i++ ) {
-            new (value->next_ravel()) PointerCell( make_string_cell( i->get_name(), LOC ) );
 
-            Value_P type;
-            if( i->get_type().size() == 0 ) {
-                type = Str0( LOC );
-            }
-            else {
-                type = make_string_cell( i->get_type(), LOC );
-            }
-            new (value->next_ravel()) PointerCell( type );
+    if( nested ) {
+        try {
+            conn->nested_rollback();
+        }
+        catch( ... ) {
+            // The plan has already been read
         }
     }
-
-    value->check_value( LOC );
-    return Token( TOK_APL_VALUE1, value );
+    return plan;
 }
 
-Fun_signature get_signature()
+/*
+ * Records the statistics for one statement, and adds it to the slow
+ * query log if it took long enough.
+ */
+class TimedStatement {
+public:
+    TimedStatement( Connection *conn_in, const string &sql_in, const string &statement_in, bool query_in );
+    void finish( Value_P B, Value_P result );
+    void set_query( bool query_in ) { query = query_in; }
+
+private:
+    Connection *conn;
+    const string &sql;
+    const string &statement;
+    bool query;
+    SlowQueryLog *slow_log;
+    StatementTiming timing;
+};
+
+TimedStatement::TimedStatement( Connection *conn_in, const string &sql_in, const string &statement_in, bool query_in )
+    : conn( conn_in ), sql( sql_in ), statement( statement_in ), query( query_in ),
+      slow_log( conn_in->get_slow_log() ), timing( sql_in, slow_log != NULL )
 {
-    init_provider_map();
-    return SIG_Z_A_F2_B;
+    if( slow_log != NULL ) {
+        conn->reset_statement_details();
+    }
 }
 
-bool close_fun( Cause cause, const NativeFunction *caller )
+void TimedStatement::finish( Value_P B, Value_P result )
 {
-    for( DbConnectionVector::iterator i = connections.begin() ; i != connections.end() ; i++ ) {
-        delete *i;
+    timing.finish( result );
+    if( slow_log == NULL || timing.get_total_ns() < slow_log->get_threshold_ms() * 1000000 ) {
+        return;
     }
 
-    connections.clear();
-
-    return false;
+    SlowQueryEntry entry;
+    entry.timestamp_ms = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+    entry.sql = sql;
+    entry.binds = describe_bind_args( B );
+    entry.rows = result->get_rank() == 2 ? result->get_rows() : 0;
+    entry.total_ns = timing.get_total_ns();
+    for( int i = 0 ; i < NUM_PHASES ; i++ ) {
+        entry.phase_ns[i] = timing.get_phase_ns( static_cast<QueryPhase>( i ) );
+    }
+    entry.details = conn->take_statement_details();
+    entry.plan = explain_statement( conn, statement, B, query );
+    slow_log->add( entry );
 }
 
-Token eval_B( Value_P B )
+static Value_P run_generic( Connection *conn, Value_P A, Value_P B, bool query )
 {
-    return list_functions( COUT );
+    if( !A->is_char_string() ) {
+        Workspace::more_error() = "Illegal query argument type";
+        VALUE_ERROR;
+    }
+
+    string sql = to_string( A->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    TimedStatement timed( conn, sql, statement, query );
+    Value_P result = run_generic_cached( conn, statement, B, query );
+    timed.finish( B, result );
+    return result;
 }
 
-Token eval_AB( Value_P A, Value_P B )
+static Token run_query( Connection *conn, Value_P A, Value_P B )
 {
-    return list_functions( COUT );
+    return Token( TOK_APL_VALUE1, run_generic( conn, A, B, true ) );
 }
 
-Token eval_XB(Value_P X, Value_P B)
+static void copy_bind_arg( Connection *conn, QueuedBind &bind, const Cell &cell, int pos )
 {
-    const APL_Float qct = Workspace::get_CT();
-    const int function_number = X->get_ravel( 0 ).get_near_int( qct );
-
-    switch( function_number ) {
-    case 0:
-        return list_functions( CERR );
-
-    case 2:
-        return close_database( qct, B );
+    if( cell.is_integer_cell() ) {
+        bind.type = QueuedBind::BIND_LONG;
+        bind.long_value = cell.get_int_value();
+    }
+    else if( cell.is_float_cell() ) {
+        bind.type = QueuedBind::BIND_DOUBLE;
+        bind.double_value = cell.get_real_value();
+    }
+    else {
+        Value_P value = cell.to_value( LOC );
+        TemporalValue temporal;
+        if( value->get_shape().get_volume() == 0 ) {
+            bind.type = QueuedBind::BIND_NULL;
+        }
+        else if( value->is_char_string() ) {
+            bind.type = QueuedBind::BIND_STRING;
+            bind.string_value = to_string( value->get_UCS_ravel() );
+        }
+        else if( bind_value_to_temporal( value, conn->get_temporal_mode(), pos, temporal ) ) {
+            bind.type = QueuedBind::BIND_STRING;
+            bind.string_value = conn->format_timestamp( temporal );
+        }
+        else {
+            stringstream out;
+            out << "Illegal data type in argument " << pos << " of arglist";
+            Workspace::more_error() = out.str().c_str();
+            VALUE_ERROR;
+        }
+    }
+}
 
-    case 5:
-        return run_transaction_begin( qct, B );
+static Token enqueue_update( Connection *conn, WriteBehindQueue *queue, Value_P A, Value_P B )
+{
+    if( !A->is_char_string() ) {
+        Workspace::more_error() = "Illegal query argument type";
+        VALUE_ERROR;
+    }
 
-    case 6:
-        return run_transaction_commit( qct, B );
+    string statement = conn->replace_bind_args( to_string( A->get_UCS_ravel() ) );
 
-    case 7:
-        return run_transaction_rollback( qct, B );
+    const Shape &shape = B->get_shape();
+    long rows;
+    int cols;
+    if( shape.get_rank() == 0 || shape.get_rank() == 1 ) {
+        rows = 1;
+        cols = shape.get_volume();
+    }
+    else if( shape.get_rank() == 2 ) {
+        rows = shape.get_rows();
+        cols = shape.get_cols();
+    }
+    else {
+        Workspace::more_error() = "Bind params have illegal rank";
+        RANK_ERROR;
+    }
 
-    case 8:
-        return show_tables( qct, B );
+    if( rows > 0 ) {
+        auto_ptr<QueuedStatement> queued( new QueuedStatement( statement, rows, cols ) );
+        for( long i = 0 ; i < rows * cols ; i++ ) {
+            copy_bind_arg( conn, queued->binds[i], B->get_ravel( i ), i % cols );
+        }
 
-    default:
-        Workspace::more_error() = "Illegal function number";
-        DOMAIN_ERROR;
+        if( conn->get_cache() != NULL ) {
+            conn->get_cache()->clear();
+        }
+        queue->enqueue( queued.release() );
     }
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
 }
 
-static Connection *param_to_db( APL_Float qct, Value_P X )
+/*
+ * Converts one null sentinel given by the user: a number, a character
+ * or an empty string.
+ */
+static NullSentinel cell_to_null_sentinel( const Cell &cell )
 {
-    const Shape &shape = X->get_shape();
-    if( shape.get_volume() != 2 ) {
-        Workspace::more_error() = "Database id missing from axis parameter";
-        RANK_ERROR;
+    if( cell.is_integer_cell() ) {
+        return NullSentinel( NullSentinel::SENTINEL_INT, cell.get_int_value(), 0 );
+    }
+    else if( cell.is_float_cell() ) {
+        return NullSentinel( NullSentinel::SENTINEL_FLOAT, 0, cell.get_real_value() );
+    }
+    else if( cell.is_character_cell() ) {
+        return NullSentinel( NullSentinel::SENTINEL_CHAR, cell.get_char_value(), 0 );
+    }
+    else if( cell.is_pointer_cell() && cell.to_value( LOC )->element_count() == 0 ) {
+        return NullSentinel( NullSentinel::SENTINEL_EMPTY_STRING, 0, 0 );
     }
-    return db_id_to_connection( X->get_ravel( 1 ).get_near_int( qct ) );
+
+    Workspace::more_error() = "Null sentinels must be numbers, characters or empty strings";
+    DOMAIN_ERROR;
 }
 
-Token eval_AXB(const Value_P A, const Value_P X, const Value_P B)
+/*
+ * Runs a query with nulls replaced by sentinel values, one per column
+ * or a single value for all columns. Returns the result and a mask
+ * with 1 for each null.
+ */
+static Token run_query_with_sentinels( Connection *conn, Value_P A, Value_P B )
 {
-    const APL_Float qct = Workspace::get_CT();
-    const int function_number = X->get_ravel( 0 ).get_near_int( qct );
-
-    switch( function_number ) {
-    case 0:
-        return list_functions( CERR );
-
-    case 1:
-        return open_database( A, B );
-
-    case 3:
-        return run_query( param_to_db( qct, X ), A, B );
-
-    case 4:
-        return run_update( param_to_db( qct, X ), A, B );
-
-    case 9:
-        return show_cols( qct, A, B );
-
-    default:
-        Workspace::more_error() = "Illegal function number";
+    if( A->get_rank() != 1 || A->element_count() != 2 ) {
+        Workspace::more_error() = "Argument must be a query and the null sentinels";
         DOMAIN_ERROR;
     }
-}
+    Value_P sql_value = A->get_ravel( 0 ).to_value( LOC );
+    if( !sql_value->is_char_string() ) {
+        Workspace::more_error() = "Illegal query argument type";
+        VALUE_ERROR;
+    }
 
-void *get_function_mux( const char *function_name )
-{
-    if( strcmp( function_name, "get_signature" ) == 0 ) return (void *)&get_signature;
-    if( strcmp( function_name, "eval_B" ) == 0 )        return (void *)&eval_B;
-    if( strcmp( function_name, "eval_AB" ) == 0 )       return (void *)&eval_AB;
-    if( strcmp( function_name, "eval_XB" ) == 0 )       return (void *)&eval_XB;
-    if( strcmp( function_name, "eval_AXB" ) == 0 )      return (void *)&eval_AXB;
-    if( strcmp( function_name, "close_fun" ) == 0 )     return (void *)&close_fun;
-    return 0;
-}
+    vector<NullSentinel> sentinel_list;
+    const Cell &sentinel_cell = A->get_ravel( 1 );
+    Value_P sentinel_value = sentinel_cell.is_pointer_cell() ? sentinel_cell.to_value( LOC ) : Value_P();
+    if( sentinel_value.get() != NULL && sentinel_value->element_count() > 0 ) {
+        for( int i = 0 ; i < sentinel_value->element_count() ; i++ ) {
+            sentinel_list.push_back( cell_to_null_sentinel( sentinel_value->get_ravel( i ) ) );
+        }
+    }
+    else {
+        sentinel_list.push_back( cell_to_null_sentinel( sentinel_cell ) );
+    }
+    NullSentinels sentinels( sentinel_list );
+
+    string sql = to_string( sql_value->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    TimedStatement timed( conn, sql, statement, true );
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_query( statement ) );
+    arg_list->set_null_sentinels( &sentinels );
+    Value_P result = run_builder( arg_list.get(), B, conn->get_temporal_mode() );
+    Value_P mask = sentinels.get_mask();
+    if( mask.get() == NULL ) {
+        mask = Idx0( LOC );
+    }
 
-static const UCS_string ucs_string_from_string( const std::string &string )
-{
-    size_t length = string.size();
-    const char *buf = string.c_str();
-    UTF8_string utf( (const UTF8 *)buf, length );
-    return UCS_string( utf );
+    Value_P value( new Value( Shape( 2 ), LOC ) );
+    new (value->next_ravel()) PointerCell( result );
+    new (value->next_ravel()) PointerCell( mask );
+    value->check_value( LOC );
+    timed.finish( B, result );
+    return Token( TOK_APL_VALUE1, value );
 }
 
-Value_P make_string_cell( const std::string &string, const char *loc )
+/*
+ * Runs a query once for each row of B, and returns the result rows of
+ * all of them in one matrix. The first column is the index of the row
+ * in B which gave the result row.
+ */
+static Token run_batch_query( Connection *conn, Value_P A, Value_P B )
 {
-    UCS_string s = ucs_string_from_string( string );
+    if( !A->is_char_string() ) {
+        Workspace::more_error() = "Illegal query argument type";
+        VALUE_ERROR;
+    }
+
+    const Shape &shape = B->get_shape();
+    int rows;
+    int cols;
+    if( shape.get_rank() == 0 || shape.get_rank() == 1 ) {
+        rows = 1;
+        cols = shape.get_volume();
+    }
+    else if( shape.get_rank() == 2 ) {
+        rows = shape.get_rows();
+        cols = shape.get_cols();
+    }
+    else {
+        Workspace::more_error() = "Bind params have illegal rank";
+        RANK_ERROR;
+    }
+
+    string sql = to_string( A->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    TimedStatement timed( conn, sql, statement, true );
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_query( statement ) );
+    arg_list->make_persistent();
+
+    vector<Value_P> results;
+    results.reserve( rows );
+    long result_rows = 0;
+    int result_cols = 0;
+    for( int row = 0 ; row < rows ; row++ ) {
+        Value_P result = run_generic_one_query( arg_list.get(), B, row * cols, cols, false, conn->get_temporal_mode() );
+        arg_list->clear_args();
+        if( result->get_rank() == 2 ) {
+            result_rows += result->get_rows();
+            result_cols = result->get_cols();
+        }
+        results.push_back( result );
+    }
+
+    Value_P value;
+    if( result_rows == 0 ) {
+        value = Idx0( LOC );
+    }
+    else {
+        // Cells are copied from the per-row results into a result
+        // allocated once with the final size
+        const APL_Integer qio = Workspace::get_IO();
+        value = new Value( Shape( result_rows, result_cols + 1 ), LOC );
+        for( int row = 0 ; row < rows ; row++ ) {
+            Value_P result = results[row];
+            if( result->get_rank() != 2 ) {
+                continue;
+            }
+            long n = result->get_rows();
+            for( long i = 0 ; i < n ; i++ ) {
+                new (value->next_ravel()) IntCell( row + qio );
+                for( int col = 0 ; col < result_cols ; col++ ) {
+                    value->next_ravel()->init( result->get_ravel( i * result_cols + col ), *value.get(), LOC );
+                }
+            }
+        }
+        value->check_value( LOC );
+    }
+
+    timed.finish( B, value );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static void run_simple_statement( Connection *conn, const string &sql )
+{
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_update( sql ) );
+    arg_list->run_query( true );
+}
+
+/*
+ * Runs one row of a bulk load. Returns false, after storing the
+ * error message, if the row failed in the database. Interrupts and
+ * statement limits are not row errors, so they are raised.
+ */
+static bool run_bulk_row( Connection *conn, ArgListBuilder *arg_list, Value_P B, int row, int cols,
+                          bool use_savepoint, string &error )
+{
+    if( use_savepoint ) {
+        run_simple_statement( conn, "savepoint apl_bulk_row" );
+    }
+    try {
+        run_generic_one_query( arg_list, B, row * cols, cols, true, conn->get_temporal_mode() );
+        arg_list->clear_args();
+    }
+    catch( ... ) {
+        arg_list->clear_args();
+        if( conn->was_statement_stopped() ) {
+            throw;
+        }
+        error = to_string( Workspace::more_error() );
+        if( use_savepoint ) {
+            run_simple_statement( conn, "rollback to savepoint apl_bulk_row" );
+            run_simple_statement( conn, "release savepoint apl_bulk_row" );
+        }
+        return false;
+    }
+    if( use_savepoint ) {
+        run_simple_statement( conn, "release savepoint apl_bulk_row" );
+    }
+    return true;
+}
+
+/*
+ * Runs the statement for each row of B in one transaction, with a
+ * savepoint around each chunk of rows. When a row in a chunk fails, the
+ * chunk is rolled back and retried one row at a time, so that only the
+ * failing rows are skipped. Returns a matrix of the indices of the
+ * rejected rows and their error messages.
+ */
+static Token run_bulk_load( Connection *conn, Value_P A, Value_P B )
+{
+    Value_P sql_value = A;
+    int chunk_size = 1000;
+    if( !A->is_char_string() ) {
+        if( A->get_rank() != 1 || A->element_count() != 2 || !A->get_ravel( 1 ).is_integer_cell() ) {
+            Workspace::more_error() = "Bulk load argument must be a statement, or a statement and a chunk size";
+            DOMAIN_ERROR;
+        }
+        sql_value = A->get_ravel( 0 ).to_value( LOC );
+        chunk_size = A->get_ravel( 1 ).get_int_value();
+        if( !sql_value->is_char_string() || chunk_size < 1 ) {
+            Workspace::more_error() = "Illegal statement or chunk size for bulk load";
+            DOMAIN_ERROR;
+        }
+    }
+    if( B->get_rank() != 2 ) {
+        Workspace::more_error() = "Bulk load parameters must be a matrix";
+        RANK_ERROR;
+    }
+
+    string sql = to_string( sql_value->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    int rows = B->get_rows();
+    int cols = B->get_cols();
+
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+
+    TimedStatement timed( conn, sql, statement, false );
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_update( statement ) );
+    vector<pair<int, string> > rejected;
+    conn->nested_begin();
+    try {
+        for( int start = 0 ; start < rows ; start += chunk_size ) {
+            int end = min( start + chunk_size, rows );
+            run_simple_statement( conn, "savepoint apl_bulk_chunk" );
+
+            string error;
+            int row = start;
+            while( row < end && run_bulk_row( conn, arg_list.get(), B, row, cols, false, error ) ) {
+                row++;
+            }
+
+            if( row < end ) {
+                run_simple_statement( conn, "rollback to savepoint apl_bulk_chunk" );
+                for( row = start ; row < end ; row++ ) {
+                    if( !run_bulk_row( conn, arg_list.get(), B, row, cols, true, error ) ) {
+                        rejected.push_back( pair<int, string>( row, error ) );
+                    }
+                }
+            }
+            run_simple_statement( conn, "release savepoint apl_bulk_chunk" );
+        }
+    }
+    catch( ... ) {
+        try {
+            conn->nested_rollback();
+        }
+        catch( ... ) {
+            // The original error is more interesting
+        }
+        throw;
+    }
+    conn->nested_commit();
+
+    Value_P value;
+    if( rejected.size() == 0 ) {
+        value = Idx0( LOC );
+    }
+    else {
+        const APL_Integer qio = Workspace::get_IO();
+        value = new Value( Shape( rejected.size(), 2 ), LOC );
+        for( vector<pair<int, string> >::iterator i = rejected.begin() ; i != rejected.end() ; i++ ) {
+            new (value->next_ravel()) IntCell( i->first + qio );
+            new (value->next_ravel()) PointerCell( make_string_cell( i->second, LOC ) );
+        }
+        value->check_value( LOC );
+    }
+
+    timed.finish( B, value );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+/*
+ * A single name, or a vector of names
+ */
+static void value_to_names( Value_P value, vector<string> &names, const char *message )
+{
+    if( value->is_char_string() ) {
+        names.push_back( to_string( value->get_UCS_ravel() ) );
+        return;
+    }
+    for( int i = 0 ; i < value->element_count() ; i++ ) {
+        Value_P name = value->get_ravel( i ).to_value( LOC );
+        if( !name->is_char_string() ) {
+            Workspace::more_error() = message;
+            DOMAIN_ERROR;
+        }
+        names.push_back( to_string( name->get_UCS_ravel() ) );
+    }
+}
+
+/*
+ * Inserts the rows of B into a table, updating the rows that already
+ * exist with the same key. A is the table name, the names of the
+ * columns of B and the names of the key columns. Returns the number of
+ * rows that were inserted and updated.
+ */
+static Token run_upsert( Connection *conn, Value_P A, Value_P B )
+{
+    if( A->get_rank() != 1 || A->element_count() != 3 ) {
+        Workspace::more_error() = "Upsert argument must be a table name, column names and key column names";
+        LENGTH_ERROR;
+    }
+    Value_P table = A->get_ravel( 0 ).to_value( LOC );
+    if( !table->is_char_string() ) {
+        Workspace::more_error() = "Table name must be a string";
+        DOMAIN_ERROR;
+    }
+
+    UpsertSpec spec;
+    spec.table = to_string( table->get_UCS_ravel() );
+    value_to_names( A->get_ravel( 1 ).to_value( LOC ), spec.columns, "Column names must be strings" );
+    value_to_names( A->get_ravel( 2 ).to_value( LOC ), spec.keys, "Key column names must be strings" );
+    if( spec.columns.size() == 0 || spec.keys.size() == 0 ) {
+        Workspace::more_error() = "Upsert needs at least one column and one key column";
+        DOMAIN_ERROR;
+    }
+    for( vector<string>::iterator i = spec.keys.begin() ; i != spec.keys.end() ; i++ ) {
+        if( find( spec.columns.begin(), spec.columns.end(), *i ) == spec.columns.end() ) {
+            stringstream out;
+            out << "Key column is not one of the columns: " << *i;
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+    }
+
+    if( B->get_rank() != 2 ) {
+        Workspace::more_error() = "Upsert rows must be a matrix";
+        RANK_ERROR;
+    }
+    int cols = B->get_cols();
+    if( cols != spec.columns.size() ) {
+        Workspace::more_error() = "Upsert rows must have one column per column name";
+        LENGTH_ERROR;
+    }
+
+    // The values are copied first, so that the database library can
+    // work on them without touching APL values
+    vector<QueuedBind> binds( B->element_count() );
+    for( long i = 0 ; i < binds.size() ; i++ ) {
+        copy_bind_arg( conn, binds[i], B->get_ravel( i ), i % cols );
+    }
+
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+
+    long inserted = 0;
+    long updated = 0;
+    if( binds.size() > 0 ) {
+        conn->nested_begin();
+        try {
+            conn->upsert_rows( spec, binds, &inserted, &updated );
+        }
+        catch( ... ) {
+            try {
+                conn->nested_rollback();
+            }
+            catch( ... ) {
+                // The original error is more interesting
+            }
+            throw;
+        }
+        conn->nested_commit();
+    }
+
+    Value_P value( new Value( Shape( 2 ), LOC ) );
+    new (value->next_ravel()) IntCell( inserted );
+    new (value->next_ravel()) IntCell( updated );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static string import_option_to_string( const Cell &cell )
+{
+    if( cell.is_integer_cell() ) {
+        stringstream out;
+        out << cell.get_int_value();
+        return out.str();
+    }
+
+    Value_P value = cell.to_value( LOC );
+    if( value->element_count() == 0 ) {
+        return "";
+    }
+    if( !value->is_char_string() ) {
+        Workspace::more_error() = "Import options must be strings or integers";
+        DOMAIN_ERROR;
+    }
+    return to_string( value->get_UCS_ravel() );
+}
+
+/*
+ * Imports a delimited file into the table B. A is the file name, or the
+ * file name and a two-column key/value matrix of options. The file is
+ * read by the database layer, so the data never becomes APL values.
+ * Returns the number of rows written and a matrix of the rejected line
+ * numbers and their errors.
+ */
+static Token run_import( Connection *conn, Value_P A, Value_P B )
+{
+    Value_P filename = A;
+    CsvImportOptions options;
+    if( !A->is_char_string() ) {
+        if( A->get_rank() != 1 || A->element_count() != 2 ) {
+            Workspace::more_error() = "Import argument must be a file name, or a file name and options";
+            DOMAIN_ERROR;
+        }
+        filename = A->get_ravel( 0 ).to_value( LOC );
+        Value_P config = A->get_ravel( 1 ).to_value( LOC );
+        const Shape &shape = config->get_shape();
+        if( shape.get_rank() != 2 || shape.get_cols() != 2 ) {
+            Workspace::more_error() = "Import options must be a two-column key/value matrix";
+            RANK_ERROR;
+        }
+        for( int row = 0 ; row < shape.get_rows() ; row++ ) {
+            options.set( import_option_to_string( config->get_ravel( row * 2 ) ),
+                         import_option_to_string( config->get_ravel( row * 2 + 1 ) ) );
+        }
+    }
+    if( !filename->is_char_string() ) {
+        Workspace::more_error() = "File name must be a string";
+        DOMAIN_ERROR;
+    }
+    if( !B->is_char_string() ) {
+        Workspace::more_error() = "Table name must be a string";
+        DOMAIN_ERROR;
+    }
+
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+
+    vector<pair<long, string> > rejected;
+    long written = import_csv_file( conn, to_string( filename->get_UCS_ravel() ), to_string( B->get_UCS_ravel() ),
+                                    options, rejected );
+
+    Value_P rejected_value;
+    if( rejected.size() == 0 ) {
+        rejected_value = Idx0( LOC );
+    }
+    else {
+        rejected_value = new Value( Shape( rejected.size(), 2 ), LOC );
+        for( vector<pair<long, string> >::iterator i = rejected.begin() ; i != rejected.end() ; i++ ) {
+            new (rejected_value->next_ravel()) IntCell( i->first );
+            new (rejected_value->next_ravel()) PointerCell( make_string_cell( i->second, LOC ) );
+        }
+        rejected_value->check_value( LOC );
+    }
+
+    Value_P value( new Value( Shape( 2 ), LOC ) );
+    new (value->next_ravel()) IntCell( written );
+    new (value->next_ravel()) PointerCell( rejected_value );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token run_update( Connection *conn, Value_P A, Value_P B )
+{
+    WriteBehindQueue *queue = conn->get_write_behind();
+    if( queue != NULL ) {
+        return enqueue_update( conn, queue, A, B );
+    }
+    return Token( TOK_APL_VALUE1, run_generic( conn, A, B, false ) );
+}
+
+/*
+ * Each element of A is a statement, or a statement followed by its
+ * bind parameters. A can also be a single string containing several
+ * statements.
+ */
+static void parse_statement_batch( Connection *conn, Value_P A, vector<string> &statements, vector<Value_P> &params )
+{
+    if( A->is_char_string() ) {
+        conn->split_script( to_string( A->get_UCS_ravel() ), statements );
+        params.resize( statements.size(), Idx0( LOC ) );
+        return;
+    }
+
+    if( A->get_rank() > 1 ) {
+        Workspace::more_error() = "Statement batch must be a vector";
+        RANK_ERROR;
+    }
+
+    for( int i = 0 ; i < A->element_count() ; i++ ) {
+        Value_P item = A->get_ravel( i ).to_value( LOC );
+        Value_P sql = item;
+        Value_P args = Idx0( LOC );
+        if( !item->is_char_string() ) {
+            if( item->get_rank() != 1 || item->element_count() != 2 ) {
+                Workspace::more_error() = "Statement batch elements must be a statement, or a statement and its parameters";
+                DOMAIN_ERROR;
+            }
+            sql = item->get_ravel( 0 ).to_value( LOC );
+            args = item->get_ravel( 1 ).to_value( LOC );
+        }
+        if( !sql->is_char_string() ) {
+            Workspace::more_error() = "Illegal statement in batch";
+            DOMAIN_ERROR;
+        }
+        statements.push_back( conn->replace_bind_args( to_string( sql->get_UCS_ravel() ) ) );
+        params.push_back( args );
+    }
+}
+
+/*
+ * True if the prepared statement returns rows. Only the slow query log
+ * needs to know, so the statement is not described otherwise.
+ */
+static bool statement_returns_rows( Connection *conn, ArgListBuilder *arg_list )
+{
+    if( conn->get_slow_log() == NULL ) {
+        return false;
+    }
+    vector<ColumnDescriptor> cols;
+    arg_list->describe_columns( cols );
+    return cols.size() > 0;
+}
+
+/*
+ * Runs all statements in A in one transaction, and returns a vector of
+ * their results. If any statement fails, the transaction is rolled
+ * back and the error names the statement. Inside a transaction that is
+ * already open, a savepoint is used instead.
+ */
+static Token run_statement_batch( Connection *conn, Value_P A )
+{
+    vector<string> statements;
+    vector<Value_P> params;
+    parse_statement_batch( conn, A, statements, params );
+    if( statements.size() == 0 ) {
+        return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+    }
+
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+
+    Value_P value( new Value( Shape( statements.size() ), LOC ) );
+    conn->nested_begin();
+    size_t i = 0;
+    try {
+        for( ; i < statements.size() ; i++ ) {
+            TimedStatement timed( conn, statements[i], statements[i], false );
+            auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_query( statements[i] ) );
+            timed.set_query( statement_returns_rows( conn, arg_list.get() ) );
+            Value_P result = run_builder( arg_list.get(), params[i], conn->get_temporal_mode() );
+            timed.finish( params[i], result );
+            new (value->next_ravel()) PointerCell( result );
+        }
+    }
+    catch( ... ) {
+        stringstream out;
+        out << "Statement " << (i + Workspace::get_IO()) << " of batch failed, transaction rolled back: "
+            << to_string( Workspace::more_error() );
+        try {
+            conn->nested_rollback();
+        }
+        catch( ... ) {
+            // The original error is more interesting
+        }
+        Workspace::more_error() = out.str().c_str();
+        throw;
+    }
+    conn->nested_commit();
+
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token run_transaction_begin( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    conn->transaction_begin();
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+/*
+ * Results cached inside the transaction may show changes that are
+ * rolled back, so the cache is cleared when the transaction ends.
+ */
+static Token run_transaction_commit( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+    conn->transaction_commit();
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token run_transaction_rollback( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+    conn->transaction_rollback();
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token show_tables( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    const vector<string> &tables = conn->get_tables();
+
+    Value_P value;
+    if( tables.size() == 0 ) {
+        value = Idx0( LOC );
+    }
+    else {
+        Shape shape( tables.size () );
+        value = new Value( shape, LOC );
+        for( vector<string>::const_iterator i = tables.begin() ; i != tables.end() ; i++ ) {
+            new (value->next_ravel()) PointerCell( make_string_cell( *i, LOC ) );
+        }
+    }
+
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Value_P make_columns_value( vector<ColumnDescriptor> &cols )
+{
+    Value_P value;
+    if( cols.size() == 0 ) {
+        value = Idx0( LOC );
+    }
+    else {
+        Shape shape( cols.size(), 2 );
+        value = new Value( shape, LOC );
+        for( vector<ColumnDescriptor>::iterator i = cols.begin() ; i != cols.end() ; i++ ) {
+            new (value->next_ravel()) PointerCell( make_string_cell( i->get_name(), LOC ) );
+
+            Value_P type;
+            if( i->get_type().size() == 0 ) {
+                type = Str0( LOC );
+            }
+            else {
+                type = make_string_cell( i->get_type(), LOC );
+            }
+            new (value->next_ravel()) PointerCell( type );
+        }
+    }
+
+    value->check_value( LOC );
+    return value;
+}
+
+static Token show_cols( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    vector<ColumnDescriptor> cols;
+
+    if( !B->is_apl_char_vector() ) {
+        Workspace::more_error() = "Illegal table name";
+        VALUE_ERROR;
+    }
+
+    string name = to_string( B->get_UCS_ravel() );
+    const TableInfo &info = conn->get_table_info( name );
+    for( vector<ColumnInfo>::const_iterator i = info.columns.begin() ; i != info.columns.end() ; i++ ) {
+        cols.push_back( ColumnDescriptor( i->name, i->type ) );
+    }
+    return Token( TOK_APL_VALUE1, make_columns_value( cols ) );
+}
+
+static Value_P make_string_or_empty( const string &s )
+{
+    return s.size() == 0 ? Str0( LOC ) : make_string_cell( s, LOC );
+}
+
+/*
+ * Returns the columns, indexes and estimated number of rows of a
+ * table. Columns are name, type, nullable and position in the primary
+ * key. Indexes are name, unique and a vector of column names.
+ */
+static Token show_table_info( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    if( !B->is_apl_char_vector() ) {
+        Workspace::more_error() = "Illegal table name";
+        VALUE_ERROR;
+    }
+
+    const TableInfo &info = conn->get_table_info( to_string( B->get_UCS_ravel() ) );
+
+    Value_P columns;
+    if( info.columns.size() == 0 ) {
+        columns = Idx0( LOC );
+    }
+    else {
+        columns = new Value( Shape( info.columns.size(), 4 ), LOC );
+        for( vector<ColumnInfo>::const_iterator i = info.columns.begin() ; i != info.columns.end() ; i++ ) {
+            new (columns->next_ravel()) PointerCell( make_string_cell( i->name, LOC ) );
+            new (columns->next_ravel()) PointerCell( make_string_or_empty( i->type ) );
+            new (columns->next_ravel()) IntCell( i->nullable ? 1 : 0 );
+            new (columns->next_ravel()) IntCell( i->primary_key_position );
+        }
+        columns->check_value( LOC );
+    }
+
+    Value_P indexes;
+    if( info.indexes.size() == 0 ) {
+        indexes = Idx0( LOC );
+    }
+    else {
+        indexes = new Value( Shape( info.indexes.size(), 3 ), LOC );
+        for( vector<IndexInfo>::const_iterator i = info.indexes.begin() ; i != info.indexes.end() ; i++ ) {
+            new (indexes->next_ravel()) PointerCell( make_string_cell( i->name, LOC ) );
+            new (indexes->next_ravel()) IntCell( i->unique ? 1 : 0 );
+
+            Value_P index_columns;
+            if( i->columns.size() == 0 ) {
+                index_columns = Idx0( LOC );
+            }
+            else {
+                index_columns = new Value( Shape( i->columns.size() ), LOC );
+                for( vector<string>::const_iterator col = i->columns.begin() ; col != i->columns.end() ; col++ ) {
+                    new (index_columns->next_ravel()) PointerCell( make_string_or_empty( *col ) );
+                }
+                index_columns->check_value( LOC );
+            }
+            new (indexes->next_ravel()) PointerCell( index_columns );
+        }
+        indexes->check_value( LOC );
+    }
+
+    Value_P value( new Value( Shape( 3 ), LOC ) );
+    new (value->next_ravel()) PointerCell( columns );
+    new (value->next_ravel()) PointerCell( indexes );
+    new (value->next_ravel()) IntCell( info.row_estimate );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token configure_cache( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+
+    // The config is either the maximum number of bytes, or a vector of
+    // the maximum number of bytes, TTL in milliseconds and an optional
+    // notification channel
+    long max_bytes = 0;
+    long ttl_ms = 0;
+    string channel;
+    int n = B->element_count();
+    if( n < 1 || n > 3 || B->get_rank() > 1 ) {
+        Workspace::more_error() = "Cache config must be max bytes, TTL and notification channel";
+        LENGTH_ERROR;
+    }
+    if( !B->get_ravel( 0 ).is_integer_cell() || (n >= 2 && !B->get_ravel( 1 ).is_integer_cell()) ) {
+        Workspace::more_error() = "Cache size and TTL must be integers";
+        DOMAIN_ERROR;
+    }
+    max_bytes = B->get_ravel( 0 ).get_int_value();
+    if( n >= 2 ) {
+        ttl_ms = B->get_ravel( 1 ).get_int_value();
+    }
+    if( n == 3 ) {
+        Value_P channel_value = B->get_ravel( 2 ).to_value( LOC );
+        if( !channel_value->is_char_string() ) {
+            Workspace::more_error() = "Notification channel must be a string";
+            DOMAIN_ERROR;
+        }
+        channel = to_string( channel_value->get_UCS_ravel() );
+    }
+
+    if( max_bytes <= 0 ) {
+        conn->disable_cache();
+    }
+    else {
+        conn->enable_cache( max_bytes, ttl_ms, channel );
+    }
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token show_query_stats( void )
+{
+    return Token( TOK_APL_VALUE1, make_query_stats_value() );
+}
+
+static Token run_reset_query_stats( void )
+{
+    reset_query_stats();
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token run_set_stats_level( APL_Float qct, Value_P B )
+{
+    if( !B->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Statistics level must be an integer";
+        DOMAIN_ERROR;
+    }
+    int level = B->get_ravel( 0 ).get_int_value();
+    if( level < STATS_LEVEL_OFF || level > STATS_LEVEL_STRINGS ) {
+        Workspace::more_error() = "Statistics level must be 0, 1 or 2";
+        DOMAIN_ERROR;
+    }
+    set_stats_level( level );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token configure_slow_log( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+
+    // The config is the threshold in milliseconds, optionally followed by
+    // the number of entries to keep in memory and a log file name
+    int n = B->element_count();
+    if( n < 1 || n > 3 || B->get_rank() > 1 ) {
+        Workspace::more_error() = "Slow query log config must be threshold, capacity and file name";
+        LENGTH_ERROR;
+    }
+    if( !B->get_ravel( 0 ).is_integer_cell() || (n >= 2 && !B->get_ravel( 1 ).is_integer_cell()) ) {
+        Workspace::more_error() = "Slow query threshold and capacity must be integers";
+        DOMAIN_ERROR;
+    }
+
+    long threshold_ms = B->get_ravel( 0 ).get_int_value();
+    int capacity = n >= 2 ? B->get_ravel( 1 ).get_int_value() : 100;
+    string filename;
+    if( n == 3 ) {
+        Value_P filename_value = B->get_ravel( 2 ).to_value( LOC );
+        if( !filename_value->is_char_string() ) {
+            Workspace::more_error() = "Slow query log file name must be a string";
+            DOMAIN_ERROR;
+        }
+        filename = to_string( filename_value->get_UCS_ravel() );
+    }
+
+    if( threshold_ms < 0 ) {
+        conn->disable_slow_log();
+    }
+    else {
+        conn->enable_slow_log( threshold_ms, capacity, filename );
+    }
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+/*
+ * Sets the limits for each statement on the connection, and returns the
+ * previous limits so that they can be restored.
+ */
+static Token configure_limits( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+
+    int n = B->element_count();
+    if( n < 1 || n > 3 || B->get_rank() > 1 ) {
+        Workspace::more_error() = "Limits must be time in milliseconds, rows and bytes";
+        LENGTH_ERROR;
+    }
+    long values[3] = { 0, 0, 0 };
+    for( int i = 0 ; i < n ; i++ ) {
+        if( !B->get_ravel( i ).is_integer_cell() || B->get_ravel( i ).get_int_value() < 0 ) {
+            Workspace::more_error() = "Limits must be non-negative integers";
+            DOMAIN_ERROR;
+        }
+        values[i] = B->get_ravel( i ).get_int_value();
+    }
+
+    QueryLimits old_limits = conn->get_limits();
+    QueryLimits limits;
+    limits.max_time_ms = values[0];
+    limits.max_rows = values[1];
+    limits.max_bytes = values[2];
+    conn->set_limits( limits );
+
+    Value_P value( new Value( Shape( 3 ), LOC ) );
+    new (value->next_ravel()) IntCell( old_limits.max_time_ms );
+    new (value->next_ravel()) IntCell( old_limits.max_rows );
+    new (value->next_ravel()) IntCell( old_limits.max_bytes );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token configure_temporal_mode( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    if( !B->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Date and time mode must be an integer";
+        DOMAIN_ERROR;
+    }
+
+    int mode = B->get_ravel( 0 ).get_int_value();
+    if( mode != TEMPORAL_TEXT && mode != TEMPORAL_EPOCH_MS && mode != TEMPORAL_TIMESTAMP ) {
+        Workspace::more_error() = "Date and time mode must be 0 (text), 1 (epoch milliseconds) or 2 (timestamp vector)";
+        DOMAIN_ERROR;
+    }
+
+    // Cached results were converted using the old mode
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+    conn->set_temporal_mode( static_cast<TemporalMode>( mode ) );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token show_slow_log( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    SlowQueryLog *slow_log = conn->get_slow_log();
+    if( slow_log == NULL ) {
+        Workspace::more_error() = "Slow query log is not enabled for this connection";
+        DOMAIN_ERROR;
+    }
+    return Token( TOK_APL_VALUE1, slow_log->make_log_value() );
+}
+
+static long value_to_statement_handle( APL_Float qct, Value_P value )
+{
+    if( !value->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Prepared statement handle must be an integer scalar";
+        DOMAIN_ERROR;
+    }
+    return value->get_ravel( 0 ).get_int_value();
+}
+
+static Token run_prepare( APL_Float qct, Connection *conn, Value_P A, Value_P B )
+{
+    if( !A->is_apl_char_vector() ) {
+        Workspace::more_error() = "Statement must be a string";
+        DOMAIN_ERROR;
+    }
+    if( !B->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Statement kind must be 1 for select statements or 0 for other statements";
+        DOMAIN_ERROR;
+    }
+
+    string sql = to_string( A->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    bool query = B->get_ravel( 0 ).get_int_value() != 0;
+
+    auto_ptr<ArgListBuilder> arg_list( query ? conn->make_prepared_query( statement )
+                                             : conn->make_prepared_update( statement ) );
+    arg_list->make_persistent();
+    long handle = conn->add_prepared_statement( new PreparedStatement( sql, statement, arg_list.release(), query ) );
+    return Token( TOK_APL_VALUE1, Value_P( new Value( IntCell( handle ), LOC ) ) );
+}
+
+static Token run_execute( APL_Float qct, Connection *conn, Value_P A, Value_P B )
+{
+    PreparedStatement *prepared = conn->find_prepared_statement( value_to_statement_handle( qct, A ) );
+    ArgListBuilder *arg_list = prepared->get_builder();
+
+    if( !prepared->is_query() && conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+
+    // The statement is left ready for the next call, also when it fails
+    TimedStatement timed( conn, prepared->get_sql(), prepared->get_statement(), prepared->is_query() );
+    Value_P result;
+    try {
+        result = run_builder( arg_list, B, conn->get_temporal_mode() );
+    }
+    catch( ... ) {
+        arg_list->clear_args();
+        throw;
+    }
+    arg_list->clear_args();
+    timed.finish( B, result );
+    return Token( TOK_APL_VALUE1, result );
+}
+
+static Token describe_prepared( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    ArgListBuilder *arg_list = conn->find_prepared_statement( value_to_statement_handle( qct, B ) )->get_builder();
+
+    vector<ColumnDescriptor> cols;
+    arg_list->describe_columns( cols );
+
+    Value_P value( new Value( Shape( 2 ), LOC ) );
+    new (value->next_ravel()) IntCell( arg_list->get_param_count() );
+    new (value->next_ravel()) PointerCell( make_columns_value( cols ) );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token finalize_prepared( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    conn->remove_prepared_statement( value_to_statement_handle( qct, B ) );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token set_type_hints( APL_Float qct, Connection *conn, Value_P A, Value_P B )
+{
+    ArgListBuilder *arg_list = conn->find_prepared_statement( value_to_statement_handle( qct, A ) )->get_builder();
+    if( !B->is_char_string() && B->element_count() > 0 ) {
+        Workspace::more_error() = "Type hints must be a string";
+        DOMAIN_ERROR;
+    }
+
+    string hints = B->element_count() == 0 ? "" : to_string( B->get_UCS_ravel() );
+    for( string::iterator i = hints.begin() ; i != hints.end() ; i++ ) {
+        if( !is_valid_type_hint( *i ) ) {
+            stringstream out;
+            out << "Illegal type hint: " << *i << ", expected one of i, f, s or ?";
+            Workspace::more_error() = out.str().c_str();
+            DOMAIN_ERROR;
+        }
+    }
+
+    arg_list->set_type_hints( hints );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static long value_to_result_handle( APL_Float qct, Value_P value )
+{
+    if( !value->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Result handle must be an integer scalar";
+        DOMAIN_ERROR;
+    }
+    return value->get_ravel( 0 ).get_int_value();
+}
+
+static Token run_retained_query( Connection *conn, Value_P A, Value_P B )
+{
+    if( !A->is_char_string() ) {
+        Workspace::more_error() = "Illegal query argument type";
+        VALUE_ERROR;
+    }
+    if( B->get_rank() > 1 ) {
+        Workspace::more_error() = "Bind params have illegal rank";
+        RANK_ERROR;
+    }
+
+    string sql = to_string( A->get_UCS_ravel() );
+    string statement = conn->replace_bind_args( sql );
+    TimedStatement timed( conn, sql, statement, true );
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_query( statement ) );
+    bind_args( arg_list.get(), B, 0, B->element_count(), conn->get_temporal_mode() );
+    long handle = conn->add_retained_result( arg_list->run_retained_query() );
+    timed.finish( B, Idx0( LOC ) );
+    return Token( TOK_APL_VALUE1, Value_P( new Value( IntCell( handle ), LOC ) ) );
+}
+
+static long cell_to_non_negative( const Cell &cell, const char *message )
+{
+    if( !cell.is_integer_cell() || cell.get_int_value() < 0 ) {
+        Workspace::more_error() = message;
+        DOMAIN_ERROR;
+    }
+    return cell.get_int_value();
+}
+
+/*
+ * B is the first row and the number of rows, optionally nested with a
+ * vector of column indexes. Rows past the end of the result are left
+ * out, so that a result can be read in pages without knowing its size.
+ */
+static Token fetch_retained( APL_Float qct, Connection *conn, Value_P A, Value_P B )
+{
+    RetainedResult *retained = conn->find_retained_result( value_to_result_handle( qct, A ) );
+    const APL_Integer qio = Workspace::get_IO();
+
+    Value_P range = B;
+    Value_P col_value;
+    if( B->element_count() == 2 && B->get_ravel( 0 ).is_pointer_cell() ) {
+        range = B->get_ravel( 0 ).to_value( LOC );
+        col_value = B->get_ravel( 1 ).to_value( LOC );
+    }
+    if( range->get_rank() > 1 || range->element_count() != 2 ) {
+        Workspace::more_error() = "Rows must be the first row and the number of rows";
+        LENGTH_ERROR;
+    }
+
+    long row_count = retained->get_row_count();
+    long start = cell_to_non_negative( range->get_ravel( 0 ), "First row must be an integer" ) - qio;
+    long count = cell_to_non_negative( range->get_ravel( 1 ), "Number of rows must be a non-negative integer" );
+    if( start < 0 ) {
+        Workspace::more_error() = "First row must be an integer";
+        DOMAIN_ERROR;
+    }
+    long end = start + count > row_count ? row_count : start + count;
+
+    int col_count = retained->get_column_count();
+    vector<int> cols;
+    if( col_value.get() == NULL || col_value->element_count() == 0 ) {
+        for( int col = 0 ; col < col_count ; col++ ) {
+            cols.push_back( col );
+        }
+    }
+    else {
+        for( int i = 0 ; i < col_value->element_count() ; i++ ) {
+            long col = cell_to_non_negative( col_value->get_ravel( i ), "Column must be an integer" ) - qio;
+            if( col < 0 || col >= col_count ) {
+                Workspace::more_error() = "Column index out of range";
+                DOMAIN_ERROR;
+            }
+            cols.push_back( col );
+        }
+    }
+
+    if( start >= end || cols.size() == 0 ) {
+        return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+    }
+    return Token( TOK_APL_VALUE1, retained->fetch( start, end, cols ) );
+}
+
+static Token describe_retained( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    RetainedResult *retained = conn->find_retained_result( value_to_result_handle( qct, B ) );
+
+    Value_P value( new Value( Shape( 2 ), LOC ) );
+    new (value->next_ravel()) IntCell( retained->get_row_count() );
+    new (value->next_ravel()) IntCell( retained->get_column_count() );
+    value->check_value( LOC );
+    return Token( TOK_APL_VALUE1, value );
+}
+
+static Token release_retained( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    conn->remove_retained_result( value_to_result_handle( qct, B ) );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token configure_write_behind( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+
+    // The config is the number of rows per transaction, optionally
+    // followed by the longest time in milliseconds before rows are
+    // written
+    int n = B->element_count();
+    if( n < 1 || n > 2 || B->get_rank() > 1 ) {
+        Workspace::more_error() = "Write-behind config must be rows and delay";
+        LENGTH_ERROR;
+    }
+    for( int i = 0 ; i < n ; i++ ) {
+        if( !B->get_ravel( i ).is_integer_cell() ) {
+            Workspace::more_error() = "Write-behind rows and delay must be integers";
+            DOMAIN_ERROR;
+        }
+    }
+
+    long max_rows = B->get_ravel( 0 ).get_int_value();
+    long max_delay_ms = n == 2 ? B->get_ravel( 1 ).get_int_value() : 100;
+    if( max_rows <= 0 ) {
+        string error = conn->disable_write_behind();
+        if( error.size() > 0 ) {
+            Workspace::more_error() = error.c_str();
+            DOMAIN_ERROR;
+        }
+    }
+    else {
+        if( max_delay_ms <= 0 ) {
+            Workspace::more_error() = "Write-behind delay must be positive";
+            DOMAIN_ERROR;
+        }
+        conn->enable_write_behind( max_rows, max_delay_ms );
+    }
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token flush_write_behind( APL_Float qct, Value_P B )
+{
+    // Getting the connection waits for the queue and raises any error
+    ConnectionRef conn = value_to_db_id( qct, B );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token show_cache_stats( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    ResultCache *cache = conn->get_cache();
+    if( cache == NULL ) {
+        Workspace::more_error() = "Result cache is not enabled for this connection";
+        DOMAIN_ERROR;
+    }
+    return Token( TOK_APL_VALUE1, cache->make_stats_value() );
+}
+
+#ifdef HAVE_SQLITE3
+static SqliteConnection *to_sqlite_connection( Connection *conn )
+{
+    SqliteConnection *sqlite_conn = dynamic_cast<SqliteConnection *>( conn );
+    if( sqlite_conn == NULL ) {
+        Workspace::more_error() = "Function is only supported for SQLite databases";
+        DOMAIN_ERROR;
+    }
+    return sqlite_conn;
+}
+
+static int value_to_pages_per_step( APL_Float qct, Value_P B )
+{
+    if( B->element_count() == 0 ) {
+        return -1;
+    }
+    if( !B->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Pages per step must be an integer";
+        DOMAIN_ERROR;
+    }
+    int pages = B->get_ravel( 0 ).get_int_value();
+    return pages > 0 ? pages : -1;
+}
+
+static Token run_backup( APL_Float qct, Connection *conn, Value_P A, Value_P B, bool load )
+{
+    if( !A->is_char_string() ) {
+        Workspace::more_error() = "Illegal database file name";
+        DOMAIN_ERROR;
+    }
+
+    SqliteConnection *sqlite_conn = to_sqlite_connection( conn );
+    string filename = to_string( A->get_UCS_ravel() );
+    int pages_per_step = value_to_pages_per_step( qct, B );
+    if( load ) {
+        if( conn->get_cache() != NULL ) {
+            conn->get_cache()->clear();
+        }
+        sqlite_conn->load_file( filename, pages_per_step );
+    }
+    else {
+        sqlite_conn->save_file( filename, pages_per_step );
+    }
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token run_serialize( APL_Float qct, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, B );
+    return Token( TOK_APL_VALUE1, to_sqlite_connection( conn )->serialize() );
+}
+
+static Token run_deserialize( APL_Float qct, Value_P A, Value_P B )
+{
+    ConnectionRef conn = value_to_db_id( qct, A );
+    SqliteConnection *sqlite_conn = to_sqlite_connection( conn );
+
+    // Accept both integers and characters in the range 0-255, since
+    // ⎕FIO returns file content as characters
+    int size = B->element_count();
+    vector<unsigned char> content( size );
+    for( int i = 0 ; i < size ; i++ ) {
+        const Cell &cell = B->get_ravel( i );
+        int byte;
+        if( cell.is_integer_cell() ) {
+            byte = cell.get_int_value();
+        }
+        else if( cell.is_character_cell() ) {
+            byte = cell.get_char_value();
+        }
+        else {
+            byte = -1;
+        }
+        if( byte < 0 || byte > 255 ) {
+            Workspace::more_error() = "Database content must be a vector of bytes";
+            DOMAIN_ERROR;
+        }
+        content[i] = byte;
+    }
+
+    if( conn->get_cache() != NULL ) {
+        conn->get_cache()->clear();
+    }
+    sqlite_conn->deserialize( content );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static string value_to_name( Value_P value )
+{
+    if( !value->is_char_string() ) {
+        Workspace::more_error() = "Function names must be strings";
+        DOMAIN_ERROR;
+    }
+    return to_string( value->get_UCS_ravel() );
+}
+
+static Token run_create_function( APL_Float qct, Connection *conn, Value_P A, Value_P B, bool aggregate )
+{
+    if( A->get_rank() != 1 || A->element_count() != 2 ) {
+        Workspace::more_error() = "Function definition must be the SQL name followed by the APL name";
+        LENGTH_ERROR;
+    }
+    if( !B->is_int_scalar( qct ) ) {
+        Workspace::more_error() = "Number of arguments must be an integer";
+        DOMAIN_ERROR;
+    }
+
+    string sql_name = value_to_name( A->get_ravel( 0 ).to_value( LOC ) );
+    string apl_name = value_to_name( A->get_ravel( 1 ).to_value( LOC ) );
+    to_sqlite_connection( conn )->create_function( sql_name, apl_name, B->get_ravel( 0 ).get_int_value(), aggregate );
+
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+
+static Token run_create_virtual_table( Connection *conn, Value_P A, Value_P B )
+{
+    string name;
+    vector<string> column_names;
+    if( A->is_char_string() ) {
+        name = to_string( A->get_UCS_ravel() );
+    }
+    else {
+        for( int i = 0 ; i < A->element_count() ; i++ ) {
+            string s = value_to_name( A->get_ravel( i ).to_value( LOC ) );
+            if( i == 0 ) {
+                name = s;
+            }
+            else {
+                column_names.push_back( s );
+            }
+        }
+    }
+
+    if( B->get_rank() > 2 ) {
+        Workspace::more_error() = "Virtual table content must be a vector or a matrix";
+        RANK_ERROR;
+    }
+
+    to_sqlite_connection( conn )->create_virtual_table( name, B, column_names );
+    return Token( TOK_APL_VALUE1, Idx0( LOC ) );
+}
+#endif
+
+Fun_signature get_signature()
+{
+    std::call_once( providers_initialised, init_provider_map );
+    return SIG_Z_A_F2_B;
+}
+
+bool close_fun( Cause cause, const NativeFunction *caller )
+{
+    connections.close_all();
+    ThreadPool::shutdown();
+
+    return false;
+}
+
+Token eval_B( Value_P B )
+{
+    return list_functions( COUT );
+}
+
+Token eval_AB( Value_P A, Value_P B )
+{
+    return list_functions( COUT );
+}
+
+Token eval_XB(Value_P X, Value_P B)
+{
+    const APL_Float qct = Workspace::get_CT();
+    const int function_number = X->get_ravel( 0 ).get_near_int( qct );
+
+    switch( function_number ) {
+    case 0:
+        return list_functions( CERR );
+
+    case 2:
+        return close_database( qct, B );
+
+    case 5:
+        return run_transaction_begin( qct, B );
+
+    case 6:
+        return run_transaction_commit( qct, B );
+
+    case 7:
+        return run_transaction_rollback( qct, B );
+
+    case 8:
+        return show_tables( qct, B );
+
+    case 18:
+        return show_cache_stats( qct, B );
+
+    case 19:
+        return show_query_stats();
+
+    case 20:
+        return run_reset_query_stats();
+
+    case 21:
+        return run_set_stats_level( qct, B );
+
+    case 23:
+        return show_slow_log( qct, B );
+
+    case 29:
+        return flush_write_behind( qct, B );
+
+#ifdef HAVE_SQLITE3
+    case 12:
+        return run_serialize( qct, B );
+#endif
+
+    default:
+        Workspace::more_error() = "Illegal function number";
+        DOMAIN_ERROR;
+    }
+}
+
+static ConnectionRef param_to_db( APL_Float qct, Value_P X, bool exclusive = true )
+{
+    const Shape &shape = X->get_shape();
+    if( shape.get_volume() != 2 ) {
+        Workspace::more_error() = "Database id missing from axis parameter";
+        RANK_ERROR;
+    }
+    return db_id_to_connection( X->get_ravel( 1 ).get_near_int( qct ), exclusive );
+}
+
+Token eval_AXB(const Value_P A, const Value_P X, const Value_P B)
+{
+    const APL_Float qct = Workspace::get_CT();
+    const int function_number = X->get_ravel( 0 ).get_near_int( qct );
+
+    switch( function_number ) {
+    case 0:
+        return list_functions( CERR );
+
+    case 1:
+        return open_database( A, B );
+
+    case 3:
+        return run_query( param_to_db( qct, X ), A, B );
+
+    case 4:
+        // Doesn't wait for the write-behind queue, since the update
+        // may be added to it
+        return run_update( param_to_db( qct, X, false ), A, B );
+
+    case 9:
+        return show_cols( qct, A, B );
+
+    case 35:
+        return show_table_info( qct, A, B );
+
+    case 17:
+        return configure_cache( qct, A, B );
+
+    case 22:
+        return configure_slow_log( qct, A, B );
+
+    case 33:
+        return configure_temporal_mode( qct, A, B );
+
+    case 36:
+        return configure_limits( qct, A, B );
+
+    case 24:
+        return run_prepare( qct, param_to_db( qct, X ), A, B );
+
+    case 25:
+        return run_execute( qct, param_to_db( qct, X ), A, B );
+
+    case 26:
+        return describe_prepared( qct, A, B );
+
+    case 27:
+        return finalize_prepared( qct, A, B );
+
+    case 28:
+        return configure_write_behind( qct, A, B );
+
+    case 30:
+        return run_batch_query( param_to_db( qct, X ), A, B );
+
+    case 31:
+        return run_statement_batch( param_to_db( qct, X ), A );
+
+    case 32:
+        return run_bulk_load( param_to_db( qct, X ), A, B );
+
+    case 34:
+        return set_type_hints( qct, param_to_db( qct, X ), A, B );
+
+    case 37:
+        return run_query_with_sentinels( param_to_db( qct, X ), A, B );
+
+    case 38:
+        return run_retained_query( param_to_db( qct, X ), A, B );
+
+    case 39:
+        return fetch_retained( qct, param_to_db( qct, X ), A, B );
+
+    case 40:
+        return describe_retained( qct, A, B );
+
+    case 41:
+        return release_retained( qct, A, B );
+
+    case 42:
+        return run_upsert( param_to_db( qct, X ), A, B );
+
+    case 43:
+        return run_import( param_to_db( qct, X ), A, B );
+
+#ifdef HAVE_SQLITE3
+    case 10:
+        return run_backup( qct, param_to_db( qct, X ), A, B, true );
+
+    case 11:
+        return run_backup( qct, param_to_db( qct, X ), A, B, false );
+
+    case 13:
+        return run_deserialize( qct, A, B );
+
+    case 14:
+        return run_create_function( qct, param_to_db( qct, X ), A, B, false );
+
+    case 15:
+        return run_create_function( qct, param_to_db( qct, X ), A, B, true );
+
+    case 16:
+        return run_create_virtual_table( param_to_db( qct, X ), A, B );
+#endif
+
+    default:
+        Workspace::more_error() = "Illegal function number";
+        DOMAIN_ERROR;
+    }
+}
+
+void *get_function_mux( const char *function_name )
+{
+    if( strcmp( function_name, "get_signature" ) == 0 ) return (void *)&get_signature;
+    if( strcmp( function_name, "eval_B" ) == 0 )        return (void *)&eval_B;
+    if( strcmp( function_name, "eval_AB" ) == 0 )       return (void *)&eval_AB;
+    if( strcmp( function_name, "eval_XB" ) == 0 )       return (void *)&eval_XB;
+    if( strcmp( function_name, "eval_AXB" ) == 0 )      return (void *)&eval_AXB;
+    if( strcmp( function_name, "close_fun" ) == 0 )     return (void *)&close_fun;
+    return 0;
+}
+
+const UCS_string ucs_string_from_string( const std::string &string )
+{
+    size_t length = string.size();
+    const char *buf = string.c_str();
+    UTF8_string utf( (const UTF8 *)buf, length );
+    return UCS_string( utf );
+}
+
+Value_P make_string_cell( const std::string &string, const char *loc )
+{
+    return make_ucs_string_cell( ucs_string_from_string( string ), loc );
+}
+
+Value_P make_ucs_string_cell( const UCS_string &s, const char *loc )
+{
+    PhaseTimer timer( PHASE_STRINGS );
     Shape shape( s.size() );
     Value_P cell( new Value( shape, loc ) );
     for( int i = 0 ; i < s.size() ; i++ ) {
@@ -468,3 +2127,15 @@ Value_P make_string_cell( const std::string &string, const char *loc )
     cell->check_value( loc );
     return cell;
 }
+
+long estimate_value_size( Value_P value )
+{
+    long size = sizeof( Value ) + value->element_count() * sizeof( Cell );
+    for( int i = 0 ; i < value->element_count() ; i++ ) {
+        const Cell &cell = value->get_ravel( i );
+        if( cell.is_pointer_cell() ) {
+            size += estimate_value_size( cell.get_pointer_value() );
+        }
+    }
+    return size;
+}
@@ -40,6 +40,9 @@ inline std::string to_string(const UCS_string & ucs)
     return string((const char *)(utf.get_items()), utf.size());
 }
 
+const UCS_string ucs_string_from_string( const std::string &string );
 Value_P make_string_cell( const std::string &string, const char *loc );
+Value_P make_ucs_string_cell( const UCS_string &string, const char *loc );
+long estimate_value_size( Value_P value );
 
 #endif
@@ -0,0 +1,412 @@
+/*
+    This file is part of GNU APL, a free implementation of the
+    ISO/IEC Standard 13751, "Programming Language APL, Extended"
+
+    Copyright (C) 2014  Elias Mårtenson
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Throughput benchmark for the native layer. The program drives the
+ * Connection and ArgListBuilder interfaces directly, without going
+ * through the interpreter, and writes one JSON object per line for
+ * each case so that results can be compared between builds.
+ *
+ * Usage: sql_bench [--quick] [--file directory] [--pg conninfo]
+ *
+ * The PostgreSQL cases are run if --pg is given, or if the environment
+ * variable SQL_BENCH_PG is set, and the server can be reached. The
+ * synthetic provider is used to measure selects without any I/O, which
+ * gives the cost of creating the APL result on its own.
+ */
+
+#include "apl-sqlite.hh"
+#include "SqliteConnection.hh"
+#include "PostgresConnection.hh"
+#include "SyntheticConnection.hh"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" void init_libapl( const char *progname, int log_startup );
+
+/*
+ * Allocation counters. Every allocation made by the library, including
+ * the ones made by the interpreter when creating values, goes through
+ * these operators.
+ */
+static std::atomic<long> alloc_count( 0 );
+static std::atomic<long> alloc_bytes( 0 );
+
+void *operator new( size_t size )
+{
+    alloc_count.fetch_add( 1, std::memory_order_relaxed );
+    alloc_bytes.fetch_add( size, std::memory_order_relaxed );
+    void *ptr = malloc( size == 0 ? 1 : size );
+    if( ptr == NULL ) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[]( size_t size )
+{
+    return operator new( size );
+}
+
+void operator delete( void *ptr ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete[]( void *ptr ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete( void *ptr, size_t ) noexcept
+{
+    free( ptr );
+}
+
+void operator delete[]( void *ptr, size_t ) noexcept
+{
+    free( ptr );
+}
+
+enum ColumnKind {
+    KIND_INT,
+    KIND_FLOAT,
+    KIND_SHORT_TEXT,
+    KIND_LONG_TEXT,
+    KIND_NULL_HEAVY
+};
+
+static const char *kind_names[] = { "int", "float", "short_text", "long_text", "null_heavy" };
+static const int NUM_KINDS = sizeof( kind_names ) / sizeof( kind_names[0] );
+
+static const int LONG_TEXT_LENGTH = 1000;
+
+class Backend {
+public:
+    Backend( const string &name_in, Connection *conn_in, bool postgres_in, bool synthetic_in )
+        : name( name_in ), conn( conn_in ), postgres( postgres_in ), synthetic( synthetic_in ) {}
+    ~Backend() { delete conn; }
+    const string name;
+    Connection *conn;
+    const bool postgres;
+    const bool synthetic;
+};
+
+class Measurement {
+public:
+    Measurement() {
+        start_count = alloc_count.load();
+        start_bytes = alloc_bytes.load();
+        start_time = std::chrono::steady_clock::now();
+    }
+    void finish( void ) {
+        seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start_time ).count();
+        allocs = alloc_count.load() - start_count;
+        bytes_allocated = alloc_bytes.load() - start_bytes;
+    }
+    double seconds;
+    long allocs;
+    long bytes_allocated;
+
+private:
+    long start_count;
+    long start_bytes;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+static const string column_type( Backend &backend, ColumnKind kind )
+{
+    switch( kind ) {
+    case KIND_INT:
+    case KIND_NULL_HEAVY:
+        return backend.postgres ? "bigint" : "integer";
+    case KIND_FLOAT:
+        return backend.postgres ? "double precision" : "real";
+    default:
+        return "text";
+    }
+}
+
+/*
+ * Binds the value of one cell of the generated table and returns the
+ * number of bytes of payload it represents.
+ */
+static long bind_cell( ArgListBuilder *arg_list, ColumnKind kind, int row, int col, const string &long_text )
+{
+    switch( kind ) {
+    case KIND_INT:
+        arg_list->append_long( row * 31L + col, col );
+        return sizeof( long );
+    case KIND_FLOAT:
+        arg_list->append_double( row * 0.5 + col, col );
+        return sizeof( double );
+    case KIND_SHORT_TEXT: {
+        char buf[32];
+        snprintf( buf, sizeof( buf ), "v%d_%d", row, col );
+        arg_list->append_string( buf, col );
+        return strlen( buf );
+    }
+    case KIND_LONG_TEXT:
+        arg_list->append_string( long_text, col );
+        return long_text.size();
+    case KIND_NULL_HEAVY:
+        if( (row + col) % 10 == 0 ) {
+            arg_list->append_long( row, col );
+            return sizeof( long );
+        }
+        arg_list->append_null( col );
+        return 0;
+    }
+    return 0;
+}
+
+static void print_result( Backend &backend, const char *op, const char *mode, ColumnKind kind,
+                          int rows, int cols, long bytes, Measurement &m )
+{
+    printf( "{\"backend\":\"%s\",\"op\":\"%s\",\"mode\":\"%s\",\"type\":\"%s\","
+            "\"rows\":%d,\"cols\":%d,\"seconds\":%.6f,\"rows_per_s\":%.1f,\"bytes_per_s\":%.1f,"
+            "\"allocs\":%ld,\"alloc_bytes\":%ld,\"allocs_per_row\":%.2f}\n",
+            backend.name.c_str(), op, mode, kind_names[kind],
+            rows, cols, m.seconds, rows / m.seconds, bytes / m.seconds,
+            m.allocs, m.bytes_allocated, static_cast<double>( m.allocs ) / rows );
+    fflush( stdout );
+}
+
+static void run_update( Connection *conn, const string &sql )
+{
+    auto_ptr<ArgListBuilder> arg_list( conn->make_prepared_update( sql ) );
+    arg_list->run_query( true );
+}
+
+static void create_table( Backend &backend, ColumnKind kind, int cols )
+{
+    try {
+        run_update( backend.conn, "drop table bench" );
+    }
+    catch( ... ) {
+        // The table did not exist
+    }
+
+    stringstream sql;
+    sql << "create table bench (";
+    for( int col = 0 ; col < cols ; col++ ) {
+        sql << (col == 0 ? "" : ", ") << "c" << col << " " << column_type( backend, kind );
+    }
+    sql << ")";
+    run_update( backend.conn, sql.str() );
+}
+
+/*
+ * Inserts the rows either the way a rank-2 argument is handled, with
+ * one prepared statement that is rebound for each row, or the way a
+ * sequence of single-row calls is handled, preparing the statement for
+ * every row.
+ */
+static void bench_insert( Backend &backend, ColumnKind kind, int rows, int cols, bool batch )
+{
+    create_table( backend, kind, cols );
+
+    stringstream sql;
+    sql << "insert into bench values (";
+    for( int col = 0 ; col < cols ; col++ ) {
+        sql << (col == 0 ? "?" : ", ?");
+    }
+    sql << ")";
+    const string statement = backend.conn->replace_bind_args( sql.str() );
+    const string long_text( LONG_TEXT_LENGTH, 'x' );
+
+    long bytes = 0;
+    Measurement m;
+    backend.conn->transaction_begin();
+    if( batch ) {
+        auto_ptr<ArgListBuilder> arg_list( backend.conn->make_prepared_update( statement ) );
+        for( int row = 0 ; row < rows ; row++ ) {
+            for( int col = 0 ; col < cols ; col++ ) {
+                bytes += bind_cell( arg_list.get(), kind, row, col, long_text );
+            }
+            arg_list->run_query( true );
+            arg_list->clear_args();
+        }
+    }
+    else {
+        for( int row = 0 ; row < rows ; row++ ) {
+            auto_ptr<ArgListBuilder> arg_list( backend.conn->make_prepared_update( statement ) );
+            for( int col = 0 ; col < cols ; col++ ) {
+                bytes += bind_cell( arg_list.get(), kind, row, col, long_text );
+            }
+            arg_list->run_query( false );
+        }
+    }
+    backend.conn->transaction_commit();
+    m.finish();
+
+    print_result( backend, "insert", batch ? "batch" : "single", kind, rows, cols, bytes, m );
+}
+
+static void bench_select( Backend &backend, ColumnKind kind, int rows, int cols )
+{
+    Measurement m;
+    auto_ptr<ArgListBuilder> arg_list( backend.conn->make_prepared_query( "select * from bench" ) );
+    Value_P result = arg_list->run_query( false );
+    m.finish();
+
+    int result_rows = result->get_rank() == 2 ? result->get_rows() : 0;
+    if( result_rows != rows ) {
+        fprintf( stderr, "%s: expected %d rows, got %d\n", backend.name.c_str(), rows, result_rows );
+    }
+    print_result( backend, "select", "all", kind, rows, cols, estimate_value_size( result ), m );
+}
+
+static const int full_row_counts[] = { 1000, 10000, 100000 };
+static const int quick_row_counts[] = { 1000, 10000 };
+static const int col_counts[] = { 1, 4, 16 };
+
+static void bench_synthetic( Backend &backend, ColumnKind kind, int rows, int cols )
+{
+    static const char synthetic_types[] = { 'i', 'f', 's', 't', 'i' };
+
+    stringstream sql;
+    sql << "select rows=" << rows << " types=" << string( cols, synthetic_types[kind] )
+        << " string_length=" << LONG_TEXT_LENGTH << " null_percent=" << (kind == KIND_NULL_HEAVY ? 90 : 0);
+
+    Measurement m;
+    auto_ptr<ArgListBuilder> arg_list( backend.conn->make_prepared_query( sql.str() ) );
+    Value_P result = arg_list->run_query( false );
+    m.finish();
+
+    print_result( backend, "select", "all", kind, rows, cols, estimate_value_size( result ), m );
+}
+
+static void bench_backend( Backend &backend, bool quick )
+{
+    const int *row_counts = quick ? quick_row_counts : full_row_counts;
+    int num_row_counts = quick ? 2 : 3;
+
+    for( int k = 0 ; k < NUM_KINDS ; k++ ) {
+        ColumnKind kind = static_cast<ColumnKind>( k );
+        for( int r = 0 ; r < num_row_counts ; r++ ) {
+            for( int c = 0 ; c < 3 ; c++ ) {
+                int rows = row_counts[r];
+                int cols = col_counts[c];
+
+                // Keep the largest cases to a reasonable size
+                if( kind == KIND_LONG_TEXT && static_cast<long>( rows ) * cols > 40000 ) {
+                    continue;
+                }
+
+                try {
+                    if( backend.synthetic ) {
+                        bench_synthetic( backend, kind, rows, cols );
+                        continue;
+                    }
+                    bench_insert( backend, kind, rows, cols, false );
+                    bench_insert( backend, kind, rows, cols, true );
+                    bench_select( backend, kind, rows, cols );
+                }
+                catch( ... ) {
+                    fprintf( stderr, "%s: %s %dx%d failed: %s\n", backend.name.c_str(), kind_names[kind],
+                             rows, cols, to_string( Workspace::more_error() ).c_str() );
+                    return;
+                }
+            }
+        }
+    }
+
+    if( !backend.synthetic ) {
+        run_update( backend.conn, "drop table bench" );
+    }
+}
+
+static Backend *open_sqlite( const string &name, const string &filename )
+{
+    sqlite3 *db;
+    if( sqlite3_open( filename.c_str(), &db ) != SQLITE_OK ) {
+        fprintf( stderr, "Unable to open %s: %s\n", filename.c_str(), sqlite3_errmsg( db ) );
+        sqlite3_close( db );
+        return NULL;
+    }
+    return new Backend( name, new SqliteConnection( db ), false, false );
+}
+
+static Backend *open_postgres( const string &conninfo )
+{
+    PGconn *db = PQconnectdb( conninfo.c_str() );
+    if( PQstatus( db ) != CONNECTION_OK ) {
+        fprintf( stderr, "Skipping postgresql: %s", PQerrorMessage( db ) );
+        PQfinish( db );
+        return NULL;
+    }
+    return new Backend( "postgresql", new PostgresConnection( db ), true, false );
+}
+
+int main( int argc, char **argv )
+{
+    bool quick = false;
+    string directory = "/tmp";
+    const char *conninfo = getenv( "SQL_BENCH_PG" );
+
+    for( int i = 1 ; i < argc ; i++ ) {
+        string arg = argv[i];
+        if( arg == "--quick" ) {
+            quick = true;
+        }
+        else if( arg == "--file" && i + 1 < argc ) {
+            directory = argv[++i];
+        }
+        else if( arg == "--pg" && i + 1 < argc ) {
+            conninfo = argv[++i];
+        }
+        else {
+            fprintf( stderr, "Usage: %s [--quick] [--file directory] [--pg conninfo]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    init_libapl( argv[0], 0 );
+
+    vector<Backend *> backends;
+    backends.push_back( new Backend( "synthetic", new SyntheticConnection( SyntheticSpec() ), false, true ) );
+    backends.push_back( open_sqlite( "sqlite-memory", ":memory:" ) );
+
+    stringstream filename;
+    filename << directory << "/sql_bench_" << getpid() << ".db";
+    backends.push_back( open_sqlite( "sqlite-file", filename.str() ) );
+
+    if( conninfo != NULL ) {
+        backends.push_back( open_postgres( conninfo ) );
+    }
+
+    for( vector<Backend *>::iterator i = backends.begin() ; i != backends.end() ; i++ ) {
+        if( *i != NULL ) {
+            bench_backend( **i, quick );
+            delete *i;
+        }
+    }
+
+    unlink( filename.str().c_str() );
+    return 0;
+}